@@ -0,0 +1,125 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+
+// Micro-benchmark of `array_push` against the previous stretchy buffer (which reallocated its memory on every push),
+// when pushing bytes one by one (like an output being captured) and runs one by one (like a runs file being read).
+
+#define BYTES_COUNT (1 << 20)
+#define RUNS_COUNT (1 << 17)
+
+// Pushes an element like the previous stretchy buffer did (only prefixed by its size, and reallocated on every push).
+static int realloc_push(void **array, const void *item, uint32_t item_size) {
+    uint64_t size = *array ? *(uint64_t *)((uint8_t *)*array - sizeof(uint64_t)) : 0;
+    void *tmp = realloc(*array ? (uint8_t *)*array - sizeof(uint64_t) : NULL, sizeof(uint64_t) + item_size * (size + 1));
+    assert(tmp);
+    
+    assert(memcpy((uint8_t *)tmp + sizeof(uint64_t) + item_size * size, item, item_size) != NULL);
+    *(uint64_t *)tmp = size + 1;
+    *array = (uint8_t *)tmp + sizeof(uint64_t);
+    
+    return 0;
+}
+
+static void realloc_free(void *array) {
+    if (array != NULL) {
+        free((uint8_t *)array - sizeof(uint64_t));
+    }
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1e3 + (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int main() {
+    struct timespec start;
+    struct timespec end;
+    unsigned int mismatches = 0;
+    
+    // Pushes bytes one by one.
+    uint8_t *realloc_bytes = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < BYTES_COUNT; i++) {
+        uint8_t byte = (uint8_t)i;
+        if (realloc_push((void **)&realloc_bytes, &byte, sizeof(byte)) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double realloc_bytes_ms = elapsed_ms(&start, &end);
+    
+    uint8_t *bytes = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < BYTES_COUNT; i++) {
+        uint8_t byte = (uint8_t)i;
+        if (array_push(bytes, byte) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double bytes_ms = elapsed_ms(&start, &end);
+    
+    if (array_size(bytes) != BYTES_COUNT || memcmp(bytes, realloc_bytes, BYTES_COUNT) != 0) {
+        mismatches++;
+    }
+    
+    // Pushes the same bytes at once.
+    uint8_t *bulk_bytes = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (array_push_n(bulk_bytes, bytes, BYTES_COUNT) == -1) {
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double bulk_bytes_ms = elapsed_ms(&start, &end);
+    
+    if (array_size(bulk_bytes) != BYTES_COUNT || memcmp(bulk_bytes, bytes, BYTES_COUNT) != 0) {
+        mismatches++;
+    }
+    
+    // Pushes runs one by one.
+    run *realloc_runs = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < RUNS_COUNT; i++) {
+        run cur_run = { .time = i, .exitcode = (uint16_t)i };
+        if (realloc_push((void **)&realloc_runs, &cur_run, sizeof(cur_run)) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double realloc_runs_ms = elapsed_ms(&start, &end);
+    
+    run *runs = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < RUNS_COUNT; i++) {
+        run cur_run = { .time = i, .exitcode = (uint16_t)i };
+        if (array_push(runs, cur_run) == -1) {
+            return EXIT_FAILURE;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double runs_ms = elapsed_ms(&start, &end);
+    
+    if (array_size(runs) != RUNS_COUNT || array_last(runs).time != realloc_runs[RUNS_COUNT - 1].time) {
+        mismatches++;
+    }
+    
+    printf("bytes pushed:      %u\n", BYTES_COUNT);
+    printf("realloc per push:  %.2f ms\n", realloc_bytes_ms);
+    printf("array_push:        %.2f ms (x%.1f)\n", bytes_ms, realloc_bytes_ms / bytes_ms);
+    printf("array_push_n:      %.2f ms (x%.1f)\n", bulk_bytes_ms, realloc_bytes_ms / bulk_bytes_ms);
+    printf("runs pushed:       %u\n", RUNS_COUNT);
+    printf("realloc per push:  %.2f ms\n", realloc_runs_ms);
+    printf("array_push:        %.2f ms (x%.1f)\n", runs_ms, realloc_runs_ms / runs_ms);
+    printf("mismatches:        %u\n", mismatches);
+    
+    realloc_free(realloc_bytes);
+    realloc_free(realloc_runs);
+    array_free(bytes);
+    array_free(bulk_bytes);
+    array_free(runs);
+    
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,97 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+#include <sy5/history.h>
+
+// Micro-benchmark of the output history: the throughput of appending runs (with their outputs compressed), the
+// compression ratio and the latency of fetching the output of a past run by index and by time.
+
+#define DEFAULT_RUNS_COUNT 2000
+
+#define OUTPUT_LENGTH (32 * 1024)
+
+#define FETCHES_COUNT 1000
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1e3 + (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Fills an output like the ones of most tasks (lines of a log, mostly alike).
+static void fill_output(uint8_t *output, uint32_t length, uint64_t run) {
+    uint32_t position = 0;
+    for (uint64_t line = 0; position < length; line++) {
+        char text[128];
+        int count = snprintf(text, sizeof(text), "[run %lu] line %lu: processed %lu items in %lu ms\n",
+            (unsigned long)run, (unsigned long)line, (unsigned long)(line * 37 % 1000), (unsigned long)(line % 13));
+        uint32_t copied = (uint32_t)count < length - position ? (uint32_t)count : length - position;
+        memcpy(output + position, text, copied);
+        position += copied;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint64_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_RUNS_COUNT;
+    
+    char path[] = "/tmp/saturnd-bench-history-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    
+    history history;
+    uint8_t *output = malloc(OUTPUT_LENGTH);
+    if (output == NULL || open_history(&history, path, 1) == -1) {
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    
+    struct timespec start;
+    struct timespec end;
+    int err = 0;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t i = 0; err != -1 && i < count; i++) {
+        fill_output(output, OUTPUT_LENGTH, i);
+        string outputs[2] = { { .length = OUTPUT_LENGTH, .data = output }, { .length = 0, .data = NULL } };
+        err = append_history(&history, i * 60, outputs);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double append_ms = elapsed_ms(&start, &end);
+    
+    double raw_mb = (double)count * OUTPUT_LENGTH / (1024 * 1024);
+    printf("runs appended:  %lu (%d KiB of stdout each)\n", (unsigned long)count, OUTPUT_LENGTH / 1024);
+    printf("append:         %.2f ms (%.1f MB/s)\n", append_ms, raw_mb / (append_ms / 1e3));
+    printf("history size:   %.2f MB (ratio %.1f)\n", (double)history.size / (1024 * 1024),
+        raw_mb * 1024 * 1024 / (double)history.size);
+    
+    // Fetches runs spread over the whole history, by index then by time.
+    for (int by_time = 0; err != -1 && by_time < 2; by_time++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (uint64_t i = 0; err != -1 && i < FETCHES_COUNT; i++) {
+            uint64_t index = i * 7919 % count;
+            uint64_t run;
+            string fetched;
+            err = by_time ? find_history_run_at(&history, index * 60 + 30, &run) :
+                find_history_run(&history, (uint32_t)index, &run);
+            err = err != -1 ? read_history_output(&history, run, 0, &fetched) : err;
+            if (err != -1) {
+                free(fetched.data);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("fetch by %-5s  %.2f us per run\n", by_time ? "time" : "index",
+            elapsed_ms(&start, &end) * 1e3 / FETCHES_COUNT);
+    }
+    
+    close_history(&history);
+    free(output);
+    unlink(path);
+    
+    return err != -1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,219 @@
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+#include <sy5/worker.h>
+#include <sy5/journal.h>
+
+// Micro-benchmark of the creation of tasks: a directory and a `task` file per task (like the daemon previously did)
+// against the journal, with a single thread (a `fdatasync` per task) and with several threads (their records being
+// synced together), then the replay of the journal on startup, which must recover every task created. As the records
+// have different lengths and the journal is compacted while the threads append to it (once it outgrows 1 MiB), it
+// also checks that a compaction never loses a record (with `--journal-only`, only the journal with several threads is
+// measured, to run it as a test).
+
+#define DEFAULT_TASKS_COUNT 2000
+
+#define THREADS_COUNT 8
+
+// Maximum length of the padding of the tasks' argument (so that their records have different lengths).
+#define MAX_PADDING_LENGTH 255
+
+// Describes the tasks created by a thread.
+typedef struct creator {
+    pthread_t thread;
+    uint64_t first_taskid;
+    uint64_t count;
+    int err;
+} creator;
+
+static int remove_path(const char *path, const struct stat *stat, int flag, struct FTW *ftw) {
+    (void)stat;
+    (void)flag;
+    (void)ftw;
+    
+    return remove(path);
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1e3 + (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Returns the length of the argument of the task whose taskid is `taskid`.
+static uint32_t argument_length(uint64_t taskid) {
+    return 5 + (uint32_t)(taskid * 7 % (MAX_PADDING_LENGTH + 1));
+}
+
+// Fills a task like the ones created by `cassini -c echo hello!!!`, with a padding depending on its taskid.
+static int fill_task(task *dest, uint64_t taskid) {
+    char argument[5 + MAX_PADDING_LENGTH + 1];
+    uint32_t length = argument_length(taskid);
+    memcpy(argument, "hello", 5);
+    memset(argument + 5, '!', length - 5);
+    argument[length] = '\0';
+    
+    *dest = (task){ .taskid = taskid };
+    assert(timing_from_strings(&dest->timing, "*", "*", "*") != -1);
+    dest->commandline.argc = 2;
+    dest->commandline.argv = calloc(2, sizeof(string));
+    assert(dest->commandline.argv);
+    assert(string_from_cstring(&dest->commandline.argv[0], "echo") != -1);
+    assert(string_from_cstring(&dest->commandline.argv[1], argument) != -1);
+    
+    return 0;
+}
+
+// Checks that the journal holds the `count` tasks created (with their argument).
+// Returns `-1` in case of failure (or if a task is missing), else 0.
+static int check_journal_tasks(const uint64_t *taskids, uint64_t count) {
+    if (array_size(taskids) != count) {
+        fprintf(stderr, "%lu tasks replayed instead of %lu\n", (unsigned long)array_size(taskids),
+            (unsigned long)count);
+        return -1;
+    }
+    
+    for (uint64_t i = 0; i < count; i++) {
+        task found;
+        if (find_journal_task(i, &found) == -1) {
+            fprintf(stderr, "task %lu not replayed\n", (unsigned long)i);
+            return -1;
+        }
+        
+        int err = found.commandline.argc == 2 && found.commandline.argv[1].length == argument_length(i) ? 0 : -1;
+        free_task(&found);
+        if (err == -1) {
+            fprintf(stderr, "task %lu replayed with a wrong argument\n", (unsigned long)i);
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// Creates `count` tasks with their files (the journal being closed).
+static int create_task_files(const char *tasks_path, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        task new_task;
+        assert(fill_task(&new_task, i) != -1);
+        
+        worker *new_worker = NULL;
+        assert(create_worker(&new_worker, &new_task, tasks_path, i, 0) != -1);
+        assert(free_worker(new_worker) != -1);
+    }
+    
+    return 0;
+}
+
+// Creates the tasks of a `creator` in the journal, waiting for each of them to be durable.
+static void *create_journal_tasks(void *arg) {
+    creator *cur_creator = arg;
+    
+    for (uint64_t i = 0; cur_creator->err != -1 && i < cur_creator->count; i++) {
+        task new_task;
+        int64_t seq = -1;
+        cur_creator->err = fill_task(&new_task, cur_creator->first_taskid + i);
+        if (cur_creator->err != -1) {
+            seq = journal_create_task(&new_task);
+            free_task(&new_task);
+        }
+        cur_creator->err = seq != -1 ? sync_journal(seq) : -1;
+    }
+    
+    return NULL;
+}
+
+// Creates `count` tasks in the journal of `tasks_path` with `threads_count` threads.
+// Returns `-1` in case of failure, else 0.
+static int create_tasks_in_journal(const char *tasks_path, uint64_t count, uint32_t threads_count) {
+    assert(create_directory(tasks_path) != -1);
+    assert(open_journal(tasks_path) != -1);
+    
+    creator creators[THREADS_COUNT];
+    int err = 0;
+    uint32_t started = 0;
+    for (; err != -1 && started < threads_count; started++) {
+        creators[started] = (creator){
+            .first_taskid = count / threads_count * started,
+            .count = count / threads_count,
+            .err = 0
+        };
+        err = pthread_create(&creators[started].thread, NULL, create_journal_tasks, &creators[started]) == 0 ? 0 : -1;
+    }
+    
+    for (uint32_t i = 0; i < started; i++) {
+        pthread_join(creators[i].thread, NULL);
+        err = creators[i].err == -1 ? -1 : err;
+    }
+    
+    close_journal();
+    
+    return err;
+}
+
+int main(int argc, char **argv) {
+    uint64_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_TASKS_COUNT;
+    count -= count % THREADS_COUNT;
+    int journal_only = argc > 2 && strcmp(argv[2], "--journal-only") == 0;
+    
+    char root_path[] = "/tmp/saturnd-bench-XXXXXX";
+    if (mkdtemp(root_path) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    
+    char paths[3][PATH_MAX];
+    for (uint32_t i = 0; i < 3; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/%u/", root_path, i);
+    }
+    
+    struct timespec start;
+    struct timespec end;
+    
+    printf("tasks created: %lu\n", (unsigned long)count);
+    printf("layout                 total (ms)  per task (us)\n");
+    
+    int err = 0;
+    double files_ms = 0;
+    if (!journal_only) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        err = create_directory(paths[0]) != -1 ? create_task_files(paths[0], count) : -1;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        files_ms = elapsed_ms(&start, &end);
+        printf("task files             %10.2f  %13.2f\n", files_ms, files_ms * 1e3 / (double)count);
+    }
+    
+    uint32_t threads_counts[] = { 1, THREADS_COUNT };
+    for (uint32_t i = journal_only ? 1 : 0; err != -1 && i < 2; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        err = create_tasks_in_journal(paths[i + 1], count, threads_counts[i]);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double journal_ms = elapsed_ms(&start, &end);
+        printf("journal, %u thread(s)   %10.2f  %13.2f", threads_counts[i], journal_ms,
+            journal_ms * 1e3 / (double)count);
+        printf(journal_only ? "\n" : "  (x%.1f)\n", files_ms / journal_ms);
+    }
+    
+    // Replays the journal written by the threads.
+    uint64_t *taskids = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = err != -1 ? open_journal(paths[2]) : err;
+    err = err != -1 ? list_journal_taskids(&taskids) : err;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (err != -1) {
+        printf("replay                 %10.2f  (%lu tasks)\n", elapsed_ms(&start, &end),
+            (unsigned long)array_size(taskids));
+        err = check_journal_tasks(taskids, count);
+    }
+    array_free(taskids);
+    close_journal();
+    
+    nftw(root_path, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+    
+    return err != -1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+#include <time.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sy5/utils.h>
+
+// Micro-benchmark of the latency of launching a task with `fork` and `execvp` (like the previous executors did) against
+// `posix_spawnp`, depending on the size of the heap of the launching process.
+
+#define SPAWNS_COUNT 200
+
+extern char **environ;
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1e3 + (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Launches `argv` with `fork` and `execvp`, then waits for it.
+static int fork_exec(char **argv) {
+    pid_t pid = fork();
+    assert(pid != -1);
+    
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(EXIT_FAILURE);
+    }
+    
+    int status;
+    assert(waitpid(pid, &status, 0) != -1);
+    
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Launches `argv` with `posix_spawnp`, then waits for it.
+static int spawn(char **argv) {
+    pid_t pid;
+    assert(posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) == 0);
+    
+    int status;
+    assert(waitpid(pid, &status, 0) != -1);
+    
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Returns the average latency (in milliseconds) of `launch`.
+static double average_latency_ms(int (*launch)(char **), char **argv, unsigned int *failures) {
+    struct timespec start;
+    struct timespec end;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < SPAWNS_COUNT; i++) {
+        if (launch(argv) == -1) {
+            (*failures)++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    
+    return elapsed_ms(&start, &end) / SPAWNS_COUNT;
+}
+
+int main() {
+    static const uint32_t heap_sizes_mib[] = { 0, 64, 256, 1024 };
+    char *argv[] = { "true", NULL };
+    unsigned int failures = 0;
+    
+    printf("launches per size: %u\n", SPAWNS_COUNT);
+    printf("heap (MiB)   fork+execvp (ms)   posix_spawnp (ms)\n");
+    
+    for (uint32_t i = 0; i < sizeof(heap_sizes_mib) / sizeof(heap_sizes_mib[0]); i++) {
+        // Touches the whole heap so that its pages are mapped (and have to be copied by `fork`).
+        size_t heap_size = (size_t)heap_sizes_mib[i] * 1024 * 1024;
+        uint8_t *heap = NULL;
+        if (heap_size > 0) {
+            heap = malloc(heap_size);
+            if (heap == NULL) {
+                printf("%10u   (could not be allocated)\n", heap_sizes_mib[i]);
+                continue;
+            }
+            memset(heap, 1, heap_size);
+        }
+        
+        double fork_ms = average_latency_ms(fork_exec, argv, &failures);
+        double spawn_ms = average_latency_ms(spawn, argv, &failures);
+        printf("%10u   %16.3f   %17.3f\n", heap_sizes_mib[i], fork_ms, spawn_ms);
+        
+        free(heap);
+    }
+    
+    printf("failures:          %u\n", failures);
+    
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
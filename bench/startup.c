@@ -0,0 +1,135 @@
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+#include <sy5/store.h>
+#include <sy5/worker.h>
+
+// Micro-benchmark of the loading of existing tasks at startup: every task loaded one after the other with its results
+// (like the daemon previously did) against `load_workers` (in parallel, the results being loaded on first access), with
+// a directory per task and with the store.
+
+#define DEFAULT_TASKS_COUNT 10000
+
+static int remove_path(const char *path, const struct stat *stat, int flag, struct FTW *ftw) {
+    (void)stat;
+    (void)flag;
+    (void)ftw;
+    
+    return remove(path);
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1e3 + (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Creates `count` tasks in `tasks_path` (in the store if it is opened).
+static int create_tasks(const char *tasks_path, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        task new_task = { .taskid = i };
+        assert(timing_from_strings(&new_task.timing, "*", "*", "*") != -1);
+        new_task.commandline.argc = 2;
+        new_task.commandline.argv = calloc(2, sizeof(string));
+        assert(new_task.commandline.argv);
+        assert(string_from_cstring(&new_task.commandline.argv[0], "echo") != -1);
+        assert(string_from_cstring(&new_task.commandline.argv[1], "hello") != -1);
+        
+        worker *new_worker = NULL;
+        assert(create_worker(&new_worker, &new_task, tasks_path, i, 0) != -1);
+        assert(free_worker(new_worker) != -1);
+    }
+    
+    return 0;
+}
+
+// Loads `count` tasks like the daemon previously did (one after the other, with their results), each worker is freed
+// right away as keeping the descriptors and the mappings of every task would exceed the limits of the process.
+static int load_tasks_eagerly(const uint64_t *taskids, uint64_t count, const char *tasks_path) {
+    for (uint64_t i = 0; i < count; i++) {
+        worker *cur_worker = NULL;
+        assert(create_worker(&cur_worker, NULL, tasks_path, taskids[i], 0) != -1);
+        assert(load_worker_results(cur_worker) != -1);
+        assert(free_worker(cur_worker) != -1);
+    }
+    
+    return 0;
+}
+
+static void free_workers(worker **workers, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        if (workers[i] != NULL) {
+            free_worker(workers[i]);
+            workers[i] = NULL;
+        }
+    }
+}
+
+// Measures both ways of loading `count` tasks from `tasks_path`.
+// Returns `-1` in case of failure, else 0.
+static int measure(const char *name, const char *tasks_path, uint64_t count, int use_store) {
+    if (use_store) {
+        assert(open_store(tasks_path) != -1);
+    }
+    assert(create_tasks(tasks_path, count) != -1);
+    
+    uint64_t *taskids = malloc(count * sizeof(uint64_t));
+    worker **workers = calloc(count, sizeof(worker *));
+    assert(taskids && workers);
+    for (uint64_t i = 0; i < count; i++) {
+        taskids[i] = i;
+    }
+    
+    struct timespec start;
+    struct timespec end;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = load_tasks_eagerly(taskids, count, tasks_path);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double eager_ms = elapsed_ms(&start, &end);
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = err != -1 ? load_workers(workers, taskids, count, tasks_path) : err;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double lazy_ms = elapsed_ms(&start, &end);
+    free_workers(workers, count);
+    
+    printf("%-10s  %16.2f  %16.2f  (x%.1f)\n", name, eager_ms, lazy_ms, eager_ms / lazy_ms);
+    
+    free(taskids);
+    free(workers);
+    close_store();
+    
+    return err;
+}
+
+int main(int argc, char **argv) {
+    uint64_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_TASKS_COUNT;
+    
+    char root_path[] = "/tmp/saturnd-bench-XXXXXX";
+    if (mkdtemp(root_path) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    
+    char dirs_path[PATH_MAX];
+    char store_path[PATH_MAX];
+    snprintf(dirs_path, sizeof(dirs_path), "%s/dirs/", root_path);
+    snprintf(store_path, sizeof(store_path), "%s/store/", root_path);
+    if (mkdir_recursively(dirs_path, 0777) == -1 || mkdir_recursively(store_path, 0777) == -1) {
+        return EXIT_FAILURE;
+    }
+    
+    printf("tasks loaded:  %lu\n", (unsigned long)count);
+    printf("layout      sequential (ms)  load_workers (ms)\n");
+    int err = measure("dirs", dirs_path, count, 0);
+    err = err != -1 ? measure("store", store_path, count, 1) : err;
+    
+    nftw(root_path, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+    
+    return err != -1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,102 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sy5/utils.h>
+
+// Micro-benchmark of `timing_next_fire` against the polling check previously done by the workers (testing every
+// minute against the three bit maps), over random timings and random starting times.
+
+#define TIMINGS_COUNT 2000
+#define SEARCHES_PER_TIMING 8
+
+// Returns a random bit map of `bits` bits with roughly one bit out of `density` set (and at least one bit set).
+static uint64_t random_field(unsigned int bits, unsigned int density) {
+    uint64_t field = 0;
+    
+    for (unsigned int i = 0; i < bits; i++) {
+        if (rand() % density == 0) {
+            field |= 1ULL << i;
+        }
+    }
+    
+    return field ? field : 1ULL << (rand() % bits);
+}
+
+static time_t polling_next_fire(const timing *timing, time_t from) {
+    time_t timestamp = from - from % 60;
+    
+    for (unsigned int i = 0; i < 8 * 24 * 60; i++) {
+        struct tm time_info;
+        localtime_r(&timestamp, &time_info);
+        
+        if (((timing->daysofweek >> time_info.tm_wday) % 2 != 0) &&
+            ((timing->hours >> time_info.tm_hour) % 2 != 0) &&
+            ((timing->minutes >> time_info.tm_min) % 2 != 0)) {
+            return timestamp;
+        }
+        
+        timestamp += 60;
+    }
+    
+    return -1;
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+int main() {
+    srand(42);
+    tzset();
+    
+    timing *timings = malloc(TIMINGS_COUNT * sizeof(timing));
+    time_t *starts = malloc(TIMINGS_COUNT * SEARCHES_PER_TIMING * sizeof(time_t));
+    time_t *expected = malloc(TIMINGS_COUNT * SEARCHES_PER_TIMING * sizeof(time_t));
+    if (timings == NULL || starts == NULL || expected == NULL) {
+        return EXIT_FAILURE;
+    }
+    
+    time_t now = time(NULL);
+    for (unsigned int i = 0; i < TIMINGS_COUNT; i++) {
+        timings[i].minutes = random_field(60, 1 + rand() % 30);
+        timings[i].hours = (uint32_t)random_field(24, 1 + rand() % 12);
+        timings[i].daysofweek = (uint8_t)random_field(7, 1 + rand() % 4);
+        
+        for (unsigned int j = 0; j < SEARCHES_PER_TIMING; j++) {
+            // Random starting times over a year (so that DST transitions are crossed).
+            starts[i * SEARCHES_PER_TIMING + j] = now + (time_t)(rand() % (366 * 24 * 60)) * 60 + rand() % 60;
+        }
+    }
+    
+    struct timespec start;
+    struct timespec end;
+    unsigned int searches = TIMINGS_COUNT * SEARCHES_PER_TIMING;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < searches; i++) {
+        expected[i] = polling_next_fire(&timings[i / SEARCHES_PER_TIMING], starts[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double polling_ns = elapsed_ns(&start, &end) / searches;
+    
+    unsigned int mismatches = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < searches; i++) {
+        if (timing_next_fire(&timings[i / SEARCHES_PER_TIMING], starts[i]) != expected[i]) {
+            mismatches++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double next_fire_ns = elapsed_ns(&start, &end) / searches;
+    
+    printf("searches:          %u\n", searches);
+    printf("polling:           %.0f ns/search\n", polling_ns);
+    printf("timing_next_fire:  %.0f ns/search (x%.1f)\n", next_fire_ns, polling_ns / next_fire_ns);
+    printf("mismatches:        %u\n", mismatches);
+    
+    free(timings);
+    free(starts);
+    free(expected);
+    
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
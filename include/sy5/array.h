@@ -3,7 +3,8 @@
 
 #include <sy5/types.h>
 
-// An array is a pointer of elements (like a C array) that is prefixed by its size (a `uint64_t`) in memory.
+// An array is a pointer of elements (like a C array) that is prefixed by its capacity and its size (two `uint64_t`) in
+// memory.
 //
 // Example:
 // ```
@@ -14,19 +15,31 @@
 // array_push(array, element2);
 // ```
 // Here's how it would look inside the memory:
-// |2|"hello, "|"world!"|
-//  ↑ ↑         ↑
-//  │ │         └────────────────────────────────────────────────────┐
-//  │ └────────────────────┐                                         │
-//  The size of the array. │                                         │
-//                         The first element (where `array` points). │
-//                                                                   The second element.
+// |8|2|"hello, "|"world!"|...|
+//  ↑ ↑ ↑         ↑        ↑
+//  │ │ │         │        Allocated but unused elements (up to the capacity).
+//  │ │ │         The second element.
+//  │ │ The first element (where `array` points).
+//  │ The size of the array.
+//  The capacity of the array.
+//
+// The capacity grows geometrically (it doubles whenever it is reached) and never shrinks (until the array is freed), so
+// pushing `n` elements one by one only costs `O(log(n))` reallocations.
 //
 // This array concept was inspired by stb's stretchy buffer (https://github.com/nothings/stb/blob/master/deprecated/stretchy_buffer.txt).
 
+// Initial capacity of an array (in number of elements).
+#define ARRAY_INITIAL_CAPACITY 8
+
+// Size of the header prefixing the elements of an array (its capacity and its size).
+#define ARRAY_HEADER_SIZE (2 * sizeof(uint64_t))
+
 // Returns the number of element in an array (or 0 if the array is `NULL`).
 #define array_size(array) ((array) ? *(uint64_t *)((uint8_t *)(array) - sizeof(uint64_t)) : 0)
 
+// Returns the number of element an array can hold without being reallocated (or 0 if the array is `NULL`).
+#define array_capacity(array) ((array) ? *(uint64_t *)((uint8_t *)(array) - ARRAY_HEADER_SIZE) : 0)
+
 // Returns the first element in an array (assumes that the array has at least 1 element).
 #define array_first(array) ((array)[0])
 
@@ -36,44 +49,79 @@
 // Returns `1` if the array is empty or `NULL`.
 #define array_empty(array) (array_size(array) == 0)
 
+// Makes sure that the array (which can be `NULL` if empty) can hold at least `count` elements without being reallocated.
+#define array_reserve(array, count) array_reserve_internal((void **)&(array), (count), sizeof((array)[0]))
+
 // Pushes an element in the array (which can be `NULL` if empty).
 #define array_push(array, item) array_push_internal((void **)&(array), &(item), sizeof(item))
 
+// Pushes `count` contiguous elements (pointed by `items`) in the array (which can be `NULL` if empty).
+#define array_push_n(array, items, count) array_push_n_internal((void **)&(array), (items), (count), sizeof((array)[0]))
+
 // Pops the last element of the array (assumes that the array has at least 1 element).
 #define array_pop(array) array_pop_internal((void **)&(array), sizeof((array)[0]))
 
 // Removes the element at a given index in the array (assumes that the array has at least 1 element).
 #define array_remove(array, index) array_remove_internal((void **)&(array), (index), sizeof((array)[0]))
 
+// Removes every element of the array (the capacity is kept for the upcoming pushes).
+#define array_clear(array) ((array) ? (void)(*(uint64_t *)((uint8_t *)(array) - sizeof(uint64_t)) = 0) : (void)0)
+
 // Frees the array (it can be `NULL`).
 #define array_free(array) array_free_internal((void **)&(array))
 
-// Internal method to push an element in the array.
-static inline int array_push_internal(void **array, void *item, uint32_t item_size) {
-    size_t size = sizeof(uint64_t) + item_size * array_size(*array);
-    void *tmp = realloc(*array ? *array - sizeof(uint64_t) : 0, size + item_size);
+// Internal method to make sure that the array can hold at least `count` elements.
+static inline int array_reserve_internal(void **array, uint64_t count, uint32_t item_size) {
+    uint64_t capacity = array_capacity(*array);
+    
+    if (count <= capacity) {
+        return 0;
+    }
+    
+    // Grows geometrically so that successive pushes only reallocate a logarithmic number of times.
+    uint64_t new_capacity = capacity ? capacity : ARRAY_INITIAL_CAPACITY;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    
+    void *tmp = realloc(*array ? (uint8_t *)*array - ARRAY_HEADER_SIZE : NULL, ARRAY_HEADER_SIZE + new_capacity * item_size);
     assert(tmp);
     
     if (*array == NULL) {
-        *(uint64_t *)tmp = 0;
+        ((uint64_t *)tmp)[1] = 0;
     }
     
-    void *end_ptr = tmp + size;
-    assert(memcpy(end_ptr, item, item_size) != NULL);
-    *(uint64_t *)tmp += 1;
-    *array = tmp + sizeof(uint64_t);
+    ((uint64_t *)tmp)[0] = new_capacity;
+    *array = (uint8_t *)tmp + ARRAY_HEADER_SIZE;
     
     return 0;
 }
 
-// Internal method to pop an element in the array.
+// Internal method to push `count` elements in the array.
+static inline int array_push_n_internal(void **array, const void *items, uint64_t count, uint32_t item_size) {
+    if (count == 0) {
+        return 0;
+    }
+    
+    uint64_t size = array_size(*array);
+    assert(array_reserve_internal(array, size + count, item_size) != -1);
+    assert(memcpy((uint8_t *)*array + size * item_size, items, count * item_size) != NULL);
+    *(uint64_t *)((uint8_t *)*array - sizeof(uint64_t)) += count;
+    
+    return 0;
+}
+
+// Internal method to push an element in the array.
+static inline int array_push_internal(void **array, const void *item, uint32_t item_size) {
+    return array_push_n_internal(array, item, 1, item_size);
+}
+
+// Internal method to pop an element in the array (the capacity is kept for the upcoming pushes).
 static inline int array_pop_internal(void **array, uint32_t item_size) {
-    size_t size = sizeof(uint64_t) + item_size * array_size(*array);
-    void *tmp = realloc(*array - sizeof(uint64_t), size - item_size);
-    assert(tmp);
+    (void)item_size;
+    assert(array_size(*array) > 0);
     
-    *(uint64_t *)tmp -= 1;
-    *array = tmp + sizeof(uint64_t);
+    *(uint64_t *)((uint8_t *)*array - sizeof(uint64_t)) -= 1;
     
     return 0;
 }
@@ -81,7 +129,7 @@ static inline int array_pop_internal(void **array, uint32_t item_size) {
 // Internal method to remove an element from the array.
 static inline int array_remove_internal(void **array, uint64_t index, uint32_t item_size) {
     uint64_t count = array_size(*array);
-    assert(memmove(*array + item_size * index, *array + item_size * index + item_size, (count - 1 - index) * item_size) != NULL);
+    assert(memmove((uint8_t *)*array + item_size * index, (uint8_t *)*array + item_size * index + item_size, (count - 1 - index) * item_size) != NULL);
     return array_pop_internal(array, item_size);
 }
 
@@ -91,7 +139,7 @@ static inline void array_free_internal(void **array) {
         return;
     }
     
-    free(*array - sizeof(uint64_t));
+    free((uint8_t *)*array - ARRAY_HEADER_SIZE);
     *array = NULL;
 }
 
@@ -12,4 +12,7 @@ extern char *g_request_pipe_path;
 // The reply pipe file path.
 extern char *g_reply_pipe_path;
 
+// The socket file path.
+extern char *g_socket_path;
+
 #endif /* COMMON_H. */
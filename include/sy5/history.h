@@ -0,0 +1,62 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <sy5/types.h>
+
+// The output history of a task is an optional archive of the outputs of every run of the task (instead of the outputs
+// of its last run only), in an append-only file: a header followed by a record per run (its time, then for each of
+// `stdout` and `stderr` its length and the length of its blocks, then the blocks of both). Each output is cut in blocks
+// compressed independently (see `lz.h`), or kept as is when they do not compress. Only the time and the offset of each
+// record are kept in memory.
+
+// Name of the directory of the histories in the tasks directory (each history is named by the taskid of its task).
+#define HISTORY_DIRECTORY_NAME "history"
+
+// Describes a run in a history.
+typedef struct history_run {
+    // Time of the run in seconds since EPOCH.
+    uint64_t time;
+    
+    // Offset of the record of the run in the file.
+    uint64_t offset;
+} history_run;
+
+// Describes an opened history.
+typedef struct history {
+    // Descriptor of the file (or `-1` if the task has no history).
+    int fd;
+    
+    // Array of the runs (from the oldest to the latest).
+    history_run *runs;
+    
+    // Size of the file (a partial record left by a crash is cut off when the history is opened).
+    uint64_t size;
+} history;
+
+// Creates a closed history (for a task without history).
+history create_history();
+
+// Opens the history at `path`, creating it if `create` is non-zero.
+// Returns `-1` in case of failure (with `errno` set to `ENOENT` if the history does not exist), else 0.
+int open_history(history *dest, const char *path, int create);
+
+// Appends the outputs (`stdout` and `stderr`) of a run to a history.
+// Returns `-1` in case of failure, else 0.
+int append_history(history *history, uint64_t time, const string outputs[2]);
+
+// Finds the run of a history made `index` runs before the latest one (0 being the latest one).
+// Returns `-1` if there is no such run, else 0.
+int find_history_run(const history *history, uint32_t index, uint64_t *run);
+
+// Finds the latest run of a history made at or before `time`.
+// Returns `-1` if there is no such run, else 0.
+int find_history_run_at(const history *history, uint64_t time, uint64_t *run);
+
+// Reads an output (0 for `stdout`, 1 for `stderr`) of a run of a history in `*dest`.
+// Returns `-1` in case of failure, else 0.
+int read_history_output(const history *history, uint64_t run, uint32_t stream, string *dest);
+
+// Closes a history (if opened).
+void close_history(history *history);
+
+#endif /* HISTORY_H. */
@@ -0,0 +1,60 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sy5/types.h>
+
+// The journal replaces the `task` file of the per-task directories: every creation and removal of a task is appended
+// to a single file (`journal` in the tasks directory) as a record (its length, a checksum, then its kind, its taskid
+// and the task for a creation), and the tasks are recovered by replaying it on startup. A task's directory then only
+// holds its results, it is created with them (on first access) and deleted in the background once the task is removed
+// and not used anymore (as are the directories and histories of the tasks left over by a crash).
+//
+// Appends are made durable by group commit: the records appended while a thread writes and syncs the journal are
+// written and synced together by the next one, so a burst of mutations costs a handful of `fdatasync`. Once the
+// journal outgrows the last snapshot, a background thread writes a snapshot of the tasks (`snapshot`, the creation
+// records of the tasks left, along with the position in the journal from which to replay) and starts a new journal
+// (of the next generation) with the records appended in the meantime.
+
+// Names of the journal and of its snapshot in the tasks directory.
+#define JOURNAL_FILE_NAME "journal"
+#define JOURNAL_SNAPSHOT_FILE_NAME "snapshot"
+
+// Opens (or creates) the journal in the tasks directory `tasks_path` and replays it (importing the tasks of the
+// per-task directories written without a journal), then starts its background thread.
+// Returns `-1` in case of failure, else 0.
+int open_journal(const char *tasks_path);
+
+// Stops the background thread (once it has deleted the files of the removed tasks) and closes the journal (if opened).
+void close_journal();
+
+// Checks if the journal is opened (in which case it holds the tasks instead of their `task` files).
+int is_journal_opened();
+
+// Lists the taskids of the tasks of the journal in `*taskids` (an array, in no particular order).
+// Returns `-1` in case of failure, else 0.
+int list_journal_taskids(uint64_t **taskids);
+
+// Returns the taskid following the greatest taskid ever created in the journal.
+uint64_t get_journal_next_taskid();
+
+// Reads the task of the journal whose taskid is `taskid` in `*dest`.
+// Returns `-1` in case of failure (or if the task is not found), else 0.
+int find_journal_task(uint64_t taskid, task *dest);
+
+// Appends the creation of a task to the journal, without waiting for it to be durable.
+// Returns `-1` in case of failure, else the sequence number of the record (to be given to `sync_journal`).
+int64_t journal_create_task(const task *task);
+
+// Appends the removal of a task to the journal, without waiting for it to be durable.
+// Returns `-1` in case of failure, else the sequence number of the record (to be given to `sync_journal`).
+int64_t journal_remove_task(uint64_t taskid);
+
+// Waits until the record whose sequence number is `seq` (and every record appended before it) is durable, writing and
+// syncing the pending records itself if no other thread is doing it.
+// Returns `-1` in case of failure, else 0.
+int sync_journal(int64_t seq);
+
+// Hands the files of a removed task (its directory and its history) to the background thread, which deletes them.
+void discard_task_files(uint64_t taskid);
+
+#endif /* JOURNAL_H. */
@@ -0,0 +1,26 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <sy5/types.h>
+
+// A fast LZ77 block codec in the format of LZ4 blocks: a sequence of tokens, each made of a run of literals followed
+// by a match (a length of at least 4 bytes and an offset of at most 65535 bytes back in the decompressed data), the
+// last token only holding literals. It favours speed over ratio (no entropy coding), which suits the highly repetitive
+// outputs of most tasks.
+
+// Maximum ratio between the length of decompressed data and the length of its compressed data (the length of a match
+// grows by at most 255 bytes per byte).
+#define LZ_MAX_RATIO 255
+
+// Returns the maximum size of `length` bytes once compressed (the capacity needed by `lz_compress`).
+uint32_t lz_compress_bound(uint32_t length);
+
+// Compresses `length` bytes of `src` in `dest` (which must hold at least `lz_compress_bound(length)` bytes).
+// Returns the size of the compressed data.
+uint32_t lz_compress(const uint8_t *src, uint32_t length, uint8_t *dest);
+
+// Decompresses `length` bytes of `src` in `dest`, which must decompress to exactly `decompressed_length` bytes.
+// Returns `-1` if the data is corrupted, else 0.
+int lz_decompress(const uint8_t *src, uint32_t length, uint8_t *dest, uint32_t decompressed_length);
+
+#endif /* LZ_H. */
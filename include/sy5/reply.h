@@ -6,7 +6,7 @@
 enum reply_item {
     // The given request was executed successfully.
     SERVER_REPLY_OK = 0x4F4B, // 'OK'
-
+    
     // The given request failed to execute.
     SERVER_REPLY_ERROR = 0x4552, // 'ER'
     
@@ -17,10 +17,13 @@ enum reply_item {
 enum reply_error_item {
     // The task is not found.
     SERVER_REPLY_ERROR_NOT_FOUND = 0x4E46, // 'NF'
-
-    // The task was never run.
+    
+    // The task was never run (or has no run matching the request).
     SERVER_REPLY_ERROR_NEVER_RUN = 0x4E52, // 'NR'
     
+    // The task has no output history.
+    SERVER_REPLY_ERROR_NO_HISTORY = 0x4E48, // 'NH'
+    
     // The count of items in the enum.
     SERVER_REPLY_ERROR_COUNT
 };
@@ -35,9 +38,21 @@ typedef struct reply {
     
     union {
         // CLIENT_REQUEST_LIST_TASKS
+        // CLIENT_REQUEST_LIST_TASKS_SINCE
         struct {
-            // Array of running tasks.
+            // Array of running tasks (for CLIENT_REQUEST_LIST_TASKS_SINCE, only the ones created since the cursor
+            // unless `reset` is set).
             task *tasks;
+            
+            // Sequence number of the latest change, to be given by the next request (CLIENT_REQUEST_LIST_TASKS_SINCE).
+            uint64_t cursor;
+            
+            // Non-zero if the changes since the cursor are not known, `tasks` being then every running task
+            // (CLIENT_REQUEST_LIST_TASKS_SINCE).
+            uint8_t reset;
+            
+            // Array of the taskids of the tasks removed since the cursor (CLIENT_REQUEST_LIST_TASKS_SINCE).
+            uint64_t *removed_taskids;
         };
         
         // CLIENT_REQUEST_CREATE_TASK
@@ -58,6 +73,16 @@ typedef struct reply {
             // Output string.
             string output;
         };
+        
+        // CLIENT_REQUEST_GET_PAST_OUTPUT
+        // CLIENT_REQUEST_GET_PAST_OUTPUT_AT
+        struct {
+            // Time of the execution whose output is sent.
+            uint64_t run_time;
+            
+            // Output of the execution.
+            string run_output;
+        };
     };
 } reply;
 
@@ -25,6 +25,27 @@ enum request_item {
     // Terminates the daemon.
     CLIENT_REQUEST_TERMINATE = 0x544D, // 'TM'.
     
+    // Lists the execution times and exit codes of a scheduled task within a time window (a page at a time).
+    CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE = 0x5452, // 'TR'.
+    
+    // Creates a task whose outputs of every execution are kept (in its output history).
+    CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY = 0x4348, // 'CH'.
+    
+    // Displays an output of the Nth latest execution of a scheduled task (from its output history).
+    CLIENT_REQUEST_GET_PAST_OUTPUT = 0x504E, // 'PN'.
+    
+    // Displays an output of the latest execution of a scheduled task made at or before a time (from its output
+    // history).
+    CLIENT_REQUEST_GET_PAST_OUTPUT_AT = 0x5054, // 'PT'.
+    
+    // Creates, removes and queries many tasks at once (a batch of `CLIENT_REQUEST_CREATE_TASK`,
+    // `CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY`, `CLIENT_REQUEST_REMOVE_TASK`, `CLIENT_REQUEST_GET_TIMES_AND_EXITCODES`
+    // and `CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE` requests).
+    CLIENT_REQUEST_BATCH = 0x4241, // 'BA'.
+    
+    // Lists the tasks created and removed since a cursor (given by a previous reply).
+    CLIENT_REQUEST_LIST_TASKS_SINCE = 0x4C43, // 'LC'.
+    
     // The count of items in the enum.
     CLIENT_REQUEST_COUNT
 };
@@ -37,6 +58,7 @@ typedef struct request {
     // Data format per request identifier.
     union {
         // CLIENT_REQUEST_CREATE_TASK
+        // CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY
         struct {
             // A task to schedule.
             task task;
@@ -46,9 +68,44 @@ typedef struct request {
         // CLIENT_REQUEST_GET_TIMES_AND_EXITCODES
         // CLIENT_REQUEST_GET_STDOUT
         // CLIENT_REQUEST_GET_STDERR
+        // CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE
+        // CLIENT_REQUEST_GET_PAST_OUTPUT
+        // CLIENT_REQUEST_GET_PAST_OUTPUT_AT
         struct {
             // Task ID on which operate.
             uint64_t taskid;
+            
+            // Output to send, 0 for `stdout` and 1 for `stderr` (CLIENT_REQUEST_GET_PAST_OUTPUT and
+            // CLIENT_REQUEST_GET_PAST_OUTPUT_AT).
+            uint8_t stream;
+            
+            // Number of executions made after the one whose output is sent (CLIENT_REQUEST_GET_PAST_OUTPUT).
+            uint32_t run_index;
+            
+            // Time of the execution whose output is sent (CLIENT_REQUEST_GET_PAST_OUTPUT_AT).
+            uint64_t run_time;
+            
+            // Time window of the runs in seconds since EPOCH, both included (CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE).
+            uint64_t since;
+            uint64_t until;
+            
+            // Number of the latest runs of the window to skip (CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE).
+            uint32_t offset;
+            
+            // Maximum number of runs to send, or 0 to send all of them (CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE).
+            uint32_t limit;
+        };
+        
+        // CLIENT_REQUEST_BATCH
+        struct {
+            // Array of the requests of the batch (handled in order).
+            struct request *batch;
+        };
+        
+        // CLIENT_REQUEST_LIST_TASKS_SINCE
+        struct {
+            // Sequence number of the latest change known by the client (0 to list every task).
+            uint64_t cursor;
         };
     };
 } request;
@@ -56,4 +113,7 @@ typedef struct request {
 // Returns an array of names for each `request_item`.
 const char **request_item_names();
 
+// Returns the name of a `request_item` (or `NULL` if the opcode is unknown).
+const char *request_item_name(uint16_t opcode);
+
 #endif // CLIENT_REQUEST_H.
\ No newline at end of file
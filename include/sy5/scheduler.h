@@ -0,0 +1,39 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <sy5/types.h>
+#include <sy5/worker.h>
+
+// The default number of executor threads.
+#define DEFAULT_EXECUTORS_COUNT 4
+
+// The scheduler is a single thread keeping every scheduled worker in a min-heap ordered by their next time of
+// execution, it only wakes up when the earliest worker is due and then hands it to a fixed-size pool of executor
+// threads (which spawn the task). A single supervisor thread then waits for every execution in progress: it reads their
+// outputs, reaps their processes (on `SIGCHLD`) and saves their results, so the number of threads does not depend on
+// the number of tasks running at the same time.
+
+// Starts the scheduler thread, the supervisor thread and `executors_count` executor threads (`SIGCHLD` is blocked in the
+// calling thread and in every thread created afterwards, only the supervisor receives it).
+// Returns `-1` in case of failure, else 0.
+int start_scheduler(uint32_t executors_count);
+
+// Stops the scheduler thread, the supervisor thread and the executor threads (executions in progress are abandoned).
+// Returns `-1` in case of failure, else 0.
+int stop_scheduler();
+
+// Schedules a worker for its upcoming executions.
+// Returns `-1` in case of failure, else 0.
+int schedule_worker(worker *worker);
+
+// Unschedules a worker and frees it (right away or as soon as its current execution ends and it is released by the
+// requests using it).
+// Returns `-1` in case of failure, else 0.
+int unschedule_worker(worker *worker);
+
+// Releases a worker acquired with `acquire_worker` (and frees it if it has been unscheduled in the meantime and is not
+// used anymore).
+// Returns `-1` in case of failure, else 0.
+int release_worker(worker *worker);
+
+#endif /* SCHEDULER_H. */
@@ -0,0 +1,79 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <sy5/types.h>
+
+// The store is an optional replacement of the per-task directories: a single file (`store` in the tasks directory)
+// made of pages, starting with a header page which points to a table of fixed-size entries (one per task). Each entry
+// points to the extents (runs of contiguous pages) holding the task, its runs, its last stdout and its last stderr.
+// The file is mapped once (in a fixed range of addresses, so that the mapping never moves when the file grows) and
+// only one descriptor is used whatever the number of tasks.
+//
+// Updates are crash-safe: new data is always written in free pages and synced (`fdatasync`) before the entry pointing
+// to it is updated (by a single small `pwrite`), which is synced in turn before the pages it stopped pointing to can be
+// reused. The free pages are not stored but recomputed from the table when the store is opened, so a crash can neither
+// leave an entry pointing to partially written (or reused) data nor leak pages.
+
+// Name of the store in the tasks directory.
+#define STORE_FILE_NAME "store"
+
+// Kinds of extents of a task in the store.
+typedef enum store_extent_kind {
+    // The task (serialized like in a `task` file).
+    STORE_EXTENT_TASK,
+    
+    // The runs (serialized like in a `runs` file), updated in place.
+    STORE_EXTENT_RUNS,
+    
+    // The last stdout (raw bytes).
+    STORE_EXTENT_STDOUT,
+    
+    // The last stderr (raw bytes).
+    STORE_EXTENT_STDERR,
+    
+    STORE_EXTENT_COUNT
+} store_extent_kind;
+
+// Opens (or creates) the store in the tasks directory `tasks_path` and maps it.
+// Returns `-1` in case of failure, else 0.
+int open_store(const char *tasks_path);
+
+// Unmaps and closes the store (if opened).
+void close_store();
+
+// Checks if the store is opened (in which case it is used instead of the per-task directories).
+int is_store_opened();
+
+// Lists the taskids of the tasks of the store in `*taskids` (an array, in no particular order).
+// Returns `-1` in case of failure, else 0.
+int list_store_taskids(uint64_t **taskids);
+
+// Adds a task to the store and gives its slot, the task only exists (after a restart) once its `STORE_EXTENT_TASK` is
+// written.
+// Returns `-1` in case of failure, else 0.
+int add_store_slot(uint32_t *slot, uint64_t taskid);
+
+// Finds the slot of a task of the store.
+// Returns `-1` if the task is not found, else 0.
+int find_store_slot(uint32_t *slot, uint64_t taskid);
+
+// Removes a task from the store, its pages are only freed by `release_store_slot` (so that they can still be written by
+// an execution in progress).
+// Returns `-1` in case of failure, else 0.
+int remove_store_slot(uint32_t slot);
+
+// Releases a slot which is not used anymore, freeing its pages if its task has been removed.
+void release_store_slot(uint32_t slot);
+
+// Replaces an extent of a task by `length` bytes of `data` (written in new pages before the task points to them).
+// Returns `-1` in case of failure, else 0.
+int write_store_extent(uint32_t slot, store_extent_kind kind, const void *data, uint32_t length);
+
+// Gets the address (in the mapping), the length and the offset (in the file) of an extent of a task.
+// Returns `-1` in case of failure, else 0.
+int get_store_extent(uint32_t slot, store_extent_kind kind, const uint8_t **data, uint32_t *length, uint64_t *offset);
+
+// Returns the descriptor of the store (used to update extents in place).
+int get_store_fd();
+
+#endif /* STORE_H. */
@@ -0,0 +1,48 @@
+#ifndef TASKMAP_H
+#define TASKMAP_H
+
+#include <sy5/types.h>
+
+// Key marking an empty entry of a task map (it cannot be used as a taskid).
+#define TASKMAP_EMPTY_KEY UINT64_MAX
+
+// Describes an entry of a task map.
+typedef struct taskmap_entry {
+    // Taskid of the entry (or `TASKMAP_EMPTY_KEY` if the entry is empty).
+    uint64_t taskid;
+    
+    // Value associated to the taskid.
+    uint64_t value;
+} taskmap_entry;
+
+// Describes a hash map from taskids to values (using open addressing with linear probing).
+typedef struct taskmap {
+    // Number of entries in use.
+    uint64_t size;
+    
+    // Number of entries allocated (always a power of 2, or 0).
+    uint64_t capacity;
+    
+    // Entries of the map.
+    taskmap_entry *entries;
+} taskmap;
+
+// Creates an empty task map.
+taskmap create_taskmap();
+
+// Associates a value to a taskid in a task map (replacing the previous value if any).
+// Returns `-1` in case of failure, else 0.
+int taskmap_put(taskmap *map, uint64_t taskid, uint64_t value);
+
+// Gets the value associated to a taskid in a task map.
+// Returns `1` and writes the value in `*dest` if the taskid is found, else 0.
+int taskmap_get(const taskmap *map, uint64_t taskid, uint64_t *dest);
+
+// Removes a taskid from a task map.
+// Returns `1` if the taskid was found, else 0.
+int taskmap_remove(taskmap *map, uint64_t taskid);
+
+// Frees a task map.
+void free_taskmap(taskmap *map);
+
+#endif /* TASKMAP_H. */
@@ -10,6 +10,9 @@
 // The name of the default reply pipe.
 #define REPLY_PIPE_NAME "saturnd-reply-pipe"
 
+// The name of the default socket (used when the daemon is listening on a Unix domain socket).
+#define SOCKET_NAME "saturnd-socket"
+
 // The buffer size needed for a timing string.
 #define TIMING_TEXT_MIN_BUFFERSIZE 1024
 
@@ -25,10 +28,54 @@ typedef struct buffer {
     // Length of the buffer.
     uint32_t length;
     
+    // Number of bytes allocated for the data of the buffer (grows geometrically).
+    uint32_t capacity;
+    
     // Data of the buffer.
     uint8_t *data;
 } buffer;
 
+// The size of the internal buffer of a reader.
+#define READER_BUFFER_SIZE 4096
+
+// Maximum length of a string (or of a command line) read from a file descriptor, whose end is not known in advance (a
+// longer one is malformed). From memory, they cannot be longer than the bytes left.
+#define STRING_MAX_LENGTH (16 * 1024 * 1024)
+
+// Describes a buffered reader over a file descriptor (so that reading small fields does not cost a syscall each), or
+// over a memory region.
+typedef struct reader {
+    // File descriptor to read from (or `-1` when reading from memory).
+    int fd;
+    
+    // Memory region to read from instead of the internal buffer (or `NULL` when reading from a file descriptor).
+    const uint8_t *memory;
+    
+    // Position of the next byte to read in the internal buffer.
+    uint32_t position;
+    
+    // Number of bytes available in the internal buffer (or in the memory region).
+    uint32_t length;
+    
+    // Internal buffer.
+    uint8_t data[READER_BUFFER_SIZE];
+} reader;
+
+// The size of the chunks in which a file range or a streamed reply is copied (when it cannot be copied by the kernel).
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+// Describes a range of a file sent as is to a descriptor (without being copied in a buffer).
+typedef struct file_range {
+    // Descriptor of the file, owned by the range (or `-1` if there is nothing to send).
+    int fd;
+    
+    // Offset of the next byte to send in the file.
+    uint64_t offset;
+    
+    // Number of bytes left to send.
+    uint64_t remaining;
+} file_range;
+
 // Describes a string.
 typedef struct string {
     // Length of the string.
@@ -1,6 +1,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <time.h>
+#include <sys/uio.h>
 #include <sy5/types.h>
 
 // Logs a syslog message.
@@ -27,6 +29,36 @@
 // Creates a data (for sending data to a pipe).
 buffer create_buffer();
 
+// Makes sure that a buffer can hold at least `capacity` bytes without being reallocated.
+// Returns `-1` in case of failure, else 0.
+int buffer_reserve(buffer *buf, uint32_t capacity);
+
+// Creates a reader (for reading data from a pipe or a file).
+reader create_reader(int fd);
+
+// Creates a reader over a memory region (for reading data already received).
+reader create_memory_reader(const uint8_t *memory, uint32_t length);
+
+// Reads exactly `length` bytes from a reader in `*dest` (retrying on short reads).
+// Returns `-1` in case of failure or if the end of file is reached before `length` bytes are read, else 0.
+int read_exact(reader *rd, void *dest, uint32_t length);
+
+// Copies exactly `length` bytes from a reader to a file descriptor in chunks (so that they are never held in memory at
+// once), moving them in the kernel (`splice`) when possible.
+// Returns `-1` in case of failure or if the end of file is reached before `length` bytes are read, else 0.
+int read_to_fd(reader *rd, int fd, uint32_t length);
+
+// Creates an empty file range (with nothing to send).
+file_range create_file_range();
+
+// Sends as much of a file range as possible to a file descriptor (the file is copied by the kernel with `sendfile` when
+// possible), stopping early if `fd` is non-blocking and full.
+// Returns `-1` in case of failure, else 0 (the range is sent once `remaining` is 0).
+int send_file_range(int fd, file_range *range);
+
+// Closes a file range (whether or not it is entirely sent).
+void close_file_range(file_range *range);
+
 // Allocate and defines every needed paths (for the pipes).
 int allocate_paths();
 
@@ -85,13 +117,38 @@ int timing_string_from_field(char *dest, unsigned int min, unsigned int max, uin
 // Returns `-1` in case of failure, else the number of characters written.
 int timing_string_from_range(char *dest, unsigned int start, unsigned int stop);
 
+// Computes the first minute at or after `from` (in local time) matching a timing, by jumping from one set bit of the
+// bit maps to the next instead of testing every minute.
+// Returns `-1` if the timing never matches, else the time of that minute in seconds since EPOCH.
+time_t timing_next_fire(const timing *timing, time_t from);
+
 // Parses a commandline struct in `*dest` from `argc` and `argv`.
 // Returns `-1` in case of failure, else 0.
 int commandline_from_args(commandline *dest, unsigned int argc, char *argv[]);
 
-// Writes a `data` to a file descriptor.
+// Writes a `data` to a file descriptor (retrying on short writes).
+// Returns `-1` in case of failure, else 0.
 int write_buffer(int fd, const buffer *buf);
 
+// Writes `count` memory regions to a file descriptor with `writev`, without gathering them in a single buffer first
+// (retrying on short writes, the regions being advanced past the bytes written).
+// Returns `-1` in case of failure, else 0.
+int write_iovecs(int fd, struct iovec *iovs, uint32_t count);
+
+// Writes `length` raw bytes to a `data` (in a single copy).
+// Returns `-1` in case of failure, else 0.
+int write_bytes(buffer *buf, const void *bytes, uint32_t length);
+
+// Begins a socket frame (a `uint32` length, followed by a `uint64` request ID and by a request or a reply) in a `data`,
+// the position of the frame is written in `*frame_start` to be given to `end_frame` once the frame has been written.
+// Returns `-1` in case of failure, else 0.
+int begin_frame(buffer *buf, uint64_t requestid, uint32_t *frame_start);
+
+// Ends a socket frame begun with `begin_frame` (by writing its length), `streamed_length` bytes of the frame being sent
+// after the `data` (streamed from a file).
+// Returns `-1` in case of failure, else 0.
+int end_frame(buffer *buf, uint32_t frame_start, uint32_t streamed_length);
+
 // Writes an `uint_8` (from host byte order to big endian order) to a `data`.
 // Returns `-1` in case of failure, else 0.
 int write_uint8(buffer *buf, const uint8_t *n);
@@ -136,49 +193,50 @@ int write_run(buffer *buf, const run *run);
 // Returns `-1` in case of failure, else 0.
 int write_run_array(buffer *buf, const run *runs);
 
-// Reads an `uint_8` (from big endian order to host byte order) to a file descriptor.
+// Reads an `uint_8` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_uint8(int fd, uint8_t *n);
+int read_uint8(reader *rd, uint8_t *n);
 
-// Reads an `uint_16` (from big endian order to host byte order) to a file descriptor.
+// Reads an `uint_16` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_uint16(int fd, uint16_t *n);
+int read_uint16(reader *rd, uint16_t *n);
 
-// Reads an `uint_32` (from big endian order to host byte order) to a file descriptor.
+// Reads an `uint_32` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_uint32(int fd, uint32_t *n);
+int read_uint32(reader *rd, uint32_t *n);
 
-// Reads an `uint_64` (from big endian order to host byte order) to a file descriptor.
+// Reads an `uint_64` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_uint64(int fd, uint64_t *n);
+int read_uint64(reader *rd, uint64_t *n);
 
-// Reads an `string` (from big endian order to host byte order) to a file descriptor.
+// Reads an `string` (from big endian order to host byte order) from a reader, its length being checked before
+// allocating it (see `STRING_MAX_LENGTH`).
 // Returns `-1` in case of failure, else 0.
-int read_string(int fd, string *string);
+int read_string(reader *rd, string *string);
 
-// Reads an `timing` (from big endian order to host byte order) to a file descriptor.
+// Reads an `timing` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_timing(int fd, timing *timing);
+int read_timing(reader *rd, timing *timing);
 
-// Reads an `commandline` (from big endian order to host byte order) to a file descriptor.
+// Reads an `commandline` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_commandline(int fd, commandline *commandline);
+int read_commandline(reader *rd, commandline *commandline);
 
-// Reads an `task` (from big endian order to host byte order) to a file descriptor.
+// Reads an `task` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_task(int fd, task *task, int read_taskid);
+int read_task(reader *rd, task *task, int read_taskid);
 
-// Reads an `task[]` (from big endian order to host byte order) to a file descriptor.
+// Reads an `task[]` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_task_array(int fd, task **tasks);
+int read_task_array(reader *rd, task **tasks);
 
-// Reads an `run` (from big endian order to host byte order) to a file descriptor.
+// Reads an `run` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_run(int fd, run *run);
+int read_run(reader *rd, run *run);
 
-// Reads an `run[]` (from big endian order to host byte order) to a file descriptor.
+// Reads an `run[]` (from big endian order to host byte order) from a reader.
 // Returns `-1` in case of failure, else 0.
-int read_run_array(int fd, run **runs);
+int read_run_array(reader *rd, run **runs);
 
 // Frees a `string`.
 // Returns `-1` in case of failure, else 0.
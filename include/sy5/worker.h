@@ -1,46 +1,227 @@
 #ifndef WORKER_H
 #define WORKER_H
 
+#include <pthread.h>
+#include <sys/types.h>
 #include <sy5/types.h>
+#include <sy5/history.h>
 
-// Defines a worker (a data structure holding all information about a task's thread).
+// Defines a worker (a data structure holding all information about a task and its executions).
 typedef struct worker {
     task task;
-    run *runs;
-    string last_stdout;
-    string last_stderr;
+    
+    // Mapping of the `runs` file (a header followed by a ring of `runs_capacity` runs serialized like in a reply).
+    uint8_t *runs_map;
+    
+    // Size of `runs_map` in bytes.
+    uint64_t runs_map_size;
+    
+    // Offset of the runs in `runs_file_fd` (0 for a `runs` file, the offset of their extent in the store).
+    uint64_t runs_file_offset;
+    
+    // Number of slots of the ring of runs.
+    uint32_t runs_capacity;
+    
+    // Slot of the oldest run in the ring of runs.
+    uint32_t runs_start;
+    
+    // Number of runs in the ring of runs.
+    uint32_t runs_count;
+    
+    // Arguments of the task's command line for `posix_spawnp` (`NULL`-terminated, built once in a single block when the
+    // worker is created).
+    char **exec_argv;
+    
+    // Directory of the worker's files (or `NULL` if the worker is in the store).
     char *dir_path;
-    int task_file_fd;
+    
+    // Slot of the worker in the store (or `WORKER_NO_STORE_SLOT` if the worker is in its own directory).
+    uint32_t store_slot;
+    
+    // Path of the output history of the task (whether or not the task has one).
+    char *history_path;
+    
+    // Output history of the task (opened with the results, closed if the task has none).
+    history history;
+    
+    // Descriptors of the worker's files (`-1` until its results are loaded, and if the worker is in the store, except
+    // `runs_file_fd` which is then the store's).
     int runs_file_fd;
     int last_stdout_file_fd;
     int last_stderr_file_fd;
+    
+    // Lock protecting the results of the executions (the runs and the last outputs, in their files or in the store).
+    pthread_mutex_t lock;
+    
+    // Next time of execution in seconds since EPOCH (managed by the scheduler).
+    uint64_t next_run_time;
+    
+    // Position of the worker in the scheduler's heap (managed by the scheduler).
+    uint64_t heap_index;
+    
+    // Non-zero while the worker is waiting in the executors queue or is being executed (managed by the scheduler).
+    int busy;
+    
+    // Non-zero once the worker has been unscheduled, it will be freed as soon as it is not busy nor used anymore.
+    int removed;
+    
+    // Number of requests using the worker (see `acquire_worker`), updated atomically.
+    uint32_t references;
+    
+    // Non-zero once the results (the runs, the files of the last outputs and the history) are loaded (see
+    // `load_worker_results`).
+    int results_loaded;
+    
+    // Next worker in the executors queue (managed by the scheduler).
+    struct worker *next_job;
 } worker;
 
-// Array of workers.
+// Defines the capture of a stream of a running task (the first half of the cap is its head, the second half is a ring
+// holding its tail once the stream outgrows the cap).
+typedef struct capture {
+    int fd;
+    buffer data;
+    
+    // Position of the oldest byte of the tail (once the stream has outgrown the cap).
+    uint32_t tail_position;
+    
+    // Number of bytes read from the stream.
+    uint64_t total;
+} capture;
+
+// Defines an execution of a worker's task in progress (from its spawn until its results are saved).
+typedef struct execution {
+    worker *worker;
+    
+    // Process of the execution (or `-1` if the command could not be spawned).
+    pid_t pid;
+    
+    // Time of the execution in seconds since EPOCH.
+    uint64_t time;
+    
+    // Status of the process (once it has exited).
+    int status;
+    
+    // Non-zero once the process has exited (and has been reaped).
+    int exited;
+    
+    // Captures of the `stdout` and `stderr` of the process (their descriptors are `-1` once closed).
+    capture captures[2];
+} execution;
+
+// Suffix of the file in which a new output is written before replacing the previous one (in a worker's directory).
+#define OUTPUT_FILE_NEW_SUFFIX ".new"
+
+// Value of `store_slot` for a worker in its own directory.
+#define WORKER_NO_STORE_SLOT UINT32_MAX
+
+// The default maximum number of runs kept for each task.
+#define DEFAULT_RUNS_RETENTION_COUNT 1000
+
+// The default maximum number of bytes kept from each output of a run.
+#define DEFAULT_OUTPUT_CAP (1024 * 1024)
+
+// Array of running workers ordered by creation (a removed worker leaves a `NULL` hole until the array is compacted).
 extern worker **g_workers;
 
-// Array of running taskids (running workers).
-extern uint64_t *g_running_taskids;
+// Lock protecting `g_workers` and its taskid index (a read lock must be held to iterate over `g_workers` from another
+// thread than the one adding and removing workers).
+extern pthread_rwlock_t g_workers_lock;
+
+// Sequence number of the latest change of the running workers (an addition or a removal), protected by
+// `g_workers_lock`. It starts from the time of the first change (in microseconds since EPOCH) so that a sequence number
+// given by a previous daemon is not mistaken for one of this daemon.
+extern uint64_t g_workers_seq;
+
+// Maximum number of runs kept for each task (the oldest runs are forgotten first), must be set before creating workers.
+extern uint32_t g_runs_retention_count;
 
-// Creates a worker.
+// Maximum age (in seconds) of the runs kept for each task (or 0 to keep them regardless of their age).
+extern uint64_t g_runs_retention_age;
+
+// Maximum number of bytes kept from each output of a run (its first and last halves are kept if it is bigger).
+extern uint32_t g_output_cap;
+
+// Creates a worker (a new one if `task` is not `NULL`, keeping the outputs of every run if `keep_history` is non-zero,
+// else the one of an existing task, which keeps its history if it has one).
+// Returns `-1` in case of failure, else 0.
+int create_worker(worker **dest, task *task, const char *tasks_path, uint64_t taskid, int keep_history);
+
+// Loads the results of a worker (its runs, the files of its last outputs and its history) if they are not loaded yet,
+// they are only loaded on first access so that existing tasks are loaded quickly (the worker's lock must be held). A
+// task of the journal which never ran has no directory, and no results, until `finish_execution` creates it.
 // Returns `-1` in case of failure, else 0.
-int create_worker(worker **dest, task *task, const char *tasks_path, uint64_t taskid);
+int load_worker_results(worker *worker);
+
+// Loads the workers of `count` existing tasks in parallel (their results are loaded on first access), `workers[i]`
+// being the worker of `taskids[i]`.
+// Returns `-1` in case of failure, else 0.
+int load_workers(worker **workers, const uint64_t *taskids, uint64_t count, const char *tasks_path);
 
 // Frees a worker.
 // Returns `-1` in case of failure, else 0.
 int free_worker(worker *worker);
 
-// Checks if a worker is running.
+// Adds a worker to the running workers (it is left out of them in case of failure).
+// Returns `-1` in case of failure, else 0.
+int add_worker(worker *worker);
+
+// Checks if a worker is running (in constant time).
 int is_worker_running(uint64_t taskid);
 
-// Removes a running worker.
-// Returns `-1` in case of failure, else 0.
+// Removes a running worker (without freeing it), only one of concurrent removals of a worker removes it.
+// Returns `-1` in case of failure, 1 if the worker is not running, else 0.
 int remove_worker(uint64_t taskid);
 
-// Gets a running worker.
-worker *get_worker(uint64_t taskid);
+// Gets a running worker (in constant time) and holds a reference to it, so that it is not freed even if it is removed
+// in the meantime (until it is released with `release_worker`, see `scheduler.h`).
+// Returns `NULL` if the worker is not running, else the worker.
+worker *acquire_worker(uint64_t taskid);
+
+// Lists the changes of the running workers made after the sequence number `since` (a read lock of `g_workers_lock`
+// must be held): the workers added since then and still running in `*added`, and the taskids of the workers removed
+// since then in `*removed` (both arrays, in the order of the changes).
+// Returns `-1` in case of failure, 1 if the changes made after `since` are not known anymore (or `since` was not given
+// by this daemon, every running worker must then be listed instead), else 0.
+int list_worker_changes(uint64_t since, worker ***added, uint64_t **removed);
+
+// Frees every running worker.
+void cleanup_workers();
+
+// Writes the runs of a worker (as a `run[]`) to a `data`, straight from the mapping of its `runs` file (the worker's lock
+// must be held).
+// Returns `-1` in case of failure, else 0.
+int write_worker_runs(buffer *buf, const worker *worker);
+
+// Writes the runs of a worker (as a `run[]`) made between `since` and `until` (both included) to a `data`, skipping the
+// `offset` latest ones and keeping at most `limit` of them (or all of them if `limit` is 0), the worker's lock must be
+// held.
+// Returns `-1` in case of failure, else 0.
+int write_worker_runs_range(buffer *buf, const worker *worker, uint64_t since, uint64_t until, uint32_t offset,
+    uint32_t limit);
+
+// Writes the last output (0 for `stdout`, 1 for `stderr`) of a worker (as a `string`) to a `data`, straight from its
+// file or from the store as the outputs are not kept in memory (the worker's lock must be held). If `range` is not
+// `NULL` and the output is in a file, only its length is written and `*range` is the rest of the output, to be sent
+// after the `data` (it can be sent once the worker's lock is released).
+// Returns `-1` in case of failure, else 0.
+int write_worker_output(buffer *buf, file_range *range, const worker *worker, uint32_t stream);
+
+// Spawns the worker's task (called from an executor thread), its outputs are then read with `read_execution_output`
+// and its process must be reaped by the caller.
+// Returns `-1` in case of failure, else 0.
+int start_execution(execution *dest, worker *worker, uint64_t execution_time);
+
+// Reads the available output of a stream (0 for `stdout`, 1 for `stderr`) of an execution, without blocking.
+// Returns `-1` in case of failure, 1 once the stream is closed, else 0.
+int read_execution_output(execution *execution, uint32_t stream);
+
+// Saves the results of an execution whose process has exited and whose streams are closed (its run and its outputs),
+// then frees its captures.
+// Returns `-1` in case of failure, else 0.
+int finish_execution(execution *execution);
 
-// Code for the worker's thread.
-void *worker_main(void *worker_arg);
+// Closes the streams of an execution and frees its captures (without saving its results).
+void free_execution(execution *execution);
 
-#endif /* WORKER_H. */
\ No newline at end of file
+#endif /* WORKER_H. */
@@ -5,7 +5,9 @@
 #include <string.h>
 #include <getopt.h>
 #include <syslog.h>
+#include <sys/un.h>
 #include <sys/fcntl.h>
+#include <sys/socket.h>
 #include <sy5/utils.h>
 #include <sy5/reply.h>
 #include <sy5/request.h>
@@ -15,23 +17,266 @@
 #include <unistd.h>
 #endif
 
+// ID of the request sent through the socket (a single request is sent per connection).
+#define CASSINI_REQUEST_ID 1
+
 static const char g_help[] =
     "usage: cassini [OPTIONS] -l -> list all tasks\n"
     "\tor: cassini [OPTIONS]    -> same\n"
+    "\tor: cassini [OPTIONS] -L CURSOR -> list the tasks created and removed since CURSOR (0 to list all tasks)\n"
+    "\t\t-> print the new CURSOR (followed by `reset` if all tasks are listed), then the created tasks (like -l)\n"
+    "\t\t   and the TASKID of each removed task prefixed by -\n"
     "\tor: cassini [OPTIONS] -q -> terminate the daemon\n"
-    "\tor: cassini [OPTIONS] -c [-m MINUTES] [-H HOURS] [-d DAYSOFWEEK] COMMAND_NAME [ARG_1] ... [ARG_N]\n"
-    "\t\t-> add a new task and print its TASKID\n"
+    "\tor: cassini [OPTIONS] -c [-A] [-m MINUTES] [-H HOURS] [-d DAYSOFWEEK] COMMAND_NAME [ARG_1] ... [ARG_N]\n"
+    "\t\t-> add a new task and print its TASKID (keeping the outputs of every run of the task with -A)\n"
     "\t\t\tformat & semantics of the \"timing\" fields defined here:\n"
     "\t\t\thttps://pubs.opengroup.org/onlinepubs/9699919799/utilities/crontab.html\n"
     "\t\t\tdefault value for each field is \"*\"\n"
     "\tor: cassini [OPTIONS] -r TASKID -> remove a task\n"
     "\tor: cassini [OPTIONS] -x TASKID -> get info (time + exit code) on all the past runs of a task\n"
+    "\tor: cassini [OPTIONS] -x TASKID [-f SINCE] [-t UNTIL] [-k OFFSET] [-n LIMIT]\n"
+    "\t\t-> get info on the past runs of a task made between SINCE and UNTIL (in seconds since EPOCH, both included),\n"
+    "\t\t   skipping the OFFSET latest ones and keeping at most the LIMIT latest ones left\n"
     "\tor: cassini [OPTIONS] -o TASKID -> get the standard output of the last run of a task\n"
     "\tor: cassini [OPTIONS] -e TASKID -> get the standard error of the last run of a task\n"
+    "\tor: cassini [OPTIONS] -O TASKID [-k OFFSET | -t UNTIL] -> get the standard output of a past run of a task\n"
+    "\t\t-> created with -A, skipping the OFFSET latest runs or of the latest run made at or before UNTIL\n"
+    "\tor: cassini [OPTIONS] -E TASKID [-k OFFSET | -t UNTIL] -> same for the standard error\n"
+    "\tor: cassini [OPTIONS] -b FILE -> send the requests of FILE (or of the standard input if FILE is -) at once\n"
+    "\t\t-> a request per line, blank lines and lines starting with # being skipped:\n"
+    "\t\t\tc MINUTES HOURS DAYSOFWEEK COMMAND_NAME [ARG_1] ... [ARG_N] -> add a new task and print its TASKID\n"
+    "\t\t\tr TASKID -> remove a task\n"
+    "\t\t\tx TASKID -> get info (time + exit code) on all the past runs of a task\n"
+    "\t\t   the requests which fail are reported on the standard error (the others are still performed)\n"
     "\tor: cassini -h -> display this message\n"
     "\n"
     "options:\n"
-    "\t-p PIPES_DIR -> look for the pipes in PIPES_DIR (default: /tmp/<USERNAME>/saturnd/pipes)\n";
+    "\t-p PIPES_DIR -> look for the pipes in PIPES_DIR (default: /tmp/<USERNAME>/saturnd/pipes)\n"
+    "\t-s -> send the request through the daemon's Unix domain socket in PIPES_DIR (see `saturnd -s`)\n";
+
+// Describes a request of a batch.
+typedef struct batch_item {
+    uint16_t opcode;
+    
+    // Line of the request in the batch (to report its failure).
+    uint32_t line;
+} batch_item;
+
+// Connects to the daemon's socket.
+// Returns `-1` in case of failure, else the socket.
+static int connect_socket() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    assert(strlen(g_socket_path) < sizeof(address.sun_path));
+    strcpy(address.sun_path, g_socket_path);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd != -1);
+    
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+// Writes a request of a batch from the words of its line (see `g_help`) in a `data`.
+// Returns `-1` in case of failure (or if the line is malformed), else 0.
+static int write_batch_item(buffer *buf, char **words, uint32_t count, uint16_t *opcode) {
+    if (strcmp(words[0], "c") == 0 && count >= 5) {
+        *opcode = CLIENT_REQUEST_CREATE_TASK;
+        task task;
+        assert(timing_from_strings(&task.timing, words[1], words[2], words[3]) != -1);
+        assert(commandline_from_args(&task.commandline, count - 4, words + 4) != -1);
+        int err = write_uint16(buf, opcode) == -1 || write_task(buf, &task, 0) == -1 ? -1 : 0;
+        free_task(&task);
+        
+        return err;
+    }
+    
+    if ((strcmp(words[0], "r") == 0 || strcmp(words[0], "x") == 0) && count == 2) {
+        *opcode = words[0][0] == 'r' ? CLIENT_REQUEST_REMOVE_TASK : CLIENT_REQUEST_GET_TIMES_AND_EXITCODES;
+        char *strtoull_endp = NULL;
+        uint64_t taskid = strtoull(words[1], &strtoull_endp, 10);
+        assert(strtoull_endp != words[1] && strtoull_endp[0] == '\0');
+        assert(write_uint16(buf, opcode) != -1);
+        assert(write_uint64(buf, &taskid) != -1);
+        
+        return 0;
+    }
+    
+    return -1;
+}
+
+// Reads a batch of requests from a file (a request per line, see `g_help`) and writes them in a `data`, each request
+// being described in `*items` (to read its reply).
+// Returns `-1` in case of failure, else 0.
+static int read_batch(FILE *file, buffer *buf, batch_item **items) {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    int err = 0;
+    
+    for (uint32_t line_number = 1; err != -1 && getline(&line, &line_capacity, file) != -1; line_number++) {
+        char **words = NULL;
+        for (char *word = strtok(line, " \t\r\n"); err != -1 && word != NULL; word = strtok(NULL, " \t\r\n")) {
+            err = array_push(words, word);
+        }
+        
+        if (err != -1 && array_size(words) > 0 && words[0][0] != '#') {
+            batch_item item = { .line = line_number };
+            err = write_batch_item(buf, words, (uint32_t)array_size(words), &item.opcode);
+            if (err == -1) {
+                fprintf(stderr, EXECUTABLE_NAME ": malformed request at line %u of the batch\n", line_number);
+            }
+            err = err != -1 ? array_push(*items, item) : err;
+        }
+        array_free(words);
+    }
+    
+    free(line);
+    
+    return err != -1 && !ferror(file) ? 0 : -1;
+}
+
+// Prints the TASKID of a `CLIENT_REQUEST_CREATE_TASK` reply.
+// Returns `-1` in case of failure, else 0.
+static int print_taskid(reader *rd) {
+    uint64_t taskid;
+    assert(read_uint64(rd, &taskid) != -1);
+#ifdef __APPLE__
+    printf("%llu\n", taskid);
+#else
+    printf("%lu\n", taskid);
+#endif
+    
+    return 0;
+}
+
+// Prints the tasks of a `CLIENT_REQUEST_LIST_TASKS` reply.
+// Returns `-1` in case of failure, else 0.
+static int print_tasks(reader *rd) {
+    task *tasks = NULL;
+    int nbtasks = read_task_array(rd, &tasks);
+    assert(nbtasks != -1);
+    
+    int err = 0;
+    for (int i = 0; i < nbtasks; i++) {
+        char timing_str[TIMING_TEXT_MIN_BUFFERSIZE];
+        err = err != -1 ? timing_string_from_timing(timing_str, &tasks[i].timing) : err;
+        if (err != -1) {
+#ifdef __APPLE__
+            printf("%llu: %s", tasks[i].taskid, timing_str);
+#else
+            printf("%lu: %s", tasks[i].taskid, timing_str);
+#endif
+        }
+        for (uint32_t j = 0; err != -1 && j < tasks[i].commandline.argc; j++) {
+            char *argv_str = NULL;
+            err = cstring_from_string(&argv_str, &tasks[i].commandline.argv[j]);
+            if (err != -1 && argv_str != NULL) {
+                printf(" %s", argv_str);
+            }
+            free(argv_str);
+        }
+        if (err != -1) {
+            printf("\n");
+        }
+        free_task(&tasks[i]);
+    }
+    array_free(tasks);
+    
+    return err;
+}
+
+// Prints a `CLIENT_REQUEST_LIST_TASKS_SINCE` reply: its cursor, the created tasks then the removed taskids.
+// Returns `-1` in case of failure, else 0.
+static int print_task_changes(reader *rd) {
+    uint64_t cursor;
+    uint8_t reset;
+    assert(read_uint64(rd, &cursor) != -1);
+    assert(read_uint8(rd, &reset) != -1);
+#ifdef __APPLE__
+    printf("%llu%s\n", cursor, reset ? " reset" : "");
+#else
+    printf("%lu%s\n", cursor, reset ? " reset" : "");
+#endif
+    
+    assert(print_tasks(rd) != -1);
+    
+    uint32_t nbremoved;
+    assert(read_uint32(rd, &nbremoved) != -1);
+    for (uint32_t i = 0; i < nbremoved; i++) {
+        uint64_t taskid;
+        assert(read_uint64(rd, &taskid) != -1);
+#ifdef __APPLE__
+        printf("-%llu\n", taskid);
+#else
+        printf("-%lu\n", taskid);
+#endif
+    }
+    
+    return 0;
+}
+
+// Prints the runs of a `CLIENT_REQUEST_GET_TIMES_AND_EXITCODES` reply.
+// Returns `-1` in case of failure, else 0.
+static int print_runs(reader *rd) {
+    run *runs = NULL;
+    int nbruns = read_run_array(rd, &runs);
+    assert(nbruns != -1);
+    for (int i = 0; i < nbruns; i++) {
+        time_t timestamp = (time_t)runs[i].time;
+        struct tm *time_info = localtime(&timestamp);
+        char time_str[26];
+        if (strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", time_info) == 0) {
+            array_free(runs);
+            return -1;
+        }
+        printf("%s %d\n", time_str, runs[i].exitcode);
+    }
+    array_free(runs);
+    
+    return 0;
+}
+
+// Prints the replies to the requests of a batch, the requests which failed being reported on `stderr`.
+// Returns `-1` in case of failure, `1` if a request of the batch failed, else 0.
+static int print_batch_replies(reader *rd, const batch_item *items) {
+    uint32_t count;
+    assert(read_uint32(rd, &count) != -1);
+    assert(count == array_size(items));
+    
+    int failed = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t reptype;
+        assert(read_uint16(rd, &reptype) != -1);
+        
+        if (reptype != SERVER_REPLY_OK) {
+            uint16_t errcode;
+            assert(read_uint16(rd, &errcode) != -1);
+            const char *errname = reply_error_item_names()[errcode];
+            fprintf(stderr, EXECUTABLE_NAME ": request at line %u of the batch failed with error `%s`\n", items[i].line,
+                errname != NULL ? errname : "SERVER_REPLY_ERROR_UNKNOWN");
+            failed = 1;
+            continue;
+        }
+        
+        switch (items[i].opcode) {
+        case CLIENT_REQUEST_CREATE_TASK:
+            assert(print_taskid(rd) != -1);
+            break;
+        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES:
+            assert(print_runs(rd) != -1);
+            break;
+        default:
+            break;
+        }
+    }
+    
+    return failed;
+}
 
 int main(int argc, char *argv[]) {
     errno = 0;
@@ -43,11 +288,23 @@ int main(int argc, char *argv[]) {
     char *opt_daysofweek = "*";
     uint16_t opt_opcode = 0;
     uint64_t opt_taskid = 0;
+    uint64_t opt_cursor = 0;
+    int opt_use_socket = 0;
+    int opt_use_range = 0;
+    uint64_t opt_since = 0;
+    uint64_t opt_until = UINT64_MAX;
+    uint32_t opt_offset = 0;
+    uint32_t opt_limit = 0;
+    int opt_keep_history = 0;
+    uint8_t opt_stream = 0;
+    char *opt_batch_path = NULL;
     char *strtoull_endp = NULL;
+    buffer batch = create_buffer();
+    batch_item *batch_items = NULL;
     
     // Parse options.
     int opt;
-    while ((opt = getopt(argc, argv, "hp:lcqm:H:d:r:x:o:e:")) != -1) {
+    while ((opt = getopt(argc, argv, "hp:slL:cAqm:H:d:r:x:f:t:k:n:o:e:O:E:b:")) != -1) {
         switch (opt) {
         case 'h':
             printf("%s", g_help);
@@ -56,12 +313,23 @@ int main(int argc, char *argv[]) {
             g_pipes_path = strdup(optarg);
             fatal_assert(g_pipes_path != NULL);
             break;
+        case 's':
+            opt_use_socket = 1;
+            break;
         case 'l':
             opt_opcode = CLIENT_REQUEST_LIST_TASKS;
             break;
+        case 'L':
+            opt_opcode = CLIENT_REQUEST_LIST_TASKS_SINCE;
+            opt_cursor = strtoull(optarg, &strtoull_endp, 10);
+            fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
+            break;
         case 'c':
             opt_opcode = CLIENT_REQUEST_CREATE_TASK;
             break;
+        case 'A':
+            opt_keep_history = 1;
+            break;
         case 'q':
             opt_opcode = CLIENT_REQUEST_TERMINATE;
             break;
@@ -84,6 +352,26 @@ int main(int argc, char *argv[]) {
             opt_taskid = strtoull(optarg, &strtoull_endp, 10);
             fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
             break;
+        case 'f':
+            opt_use_range = 1;
+            opt_since = strtoull(optarg, &strtoull_endp, 10);
+            fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
+            break;
+        case 't':
+            opt_use_range = 1;
+            opt_until = strtoull(optarg, &strtoull_endp, 10);
+            fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
+            break;
+        case 'k':
+            opt_use_range = 1;
+            opt_offset = strtoul(optarg, &strtoull_endp, 10);
+            fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
+            break;
+        case 'n':
+            opt_use_range = 1;
+            opt_limit = strtoul(optarg, &strtoull_endp, 10);
+            fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
+            break;
         case 'o':
             opt_opcode = CLIENT_REQUEST_GET_STDOUT;
             opt_taskid = strtoull(optarg, &strtoull_endp, 10);
@@ -94,6 +382,17 @@ int main(int argc, char *argv[]) {
             opt_taskid = strtoull(optarg, &strtoull_endp, 10);
             fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
             break;
+        case 'O':
+        case 'E':
+            opt_opcode = CLIENT_REQUEST_GET_PAST_OUTPUT;
+            opt_stream = opt == 'O' ? 0 : 1;
+            opt_taskid = strtoull(optarg, &strtoull_endp, 10);
+            fatal_assert(strtoull_endp != optarg && strtoull_endp[0] == '\0');
+            break;
+        case 'b':
+            opt_opcode = CLIENT_REQUEST_BATCH;
+            opt_batch_path = optarg;
+            break;
         case '?':
             used_unexisting_option = 1;
             break;
@@ -110,13 +409,49 @@ int main(int argc, char *argv[]) {
         opt_opcode = CLIENT_REQUEST_LIST_TASKS;
     }
     
+    // A time window, an offset or a limit turns `-x` into a range request.
+    if (opt_opcode == CLIENT_REQUEST_GET_TIMES_AND_EXITCODES && opt_use_range) {
+        opt_opcode = CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE;
+    }
+    
+    // An upper bound turns `-O` and `-E` into a request by time.
+    if (opt_opcode == CLIENT_REQUEST_GET_PAST_OUTPUT && opt_until != UINT64_MAX) {
+        opt_opcode = CLIENT_REQUEST_GET_PAST_OUTPUT_AT;
+    }
+    
+    if (opt_opcode == CLIENT_REQUEST_CREATE_TASK && opt_keep_history) {
+        opt_opcode = CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY;
+    }
+    
+    // The batch is read before connecting to the daemon (the standard input may be slow to come).
+    if (opt_opcode == CLIENT_REQUEST_BATCH) {
+        FILE *batch_file = strcmp(opt_batch_path, "-") == 0 ? stdin : fopen(opt_batch_path, "r");
+        fatal_assert(batch_file != NULL);
+        int read_err = read_batch(batch_file, &batch, &batch_items);
+        if (batch_file != stdin) {
+            fclose(batch_file);
+        }
+        fatal_assert(read_err != -1);
+    }
+    
     fatal_assert(allocate_paths() != -1);
     
     int request_write_fd;
     int connection_attempts = 0;
     do {
-        // Open the request pipe in writing.
-        request_write_fd = open(g_request_pipe_path, O_WRONLY | O_NONBLOCK);
+        if (opt_use_socket) {
+            // Connects to the socket.
+            request_write_fd = connect_socket();
+        } else {
+            // Open the request pipe in writing.
+            request_write_fd = open(g_request_pipe_path, O_WRONLY | O_NONBLOCK);
+            
+            // Only the opening must not block (a batch may not fit in the pipe at once).
+            if (request_write_fd != -1 && fcntl(request_write_fd, F_SETFL, 0) == -1) {
+                close(request_write_fd);
+                goto error;
+            }
+        }
         
         if (request_write_fd == -1) {
             fatal_assert_with_log(connection_attempts < 10, "cannot open request pipe within 100ms, timing out.\n");
@@ -128,14 +463,21 @@ int main(int argc, char *argv[]) {
         }
     } while (1);
     
-    log2("sending to daemon `%s`.\n", request_item_names()[opt_opcode]);
+    errno = 0;
+    
+    log2("sending to daemon `%s`.\n", request_item_name(opt_opcode));
     
-    // Writes a request.
+    // Writes a request (in a frame tagged with a request ID when using the socket).
     buffer buf = create_buffer();
+    uint32_t frame_start = 0;
+    if (opt_use_socket) {
+        fatal_assert(begin_frame(&buf, CASSINI_REQUEST_ID, &frame_start) != -1);
+    }
     fatal_assert(write_uint16(&buf, &opt_opcode) != -1);
     
     switch (opt_opcode) {
-    case CLIENT_REQUEST_CREATE_TASK: {
+    case CLIENT_REQUEST_CREATE_TASK:
+    case CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY: {
         task task;
         fatal_assert(timing_from_strings(&task.timing, opt_minutes, opt_hours, opt_daysofweek) != -1);
         fatal_assert(commandline_from_args(&task.commandline, argc - optind, argv + optind) != -1);
@@ -150,87 +492,113 @@ int main(int argc, char *argv[]) {
         fatal_assert(write_uint64(&buf, &opt_taskid) != -1);
         break;
     }
+    case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE: {
+        fatal_assert(write_uint64(&buf, &opt_taskid) != -1);
+        fatal_assert(write_uint64(&buf, &opt_since) != -1);
+        fatal_assert(write_uint64(&buf, &opt_until) != -1);
+        fatal_assert(write_uint32(&buf, &opt_offset) != -1);
+        fatal_assert(write_uint32(&buf, &opt_limit) != -1);
+        break;
+    }
+    case CLIENT_REQUEST_GET_PAST_OUTPUT: {
+        fatal_assert(write_uint64(&buf, &opt_taskid) != -1);
+        fatal_assert(write_uint8(&buf, &opt_stream) != -1);
+        fatal_assert(write_uint32(&buf, &opt_offset) != -1);
+        break;
+    }
+    case CLIENT_REQUEST_GET_PAST_OUTPUT_AT: {
+        fatal_assert(write_uint64(&buf, &opt_taskid) != -1);
+        fatal_assert(write_uint8(&buf, &opt_stream) != -1);
+        fatal_assert(write_uint64(&buf, &opt_until) != -1);
+        break;
+    }
+    case CLIENT_REQUEST_LIST_TASKS_SINCE: {
+        fatal_assert(write_uint64(&buf, &opt_cursor) != -1);
+        break;
+    }
+    case CLIENT_REQUEST_BATCH: {
+        uint32_t nbrequests = (uint32_t)array_size(batch_items);
+        fatal_assert(write_uint32(&buf, &nbrequests) != -1);
+        fatal_assert(write_bytes(&buf, batch.data, batch.length) != -1);
+        break;
+    }
     default:
         break;
     }
     
+    if (opt_use_socket) {
+        fatal_assert(end_frame(&buf, frame_start, 0) != -1);
+    }
+    
     fatal_assert(write_buffer(request_write_fd, &buf) != -1);
     free(buf.data);
-    fatal_assert(close(request_write_fd) != -1);
     
     // Waits for a reply...
-    int reply_read_fd = open(g_reply_pipe_path, O_RDONLY);
-    fatal_assert(reply_read_fd != -1);
+    int reply_read_fd;
+    if (opt_use_socket) {
+        reply_read_fd = request_write_fd;
+    } else {
+        fatal_assert(close(request_write_fd) != -1);
+        reply_read_fd = open(g_reply_pipe_path, O_RDONLY);
+        fatal_assert(reply_read_fd != -1);
+    }
+    reader reply_reader = create_reader(reply_read_fd);
+    
+    if (opt_use_socket) {
+        uint32_t frame_length;
+        uint64_t requestid;
+        fatal_assert(read_uint32(&reply_reader, &frame_length) != -1);
+        fatal_assert(read_uint64(&reply_reader, &requestid) != -1);
+        fatal_assert(requestid == CASSINI_REQUEST_ID);
+    }
     
     // Reads a reply.
     uint16_t reptype;
-    fatal_assert(read_uint16(reply_read_fd, &reptype) != -1);
+    fatal_assert(read_uint16(&reply_reader, &reptype) != -1);
     
     if (reptype == SERVER_REPLY_OK) {
         log2("reply received `%s`.\n", reply_item_names()[reptype]);
         
         switch (opt_opcode) {
-        case CLIENT_REQUEST_LIST_TASKS: {
-            task *tasks = NULL;
-            uint32_t nbtasks = read_task_array(reply_read_fd, &tasks);
-            fatal_assert(nbtasks != -1);
-            for (uint32_t i = 0; i < nbtasks; i++) {
-                char timing_str[TIMING_TEXT_MIN_BUFFERSIZE];
-                fatal_assert(timing_string_from_timing(timing_str, &tasks[i].timing) != -1);
-#ifdef __APPLE__
-                printf("%llu: %s", tasks[i].taskid, timing_str);
-#else
-                printf("%lu: %s", tasks[i].taskid, timing_str);
-#endif
-                for (uint32_t j = 0; j < tasks[i].commandline.argc; j++) {
-                    char *argv_str = NULL;
-                    fatal_assert(cstring_from_string(&argv_str, &tasks[i].commandline.argv[j]) != -1);
-                    if (argv_str != NULL) {
-                        printf(" %s", argv_str);
-                    }
-                    free(argv_str);
-                }
-                printf("\n");
-                free_task(&tasks[i]);
-            }
-            array_free(tasks);
+        case CLIENT_REQUEST_LIST_TASKS:
+            fatal_assert(print_tasks(&reply_reader) != -1);
             break;
-        }
-        case CLIENT_REQUEST_CREATE_TASK: {
-            uint64_t taskid;
-            fatal_assert(read_uint64(reply_read_fd, &taskid) != -1);
-#ifdef __APPLE__
-            printf("%llu\n", taskid);
-#else
-            printf("%lu\n", taskid);
-#endif
+        case CLIENT_REQUEST_LIST_TASKS_SINCE:
+            fatal_assert(print_task_changes(&reply_reader) != -1);
             break;
-        }
-        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES: {
-            run *runs = NULL;
-            uint32_t nbruns = read_run_array(reply_read_fd, &runs);
-            fatal_assert(nbruns != -1);
-            for (uint32_t i = 0; i < nbruns; i++) {
-                time_t timestamp = (time_t)runs[i].time;
-                struct tm *time_info = localtime(&timestamp);
-                char time_str[26];
-                fatal_assert(strftime(time_str, 26, "%Y-%m-%d %H:%M:%S", time_info) != -1);
-                printf("%s %d\n", time_str, runs[i].exitcode);
-            }
-            array_free(runs);
+        case CLIENT_REQUEST_CREATE_TASK:
+        case CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY:
+            fatal_assert(print_taskid(&reply_reader) != -1);
+            break;
+        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES:
+        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE:
+            fatal_assert(print_runs(&reply_reader) != -1);
             break;
-        }
         case CLIENT_REQUEST_GET_STDOUT:
         case CLIENT_REQUEST_GET_STDERR: {
-            string output;
-            fatal_assert(read_string(reply_read_fd, &output) != -1);
-            char *output_str = NULL;
-            fatal_assert(cstring_from_string(&output_str, &output) != -1);
-            if (output_str != NULL) {
-                printf("%s", output_str);
-            }
-            free_string(&output);
-            free(output_str);
+            // The output is streamed to `stdout` in chunks as it is received (it is never held in memory at once).
+            uint32_t output_length;
+            fatal_assert(read_uint32(&reply_reader, &output_length) != -1);
+            fatal_assert(fflush(stdout) != EOF);
+            fatal_assert(read_to_fd(&reply_reader, STDOUT_FILENO, output_length) != -1);
+            break;
+        }
+        case CLIENT_REQUEST_GET_PAST_OUTPUT:
+        case CLIENT_REQUEST_GET_PAST_OUTPUT_AT: {
+            // The time of the run comes before its output (which is streamed like the outputs of the last run).
+            uint64_t run_time;
+            uint32_t output_length;
+            fatal_assert(read_uint64(&reply_reader, &run_time) != -1);
+            fatal_assert(read_uint32(&reply_reader, &output_length) != -1);
+            fatal_assert(fflush(stdout) != EOF);
+            fatal_assert(read_to_fd(&reply_reader, STDOUT_FILENO, output_length) != -1);
+            break;
+        }
+        case CLIENT_REQUEST_BATCH: {
+            // The failure of a request of the batch is only reported once every reply has been printed.
+            int batch_status = print_batch_replies(&reply_reader, batch_items);
+            fatal_assert(batch_status != -1);
+            exit_code = batch_status == 1 ? EXIT_FAILURE : exit_code;
             break;
         }
         default:
@@ -238,7 +606,7 @@ int main(int argc, char *argv[]) {
         }
     } else {
         uint16_t errcode;
-        fatal_assert(read_uint16(reply_read_fd, &errcode) != -1);
+        fatal_assert(read_uint16(&reply_reader, &errcode) != -1);
         log2("reply received `%s` with error `%s`.\n", reply_item_names()[reptype], reply_error_item_names()[errcode]);
         goto error;
     }
@@ -252,6 +620,8 @@ int main(int argc, char *argv[]) {
     
     cleanup:
     cleanup_paths();
+    free(batch.data);
+    array_free(batch_items);
     
     return exit_code;
 }
\ No newline at end of file
@@ -2,4 +2,5 @@
 
 char *g_pipes_path = NULL;
 char *g_request_pipe_path =  NULL;
-char *g_reply_pipe_path = NULL;
\ No newline at end of file
+char *g_reply_pipe_path = NULL;
+char *g_socket_path = NULL;
\ No newline at end of file
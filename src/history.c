@@ -0,0 +1,306 @@
+#include <sy5/history.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sy5/lz.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+
+// Magic number at the beginning of a history ('OUTH').
+#define HISTORY_MAGIC 0x4F555448
+
+// Version of the format of a history.
+#define HISTORY_VERSION 1
+
+// Size of the header of a history (its magic number and its version, as two `uint32`).
+#define HISTORY_HEADER_SIZE (2 * sizeof(uint32_t))
+
+// Size of the header of a record (its time as an `uint64`, then the length of each output and the length of its blocks
+// as `uint32`).
+#define HISTORY_RECORD_HEADER_SIZE (sizeof(uint64_t) + 4 * sizeof(uint32_t))
+
+// Maximum number of bytes of an output in a block (a block can be decompressed without the others).
+#define HISTORY_BLOCK_SIZE (64 * 1024)
+
+// Flag of the header of a block (its length as an `uint32`) set when the block is kept as is.
+#define HISTORY_BLOCK_STORED 0x80000000U
+
+// Describes the header of a record.
+typedef struct record_header {
+    uint64_t time;
+    
+    // Length of each output.
+    uint32_t lengths[2];
+    
+    // Length of the blocks of each output.
+    uint32_t blocks_lengths[2];
+} record_header;
+
+history create_history() {
+    history history = {
+        .fd = -1,
+        .runs = NULL,
+        .size = 0
+    };
+    
+    return history;
+}
+
+// Writes `length` bytes at `offset` in a file (retrying on short writes).
+// Returns `-1` in case of failure, else 0.
+static int write_at(int fd, const uint8_t *data, uint64_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t count = pwrite(fd, data, length, (off_t)offset);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        
+        assert(count > 0);
+        data += count;
+        length -= count;
+        offset += count;
+    }
+    
+    return 0;
+}
+
+// Reads the header of the record at `offset`.
+// Returns `-1` in case of failure, else 0.
+static int read_record_header(int fd, uint64_t offset, record_header *dest) {
+    uint8_t bytes[HISTORY_RECORD_HEADER_SIZE];
+    assert(pread(fd, bytes, sizeof(bytes), (off_t)offset) == sizeof(bytes));
+    
+    reader rd = create_memory_reader(bytes, sizeof(bytes));
+    assert(read_uint64(&rd, &dest->time) != -1);
+    for (uint32_t i = 0; i < 2; i++) {
+        assert(read_uint32(&rd, &dest->lengths[i]) != -1);
+        assert(read_uint32(&rd, &dest->blocks_lengths[i]) != -1);
+    }
+    
+    return 0;
+}
+
+// Reads the runs of a history (cutting off a partial record left by a crash) or writes the header of a new one.
+// Returns `-1` in case of failure, else 0.
+static int read_history(history *history) {
+    struct stat file_stat;
+    assert(fstat(history->fd, &file_stat) != -1);
+    uint64_t file_size = (uint64_t)file_stat.st_size;
+    
+    if (file_size < HISTORY_HEADER_SIZE) {
+        uint32_t fields[] = { HISTORY_MAGIC, HISTORY_VERSION };
+        buffer buf = create_buffer();
+        int err = write_uint32(&buf, &fields[0]) == -1 || write_uint32(&buf, &fields[1]) == -1 ||
+            write_at(history->fd, buf.data, buf.length, 0) == -1 ? -1 : 0;
+        free(buf.data);
+        assert(err != -1);
+        
+        history->size = HISTORY_HEADER_SIZE;
+        return ftruncate(history->fd, HISTORY_HEADER_SIZE);
+    }
+    
+    uint8_t header[HISTORY_HEADER_SIZE];
+    uint32_t magic;
+    uint32_t version;
+    assert(pread(history->fd, header, sizeof(header), 0) == sizeof(header));
+    reader rd = create_memory_reader(header, sizeof(header));
+    assert(read_uint32(&rd, &magic) != -1 && read_uint32(&rd, &version) != -1);
+    assert(magic == HISTORY_MAGIC && version == HISTORY_VERSION);
+    
+    // Only the headers of the records are read (their blocks are skipped).
+    uint64_t offset = HISTORY_HEADER_SIZE;
+    while (offset + HISTORY_RECORD_HEADER_SIZE <= file_size) {
+        record_header record;
+        assert(read_record_header(history->fd, offset, &record) != -1);
+        
+        uint64_t record_size = HISTORY_RECORD_HEADER_SIZE + (uint64_t)record.blocks_lengths[0] +
+            record.blocks_lengths[1];
+        if (offset + record_size > file_size) {
+            break;
+        }
+        
+        history_run run = { .time = record.time, .offset = offset };
+        assert(array_push(history->runs, run) != -1);
+        offset += record_size;
+    }
+    
+    history->size = offset;
+    
+    return offset < file_size ? ftruncate(history->fd, (off_t)offset) : 0;
+}
+
+int open_history(history *dest, const char *path, int create) {
+    *dest = create_history();
+    
+    dest->fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0666);
+    assert(dest->fd != -1);
+    
+    if (read_history(dest) == -1) {
+        close_history(dest);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Writes an output in blocks (compressed when they can be) to a `data`.
+// Returns `-1` in case of failure, else 0.
+static int write_blocks(buffer *buf, const string *output) {
+    for (uint32_t position = 0; position < output->length; position += HISTORY_BLOCK_SIZE) {
+        uint32_t length = output->length - position;
+        length = length < HISTORY_BLOCK_SIZE ? length : HISTORY_BLOCK_SIZE;
+        
+        // The block is compressed right after the space of its header (which is then written without reallocating).
+        assert(buffer_reserve(buf, buf->length + sizeof(uint32_t) + lz_compress_bound(length)) != -1);
+        uint8_t *block = buf->data + buf->length + sizeof(uint32_t);
+        uint32_t block_length = lz_compress(output->data + position, length, block);
+        uint32_t block_header = block_length;
+        
+        if (block_length >= length) {
+            assert(memcpy(block, output->data + position, length) != NULL);
+            block_length = length;
+            block_header = length | HISTORY_BLOCK_STORED;
+        }
+        
+        assert(write_uint32(buf, &block_header) != -1);
+        buf->length += block_length;
+    }
+    
+    return 0;
+}
+
+int append_history(history *history, uint64_t time, const string outputs[2]) {
+    record_header record = { .time = time };
+    buffer buf = create_buffer();
+    int err = buffer_reserve(&buf, HISTORY_RECORD_HEADER_SIZE);
+    buf.length = HISTORY_RECORD_HEADER_SIZE;
+    
+    for (uint32_t i = 0; err != -1 && i < 2; i++) {
+        uint32_t blocks_start = buf.length;
+        err = write_blocks(&buf, &outputs[i]);
+        record.lengths[i] = outputs[i].length;
+        record.blocks_lengths[i] = buf.length - blocks_start;
+    }
+    
+    // The header is written in front of the blocks once their lengths are known.
+    if (err != -1) {
+        uint32_t blocks_end = buf.length;
+        buf.length = 0;
+        err = write_uint64(&buf, &record.time);
+        for (uint32_t i = 0; err != -1 && i < 2; i++) {
+            err = write_uint32(&buf, &record.lengths[i]) == -1 || write_uint32(&buf, &record.blocks_lengths[i]) == -1 ?
+                -1 : 0;
+        }
+        buf.length = blocks_end;
+    }
+    
+    // The record is written in one go at the end of the history (a crash in the middle is cut off on the next open).
+    err = err != -1 ? write_at(history->fd, buf.data, buf.length, history->size) : err;
+    free(buf.data);
+    
+    if (err == -1) {
+        ftruncate(history->fd, (off_t)history->size);
+        return -1;
+    }
+    
+    history_run run = { .time = time, .offset = history->size };
+    assert(array_push(history->runs, run) != -1);
+    history->size += buf.length;
+    
+    return 0;
+}
+
+int find_history_run(const history *history, uint32_t index, uint64_t *run) {
+    uint64_t count = array_size(history->runs);
+    assert(index < count);
+    *run = count - 1 - index;
+    
+    return 0;
+}
+
+int find_history_run_at(const history *history, uint64_t time, uint64_t *run) {
+    // Finds the first run made after `time` (the runs are appended in chronological order).
+    uint64_t low = 0;
+    uint64_t high = array_size(history->runs);
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (history->runs[middle].time <= time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    assert(low > 0);
+    *run = low - 1;
+    
+    return 0;
+}
+
+int read_history_output(const history *history, uint64_t run, uint32_t stream, string *dest) {
+    record_header record;
+    assert(run < array_size(history->runs));
+    assert(read_record_header(history->fd, history->runs[run].offset, &record) != -1);
+    
+    uint64_t blocks_offset = history->runs[run].offset + HISTORY_RECORD_HEADER_SIZE +
+        (stream == 0 ? 0 : record.blocks_lengths[0]);
+    uint32_t blocks_length = record.blocks_lengths[stream];
+    
+    // The lengths are read from the file, so they are checked before anything is allocated for them: the blocks are in
+    // the history and the output is no longer than its blocks can decompress to.
+    assert(blocks_offset + blocks_length <= history->size);
+    assert(record.lengths[stream] <= (uint64_t)blocks_length * LZ_MAX_RATIO);
+    uint8_t *blocks = malloc(blocks_length + 1);
+    uint8_t *output = malloc((size_t)record.lengths[stream] + 1);
+    int err = blocks && output ? 0 : -1;
+    
+    if (err != -1 && pread(history->fd, blocks, blocks_length, (off_t)blocks_offset) != blocks_length) {
+        err = -1;
+    }
+    
+    // Decompresses the blocks one after the other.
+    reader rd = create_memory_reader(blocks, blocks_length);
+    for (uint32_t position = 0; err != -1 && position < record.lengths[stream]; position += HISTORY_BLOCK_SIZE) {
+        uint32_t length = record.lengths[stream] - position;
+        length = length < HISTORY_BLOCK_SIZE ? length : HISTORY_BLOCK_SIZE;
+        
+        uint32_t block_header;
+        err = read_uint32(&rd, &block_header);
+        uint32_t block_length = block_header & ~HISTORY_BLOCK_STORED;
+        if (err == -1 || block_length > rd.length - rd.position) {
+            err = -1;
+            break;
+        }
+        
+        const uint8_t *block = blocks + rd.position;
+        if (block_header & HISTORY_BLOCK_STORED) {
+            err = block_length == length && memcpy(output + position, block, length) != NULL ? 0 : -1;
+        } else {
+            err = lz_decompress(block, block_length, output + position, length);
+        }
+        rd.position += block_length;
+    }
+    
+    free(blocks);
+    if (err == -1) {
+        free(output);
+        return -1;
+    }
+    
+    dest->length = record.lengths[stream];
+    dest->data = output;
+    
+    return 0;
+}
+
+void close_history(history *history) {
+    if (history->fd != -1) {
+        close(history->fd);
+    }
+    array_free(history->runs);
+    
+    *history = create_history();
+}
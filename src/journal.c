@@ -0,0 +1,844 @@
+#include <sy5/journal.h>
+#include <stdio.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+#include <sy5/history.h>
+#include <sy5/taskmap.h>
+
+// Magic numbers at the beginning of the journal ('JRNL') and of its snapshot ('SNAP').
+#define JOURNAL_MAGIC 0x4A524E4C
+#define JOURNAL_SNAPSHOT_MAGIC 0x534E4150
+
+// Version of the format of the journal and of its snapshot.
+#define JOURNAL_VERSION 1
+
+// Size of the header of the journal (its magic number, its version and its generation, as three `uint32`).
+#define JOURNAL_HEADER_SIZE (3 * sizeof(uint32_t))
+
+// Size of the header of the snapshot (its magic number, its version and the generation of the journal to replay after
+// it as three `uint32`, then the offset in that journal from which to replay and the next taskid as two `uint64`).
+#define JOURNAL_SNAPSHOT_HEADER_SIZE (3 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+
+// Size of the header of a record (the length of its body and its checksum, as two `uint32`).
+#define JOURNAL_RECORD_HEADER_SIZE (2 * sizeof(uint32_t))
+
+// Size of the beginning of the body of a record (its kind as an `uint8`, then its taskid as an `uint64`).
+#define JOURNAL_RECORD_BODY_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint64_t))
+
+// Kinds of records.
+#define JOURNAL_RECORD_CREATE 'C'
+#define JOURNAL_RECORD_REMOVE 'R'
+
+// Minimum size of the journal before it is compacted (it is also compacted only once bigger than the snapshot).
+#define JOURNAL_COMPACTION_MIN_SIZE (1024 * 1024)
+
+// Suffix of the files written before replacing the journal or its snapshot.
+#define JOURNAL_NEW_SUFFIX ".new"
+
+// Describes a task of the journal (the body of its creation record).
+typedef struct journal_task {
+    uint64_t taskid;
+    uint8_t *record;
+    uint32_t length;
+} journal_task;
+
+// Lock protecting every variable of the journal.
+static pthread_mutex_t g_journal_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Condition signaled when pending records have been written and synced (or failed to be).
+static pthread_cond_t g_journal_cond = PTHREAD_COND_INITIALIZER;
+
+// Condition signaled when the background thread has work to do.
+static pthread_cond_t g_background_cond = PTHREAD_COND_INITIALIZER;
+
+// Non-zero while the journal is opened (only written before the background thread starts and after it stops).
+static int g_journal_opened = 0;
+
+static char *g_tasks_path = NULL;
+static int g_journal_fd = -1;
+
+// Generation of the journal (incremented each time it is replaced after a snapshot).
+static uint32_t g_generation = 0;
+
+// Size of the journal (the records written and synced).
+static uint64_t g_journal_size = 0;
+
+// Size of the last snapshot.
+static uint64_t g_snapshot_size = 0;
+
+// Records appended but not written yet.
+static buffer g_pending = { 0 };
+
+// Sequence numbers of the last record appended and of the last record durable.
+static int64_t g_appended_seq = 0;
+static int64_t g_durable_seq = 0;
+
+// Non-zero while a thread writes and syncs pending records.
+static int g_committing = 0;
+
+// Non-zero once writing the journal failed (every later append fails).
+static int g_failed = 0;
+
+// Tasks of the journal (in no particular order), and their index in `g_tasks` by taskid.
+static journal_task *g_tasks = NULL;
+static taskmap g_tasks_index = { 0 };
+
+static uint64_t g_next_taskid = 0;
+
+// Taskids of the removed tasks whose files are left to delete.
+static uint64_t *g_discarded = NULL;
+
+// Background thread (writing snapshots and deleting files) and whether it must stop.
+static pthread_t g_background_thread;
+static int g_background_started = 0;
+static int g_stopping = 0;
+
+// Computes the checksum of a record's body (FNV-1a).
+static uint32_t checksum(const uint8_t *data, uint32_t length) {
+    uint32_t hash = 2166136261U;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619U;
+    }
+    
+    return hash;
+}
+
+// Writes `length` bytes at `offset` in a file (retrying on short writes).
+// Returns `-1` in case of failure, else 0.
+static int write_at(int fd, const uint8_t *data, uint64_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t count = pwrite(fd, data, length, (off_t)offset);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        
+        assert(count > 0);
+        data += count;
+        length -= count;
+        offset += count;
+    }
+    
+    return 0;
+}
+
+// Reads a whole file in `*dest` (which is `NULL` if the file does not exist).
+// Returns `-1` in case of failure, else 0.
+static int read_file(const char *path, buffer *dest) {
+    *dest = create_buffer();
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 && errno == ENOENT) {
+        errno = 0;
+        return 0;
+    }
+    assert(fd != -1);
+    
+    struct stat file_stat;
+    int err = fstat(fd, &file_stat) != -1 && file_stat.st_size < UINT32_MAX ? 0 : -1;
+    err = err != -1 ? buffer_reserve(dest, (uint32_t)file_stat.st_size + 1) : err;
+    if (err != -1 && pread(fd, dest->data, file_stat.st_size, 0) != file_stat.st_size) {
+        err = -1;
+    }
+    dest->length = err != -1 ? (uint32_t)file_stat.st_size : 0;
+    close(fd);
+    
+    if (err == -1) {
+        free(dest->data);
+        *dest = create_buffer();
+    }
+    
+    return err;
+}
+
+// Builds the path of a file of the tasks directory in `dest`.
+// Returns `-1` if the path is too long, else 0.
+static int tasks_file_path(char dest[PATH_MAX], const char *name, const char *suffix) {
+    return snprintf(dest, PATH_MAX, "%s%s%s", g_tasks_path, name, suffix) < PATH_MAX ? 0 : -1;
+}
+
+// Makes the creation or the renaming of a file in the tasks directory durable.
+// Returns `-1` in case of failure, else 0.
+static int sync_tasks_directory() {
+    int fd = open(g_tasks_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    assert(fd != -1);
+    int err = fsync(fd);
+    close(fd);
+    
+    return err;
+}
+
+// Writes a record (its header, then its body) to a `data`.
+// Returns `-1` in case of failure, else 0.
+static int write_record(buffer *buf, const uint8_t *body, uint32_t length) {
+    uint32_t sum = checksum(body, length);
+    assert(write_uint32(buf, &length) != -1);
+    assert(write_uint32(buf, &sum) != -1);
+    assert(write_bytes(buf, body, length) != -1);
+    
+    return 0;
+}
+
+// Applies the body of a record to the tasks of the journal.
+// Returns `-1` in case of failure (or if the record is malformed), else 0.
+static int apply_record(const uint8_t *body, uint32_t length) {
+    uint8_t kind;
+    uint64_t taskid;
+    reader rd = create_memory_reader(body, length);
+    assert(read_uint8(&rd, &kind) != -1 && read_uint64(&rd, &taskid) != -1);
+    assert(taskid != TASKMAP_EMPTY_KEY);
+    
+    uint64_t index;
+    int found = taskmap_get(&g_tasks_index, taskid, &index);
+    
+    if (kind == JOURNAL_RECORD_REMOVE) {
+        // The last task takes the place of the removed one.
+        if (found) {
+            free(g_tasks[index].record);
+            g_tasks[index] = array_last(g_tasks);
+            assert(taskmap_put(&g_tasks_index, g_tasks[index].taskid, index) != -1);
+            assert(array_pop(g_tasks) != -1);
+            taskmap_remove(&g_tasks_index, taskid);
+        }
+        
+        return 0;
+    }
+    
+    assert(kind == JOURNAL_RECORD_CREATE);
+    journal_task new_task = { .taskid = taskid, .record = malloc(length), .length = length };
+    assert(new_task.record != NULL);
+    memcpy(new_task.record, body, length);
+    
+    if (found) {
+        free(g_tasks[index].record);
+        g_tasks[index] = new_task;
+    } else if (array_push(g_tasks, new_task) == -1 ||
+        taskmap_put(&g_tasks_index, taskid, array_size(g_tasks) - 1) == -1) {
+        free(new_task.record);
+        return -1;
+    }
+    
+    if (taskid >= g_next_taskid) {
+        g_next_taskid = taskid + 1;
+    }
+    
+    return 0;
+}
+
+// Applies the records of `data` from `offset`, stopping at the first partial or corrupted one (left by a crash).
+// Returns `-1` in case of failure, else the offset following the last record applied.
+static int64_t apply_records(const buffer *data, uint64_t offset) {
+    while (offset + JOURNAL_RECORD_HEADER_SIZE <= data->length) {
+        uint32_t length;
+        uint32_t sum;
+        reader rd = create_memory_reader(data->data + offset, JOURNAL_RECORD_HEADER_SIZE);
+        assert(read_uint32(&rd, &length) != -1 && read_uint32(&rd, &sum) != -1);
+        
+        const uint8_t *body = data->data + offset + JOURNAL_RECORD_HEADER_SIZE;
+        if (length > data->length - offset - JOURNAL_RECORD_HEADER_SIZE || checksum(body, length) != sum) {
+            break;
+        }
+        
+        assert(apply_record(body, length) != -1);
+        offset += JOURNAL_RECORD_HEADER_SIZE + length;
+    }
+    
+    return (int64_t)offset;
+}
+
+// Reads the snapshot (if any): its tasks are applied, and the generation of the journal to replay after it and the
+// offset from which to replay it are written in `*generation` and `*offset` (`*generation` being 0 without snapshot).
+// Returns `-1` in case of failure, else 0.
+static int read_snapshot(uint32_t *generation, uint64_t *offset) {
+    char path[PATH_MAX];
+    buffer data;
+    assert(tasks_file_path(path, JOURNAL_SNAPSHOT_FILE_NAME, "") != -1);
+    assert(read_file(path, &data) != -1);
+    
+    *generation = 0;
+    if (data.data == NULL) {
+        return 0;
+    }
+    
+    // A snapshot is only renamed once entirely written, so it cannot hold a partial record.
+    uint32_t magic;
+    uint32_t version;
+    reader rd = create_memory_reader(data.data, data.length);
+    int err = read_uint32(&rd, &magic) == -1 || read_uint32(&rd, &version) == -1 ||
+        read_uint32(&rd, generation) == -1 || read_uint64(&rd, offset) == -1 ||
+        read_uint64(&rd, &g_next_taskid) == -1 ? -1 : 0;
+    err = err != -1 && magic == JOURNAL_SNAPSHOT_MAGIC && version == JOURNAL_VERSION && *generation > 0 ? 0 : -1;
+    err = err != -1 && apply_records(&data, JOURNAL_SNAPSHOT_HEADER_SIZE) == data.length ? 0 : -1;
+    g_snapshot_size = data.length;
+    free(data.data);
+    
+    return err;
+}
+
+// Imports the tasks of the per-task directories written without a journal (from their `task` file).
+// Returns `-1` in case of failure, else 0.
+static int import_task_directories() {
+    DIR *tasks_dir = opendir(g_tasks_path);
+    assert(tasks_dir != NULL);
+    
+    int64_t seq = 0;
+    struct dirent *entry;
+    while (seq != -1 && (entry = readdir(tasks_dir)) != NULL) {
+        char *unparsed = NULL;
+        uint64_t taskid = strtoull(entry->d_name, &unparsed, 10);
+        if (unparsed == entry->d_name || *unparsed != '\0') {
+            continue;
+        }
+        
+        // A directory whose `task` file is missing or cannot be read (left over by a crash) is not imported, so it is
+        // deleted in the background like the directories of the removed tasks. Its taskid is not given to a new task
+        // meanwhile.
+        char path[PATH_MAX];
+        int fd = snprintf(path, sizeof(path), "%s%s/task", g_tasks_path, entry->d_name) < (int)sizeof(path) ?
+            open(path, O_RDONLY | O_CLOEXEC) : -1;
+        reader task_reader = create_reader(fd);
+        task imported;
+        if (fd == -1 || read_task(&task_reader, &imported, 1) == -1) {
+            log2("cannot import task %llu, its directory is discarded!\n", (unsigned long long)taskid);
+            g_next_taskid = taskid >= g_next_taskid ? taskid + 1 : g_next_taskid;
+            errno = 0;
+        } else {
+            imported.taskid = taskid;
+            seq = journal_create_task(&imported);
+            free_task(&imported);
+        }
+        
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    
+    closedir(tasks_dir);
+    
+    return seq != -1 ? sync_journal(seq) : -1;
+}
+
+// Finds the directories (and the histories) of the tasks which are not in the journal anymore, left over by a crash
+// or by a previous run of the daemon, so that the background thread deletes them.
+// Returns `-1` in case of failure, else 0.
+static int find_discarded_tasks() {
+    char history_path[PATH_MAX];
+    assert(tasks_file_path(history_path, HISTORY_DIRECTORY_NAME, "/") != -1);
+    const char *paths[] = { g_tasks_path, history_path };
+    
+    for (uint32_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        DIR *dir = opendir(paths[i]);
+        if (dir == NULL && errno == ENOENT) {
+            errno = 0;
+            continue;
+        }
+        assert(dir != NULL);
+        
+        struct dirent *entry;
+        int err = 0;
+        while (err != -1 && (entry = readdir(dir)) != NULL) {
+            char *unparsed = NULL;
+            uint64_t taskid = strtoull(entry->d_name, &unparsed, 10);
+            if (unparsed != entry->d_name && *unparsed == '\0' && !taskmap_get(&g_tasks_index, taskid, NULL)) {
+                err = array_push(g_discarded, taskid);
+            }
+        }
+        
+        closedir(dir);
+        errno = 0;
+        assert(err != -1);
+    }
+    
+    return 0;
+}
+
+// Deletes the directory and the history of a removed task (if they exist).
+static void delete_task_files(uint64_t taskid) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%llu", g_tasks_path, (unsigned long long)taskid);
+    
+    DIR *dir = opendir(path);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 &&
+                unlinkat(dirfd(dir), entry->d_name, 0) == -1) {
+                log2("cannot delete a file of task %llu!\n", (unsigned long long)taskid);
+            }
+        }
+        closedir(dir);
+        
+        if (rmdir(path) == -1) {
+            log2("cannot delete the directory of task %llu!\n", (unsigned long long)taskid);
+        }
+    }
+    
+    snprintf(path, sizeof(path), "%s" HISTORY_DIRECTORY_NAME "/%llu", g_tasks_path, (unsigned long long)taskid);
+    if (unlink(path) == -1 && errno != ENOENT) {
+        log2("cannot delete the history of task %llu!\n", (unsigned long long)taskid);
+    }
+    
+    errno = 0;
+}
+
+// Deletes the new file of the file `name` of the tasks directory (if any).
+static void delete_new_file(const char *name) {
+    char new_path[PATH_MAX];
+    if (tasks_file_path(new_path, name, JOURNAL_NEW_SUFFIX) != -1) {
+        unlink(new_path);
+    }
+}
+
+// Writes `length` bytes of `data` in the new file of the file `name` of the tasks directory, synced so that it can
+// replace it (see `rename_new_file`).
+// Returns `-1` in case of failure, else the descriptor of the new file.
+static int write_new_file(const char *name, const uint8_t *data, uint64_t length) {
+    char new_path[PATH_MAX];
+    assert(tasks_file_path(new_path, name, JOURNAL_NEW_SUFFIX) != -1);
+    
+    int fd = open(new_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    assert(fd != -1);
+    
+    if (write_at(fd, data, length, 0) == -1 || fdatasync(fd) == -1) {
+        close(fd);
+        unlink(new_path);
+        return -1;
+    }
+    
+    return fd;
+}
+
+// Replaces the file `name` of the tasks directory by its new file (the replacement is only durable once the tasks
+// directory is synced).
+// Returns `-1` in case of failure, else 0.
+static int rename_new_file(const char *name) {
+    char path[PATH_MAX];
+    char new_path[PATH_MAX];
+    assert(tasks_file_path(path, name, "") != -1 && tasks_file_path(new_path, name, JOURNAL_NEW_SUFFIX) != -1);
+    
+    return rename(new_path, path);
+}
+
+// Writes `length` bytes of `data` in a new file of the tasks directory, synced before it replaces the file `name`.
+// Returns `-1` in case of failure, else the descriptor of the new file.
+static int replace_file(const char *name, const uint8_t *data, uint64_t length) {
+    int fd = write_new_file(name, data, length);
+    assert(fd != -1);
+    
+    if (rename_new_file(name) == -1 || sync_tasks_directory() == -1) {
+        close(fd);
+        delete_new_file(name);
+        return -1;
+    }
+    
+    return fd;
+}
+
+// Writes the header of a journal of generation `generation` to a `data`.
+// Returns `-1` in case of failure, else 0.
+static int write_journal_header(buffer *buf, uint32_t generation) {
+    uint32_t fields[] = { JOURNAL_MAGIC, JOURNAL_VERSION, generation };
+    for (uint32_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        assert(write_uint32(buf, &fields[i]) != -1);
+    }
+    
+    return 0;
+}
+
+// Writes a snapshot of the tasks, then replaces the journal by a new one (of the next generation) holding the records
+// appended since the snapshot. The journal's lock is never held while writing: appends are never blocked, and commits
+// only while the records committed during the writing of the new journal are copied to it and it replaces the journal.
+// Returns `-1` in case of failure, else 0.
+static int compact_journal() {
+    // The snapshot holds the records appended until now, it is written once they are all durable (so that it cannot
+    // hold a record whose append failed). The records being written by a group commit are not counted in the size of
+    // the journal yet, so it is waited for (else the replay offset would fall in the middle of a record).
+    pthread_mutex_lock(&g_journal_lock);
+    while (g_committing) {
+        pthread_cond_wait(&g_journal_cond, &g_journal_lock);
+    }
+    
+    uint32_t fields[] = { JOURNAL_SNAPSHOT_MAGIC, JOURNAL_VERSION, g_generation };
+    uint64_t offset = g_journal_size + g_pending.length;
+    int64_t seq = g_appended_seq;
+    buffer snapshot = create_buffer();
+    int err = 0;
+    for (uint32_t i = 0; err != -1 && i < sizeof(fields) / sizeof(fields[0]); i++) {
+        err = write_uint32(&snapshot, &fields[i]);
+    }
+    err = err != -1 && write_uint64(&snapshot, &offset) != -1 ? write_uint64(&snapshot, &g_next_taskid) : -1;
+    for (uint64_t i = 0; err != -1 && i < array_size(g_tasks); i++) {
+        err = write_record(&snapshot, g_tasks[i].record, g_tasks[i].length);
+    }
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    err = err != -1 ? sync_journal(seq) : err;
+    int snapshot_fd = err != -1 ? replace_file(JOURNAL_SNAPSHOT_FILE_NAME, snapshot.data, snapshot.length) : -1;
+    uint64_t snapshot_size = snapshot.length;
+    free(snapshot.data);
+    assert(snapshot_fd != -1);
+    close(snapshot_fd);
+    
+    // A crash from now on replays the snapshot then the current journal from `offset`, until it is replaced. The new
+    // journal starts with the records committed until now (the descriptor and the generation of the journal are only
+    // changed by the compaction).
+    pthread_mutex_lock(&g_journal_lock);
+    while (g_committing) {
+        pthread_cond_wait(&g_journal_cond, &g_journal_lock);
+    }
+    uint64_t copied_end = g_journal_size;
+    uint32_t generation = g_generation + 1;
+    int fd = g_journal_fd;
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    buffer journal = create_buffer();
+    uint64_t tail_length = copied_end - offset;
+    err = write_journal_header(&journal, generation) == -1 ||
+        buffer_reserve(&journal, JOURNAL_HEADER_SIZE + tail_length) == -1 ? -1 : 0;
+    if (err != -1 && pread(fd, journal.data + journal.length, tail_length, (off_t)offset) != (ssize_t)tail_length) {
+        err = -1;
+    }
+    journal.length += err != -1 ? tail_length : 0;
+    int journal_fd = err != -1 ? write_new_file(JOURNAL_FILE_NAME, journal.data, journal.length) : -1;
+    uint64_t journal_size = journal.length;
+    free(journal.data);
+    assert(journal_fd != -1);
+    
+    // The commits are then blocked (as if one was in progress, so the lock is not held) while the records committed
+    // meanwhile are copied to the new journal and it replaces the current one: a commit acknowledged before the
+    // replacement is durable is then in both journals.
+    pthread_mutex_lock(&g_journal_lock);
+    while (g_committing) {
+        pthread_cond_wait(&g_journal_cond, &g_journal_lock);
+    }
+    g_committing = 1;
+    uint64_t committed_length = g_journal_size - copied_end;
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    uint8_t *committed = malloc(committed_length + 1);
+    err = committed != NULL && pread(fd, committed, committed_length, (off_t)copied_end) == (ssize_t)committed_length &&
+        write_at(journal_fd, committed, committed_length, journal_size) != -1 && fdatasync(journal_fd) != -1 ? 0 : -1;
+    free(committed);
+    int renamed = err != -1 && rename_new_file(JOURNAL_FILE_NAME) != -1;
+    int synced = renamed && sync_tasks_directory() != -1;
+    
+    pthread_mutex_lock(&g_journal_lock);
+    if (renamed) {
+        close(g_journal_fd);
+        g_journal_fd = journal_fd;
+        g_journal_size = journal_size + committed_length;
+        g_generation = generation;
+        g_snapshot_size = snapshot_size;
+    } else {
+        close(journal_fd);
+        delete_new_file(JOURNAL_FILE_NAME);
+    }
+    
+    // The journal is replaced, but it may not be after a crash, so nothing can be committed to it anymore.
+    if (renamed && !synced) {
+        log("cannot sync the replacement of the journal!\n");
+        g_failed = 1;
+    }
+    
+    g_committing = 0;
+    pthread_cond_broadcast(&g_journal_cond);
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    return synced ? 0 : -1;
+}
+
+// Checks if the journal must be compacted (with the journal's lock held).
+static int needs_compaction() {
+    return !g_failed && g_journal_size > JOURNAL_COMPACTION_MIN_SIZE && g_journal_size > g_snapshot_size;
+}
+
+// Deletes the files of the removed tasks and compacts the journal when needed, until the journal is closed.
+static void *background_main(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_journal_lock);
+    
+    while (1) {
+        while (!g_stopping && array_empty(g_discarded) && !needs_compaction()) {
+            pthread_cond_wait(&g_background_cond, &g_journal_lock);
+        }
+        
+        // The files left to delete are deleted even when stopping.
+        if (!array_empty(g_discarded)) {
+            uint64_t taskid = array_last(g_discarded);
+            array_pop(g_discarded);
+            pthread_mutex_unlock(&g_journal_lock);
+            delete_task_files(taskid);
+            pthread_mutex_lock(&g_journal_lock);
+            continue;
+        }
+        
+        if (g_stopping) {
+            break;
+        }
+        
+        pthread_mutex_unlock(&g_journal_lock);
+        int err = compact_journal();
+        pthread_mutex_lock(&g_journal_lock);
+        
+        // A failed compaction is only retried once the journal has doubled.
+        if (err == -1) {
+            log("cannot compact the journal!\n");
+            g_snapshot_size = g_journal_size * 2;
+        }
+    }
+    
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    return NULL;
+}
+
+// Opens the journal (creating it if needed) and replays it after its snapshot.
+// Returns `-1` in case of failure, else 0.
+static int replay_journal() {
+    char path[PATH_MAX];
+    char new_path[PATH_MAX];
+    
+    // The new files of an interrupted compaction are left over.
+    for (uint32_t i = 0; i < 2; i++) {
+        const char *name = i == 0 ? JOURNAL_FILE_NAME : JOURNAL_SNAPSHOT_FILE_NAME;
+        assert(tasks_file_path(new_path, name, JOURNAL_NEW_SUFFIX) != -1);
+        assert(unlink(new_path) != -1 || errno == ENOENT);
+        errno = 0;
+    }
+    
+    uint32_t snapshot_generation;
+    uint64_t snapshot_offset;
+    assert(read_snapshot(&snapshot_generation, &snapshot_offset) != -1);
+    
+    assert(tasks_file_path(path, JOURNAL_FILE_NAME, "") != -1);
+    buffer data;
+    assert(read_file(path, &data) != -1);
+    
+    // A new journal follows the snapshot, and imports the tasks of the per-task directories if there is none.
+    if (data.length < JOURNAL_HEADER_SIZE) {
+        free(data.data);
+        g_generation = snapshot_generation + 1;
+        buffer header = create_buffer();
+        assert(write_journal_header(&header, g_generation) != -1);
+        g_journal_fd = replace_file(JOURNAL_FILE_NAME, header.data, header.length);
+        g_journal_size = header.length;
+        free(header.data);
+        assert(g_journal_fd != -1);
+        
+        return snapshot_generation == 0 ? import_task_directories() : 0;
+    }
+    
+    uint32_t magic;
+    uint32_t version;
+    reader rd = create_memory_reader(data.data, data.length);
+    int err = read_uint32(&rd, &magic) == -1 || read_uint32(&rd, &version) == -1 ||
+        read_uint32(&rd, &g_generation) == -1 || magic != JOURNAL_MAGIC || version != JOURNAL_VERSION ? -1 : 0;
+    
+    // The journal is replayed from the snapshot's offset if it has not been replaced since the snapshot.
+    uint64_t offset = JOURNAL_HEADER_SIZE;
+    if (snapshot_generation != 0 && g_generation == snapshot_generation) {
+        offset = snapshot_offset;
+    } else if (snapshot_generation != 0 && g_generation != snapshot_generation + 1) {
+        err = -1;
+    }
+    
+    int64_t end = err != -1 && offset <= data.length ? apply_records(&data, offset) : -1;
+    free(data.data);
+    assert(end != -1);
+    
+    g_journal_fd = open(path, O_RDWR | O_CLOEXEC);
+    assert(g_journal_fd != -1);
+    g_journal_size = (uint64_t)end;
+    
+    // A partial record left by a crash is cut off.
+    return ftruncate(g_journal_fd, (off_t)g_journal_size);
+}
+
+int open_journal(const char *tasks_path) {
+    g_tasks_path = strdup(tasks_path);
+    assert(g_tasks_path != NULL);
+    g_tasks_index = create_taskmap();
+    g_pending = create_buffer();
+    g_journal_opened = 1;
+    
+    assert(replay_journal() != -1);
+    assert(find_discarded_tasks() != -1);
+    
+    assert(pthread_create(&g_background_thread, NULL, background_main, NULL) == 0);
+    g_background_started = 1;
+    
+    return 0;
+}
+
+void close_journal() {
+    if (!g_journal_opened) {
+        return;
+    }
+    
+    if (g_background_started) {
+        pthread_mutex_lock(&g_journal_lock);
+        g_stopping = 1;
+        pthread_cond_signal(&g_background_cond);
+        pthread_mutex_unlock(&g_journal_lock);
+        pthread_join(g_background_thread, NULL);
+        g_background_started = 0;
+    }
+    
+    if (g_journal_fd != -1) {
+        close(g_journal_fd);
+        g_journal_fd = -1;
+    }
+    
+    for (uint64_t i = 0; i < array_size(g_tasks); i++) {
+        free(g_tasks[i].record);
+    }
+    array_free(g_tasks);
+    array_free(g_discarded);
+    free_taskmap(&g_tasks_index);
+    free(g_pending.data);
+    g_pending = create_buffer();
+    free(g_tasks_path);
+    g_tasks_path = NULL;
+    g_journal_opened = 0;
+}
+
+int is_journal_opened() {
+    return g_journal_opened;
+}
+
+int list_journal_taskids(uint64_t **taskids) {
+    pthread_mutex_lock(&g_journal_lock);
+    
+    int err = array_reserve(*taskids, array_size(*taskids) + array_size(g_tasks));
+    for (uint64_t i = 0; err != -1 && i < array_size(g_tasks); i++) {
+        err = array_push(*taskids, g_tasks[i].taskid);
+    }
+    
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    return err;
+}
+
+uint64_t get_journal_next_taskid() {
+    pthread_mutex_lock(&g_journal_lock);
+    uint64_t next_taskid = g_next_taskid;
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    return next_taskid;
+}
+
+int find_journal_task(uint64_t taskid, task *dest) {
+    pthread_mutex_lock(&g_journal_lock);
+    
+    uint64_t index;
+    int err = taskmap_get(&g_tasks_index, taskid, &index) ? 0 : -1;
+    if (err != -1) {
+        reader rd = create_memory_reader(g_tasks[index].record + JOURNAL_RECORD_BODY_HEADER_SIZE,
+            g_tasks[index].length - JOURNAL_RECORD_BODY_HEADER_SIZE);
+        err = read_task(&rd, dest, 0);
+        dest->taskid = taskid;
+    }
+    
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    return err;
+}
+
+// Appends the body of a record to the journal (and applies it to its tasks), without waiting for it to be durable.
+// Returns `-1` in case of failure, else the sequence number of the record.
+static int64_t append_record(const buffer *body) {
+    pthread_mutex_lock(&g_journal_lock);
+    
+    int64_t seq = -1;
+    if (!g_failed && apply_record(body->data, body->length) != -1 &&
+        write_record(&g_pending, body->data, body->length) != -1) {
+        seq = ++g_appended_seq;
+    }
+    
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    return seq;
+}
+
+int64_t journal_create_task(const task *task) {
+    uint8_t kind = JOURNAL_RECORD_CREATE;
+    buffer body = create_buffer();
+    int64_t seq = write_uint8(&body, &kind) == -1 || write_uint64(&body, &task->taskid) == -1 ||
+        write_task(&body, task, 0) == -1 ? -1 : append_record(&body);
+    free(body.data);
+    
+    return seq;
+}
+
+int64_t journal_remove_task(uint64_t taskid) {
+    uint8_t kind = JOURNAL_RECORD_REMOVE;
+    buffer body = create_buffer();
+    int64_t seq = write_uint8(&body, &kind) == -1 || write_uint64(&body, &taskid) == -1 ? -1 : append_record(&body);
+    free(body.data);
+    
+    return seq;
+}
+
+int sync_journal(int64_t seq) {
+    pthread_mutex_lock(&g_journal_lock);
+    
+    while (g_durable_seq < seq && !g_failed) {
+        // Another thread is writing: its records and the ones appended since are written by the next one.
+        if (g_committing) {
+            pthread_cond_wait(&g_journal_cond, &g_journal_lock);
+            continue;
+        }
+        
+        // Writes and syncs every pending record (including the ones of the threads waiting).
+        buffer records = g_pending;
+        g_pending = create_buffer();
+        int64_t last_seq = g_appended_seq;
+        uint64_t offset = g_journal_size;
+        int fd = g_journal_fd;
+        g_committing = 1;
+        pthread_mutex_unlock(&g_journal_lock);
+        
+        int err = write_at(fd, records.data, records.length, offset) == -1 || fdatasync(fd) == -1 ? -1 : 0;
+        free(records.data);
+        
+        pthread_mutex_lock(&g_journal_lock);
+        g_committing = 0;
+        if (err == -1) {
+            log("cannot write the journal!\n");
+            g_failed = 1;
+        } else {
+            g_journal_size += records.length;
+            g_durable_seq = last_seq;
+        }
+        pthread_cond_broadcast(&g_journal_cond);
+        
+        if (needs_compaction()) {
+            pthread_cond_signal(&g_background_cond);
+        }
+    }
+    
+    int err = g_durable_seq >= seq ? 0 : -1;
+    pthread_mutex_unlock(&g_journal_lock);
+    
+    return err;
+}
+
+void discard_task_files(uint64_t taskid) {
+    pthread_mutex_lock(&g_journal_lock);
+    
+    if (array_push(g_discarded, taskid) == -1) {
+        log2("cannot delete the files of task %llu!\n", (unsigned long long)taskid);
+    }
+    pthread_cond_signal(&g_background_cond);
+    
+    pthread_mutex_unlock(&g_journal_lock);
+}
@@ -0,0 +1,176 @@
+#include <sy5/lz.h>
+#include <string.h>
+#include <sy5/utils.h>
+
+// Minimum length of a match.
+#define LZ_MIN_MATCH 4
+
+// Number of bits of the hash of 4 bytes (the size of the table of the last positions of each hash).
+#define LZ_HASH_BITS 12
+
+// A match must start at least 12 bytes before the end, and the last 5 bytes are always literals.
+#define LZ_MATCH_START_LIMIT 12
+#define LZ_LAST_LITERALS 5
+
+// Maximum offset of a match.
+#define LZ_MAX_OFFSET 65535
+
+// A length field of a token (4 bits) holding 15 is followed by bytes to add to it (until a byte which is not 255).
+#define LZ_LENGTH_MASK 15
+
+static uint32_t read_4_bytes(const uint8_t *bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    
+    return value;
+}
+
+static uint32_t hash_4_bytes(uint32_t value) {
+    return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes the part of a length which does not fit in its token.
+static uint8_t *write_length(uint8_t *out, uint32_t length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = (uint8_t)length;
+    
+    return out;
+}
+
+// Reads the part of a length which does not fit in its token.
+// Returns `-1` if the data ends before the length, else 0.
+static int read_length(const uint8_t **in, const uint8_t *end, uint32_t *length) {
+    uint8_t byte;
+    do {
+        assert(*in < end);
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    
+    return 0;
+}
+
+// Writes a token, its literals and its match (if `match_length` is not 0).
+static uint8_t *write_sequence(uint8_t *out, const uint8_t *literals, uint32_t literals_length, uint32_t offset,
+    uint32_t match_length) {
+    uint32_t match_field = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+    uint8_t *token = out++;
+    *token = (uint8_t)((literals_length < LZ_LENGTH_MASK ? literals_length : LZ_LENGTH_MASK) << 4 |
+        (match_field < LZ_LENGTH_MASK ? match_field : LZ_LENGTH_MASK));
+    
+    if (literals_length >= LZ_LENGTH_MASK) {
+        out = write_length(out, literals_length - LZ_LENGTH_MASK);
+    }
+    memcpy(out, literals, literals_length);
+    out += literals_length;
+    
+    if (match_length > 0) {
+        *out++ = (uint8_t)offset;
+        *out++ = (uint8_t)(offset >> 8);
+        if (match_field >= LZ_LENGTH_MASK) {
+            out = write_length(out, match_field - LZ_LENGTH_MASK);
+        }
+    }
+    
+    return out;
+}
+
+uint32_t lz_compress_bound(uint32_t length) {
+    return length + length / 255 + 16;
+}
+
+uint32_t lz_compress(const uint8_t *src, uint32_t length, uint8_t *dest) {
+    // Last position (plus one, 0 meaning none) of each hash of 4 bytes.
+    uint32_t table[1 << LZ_HASH_BITS] = { 0 };
+    const uint8_t *end = src + length;
+    const uint8_t *anchor = src;
+    const uint8_t *in = src;
+    uint8_t *out = dest;
+    
+    while (length > LZ_MATCH_START_LIMIT && in < end - LZ_MATCH_START_LIMIT) {
+        uint32_t sequence = read_4_bytes(in);
+        uint32_t hash = hash_4_bytes(sequence);
+        uint32_t candidate = table[hash];
+        table[hash] = (uint32_t)(in - src) + 1;
+        
+        const uint8_t *ref = candidate > 0 ? src + candidate - 1 : NULL;
+        if (ref == NULL || in - ref > LZ_MAX_OFFSET || read_4_bytes(ref) != sequence) {
+            in++;
+            continue;
+        }
+        
+        // Extends the match backwards (over the pending literals) and forwards.
+        while (in > anchor && ref > src && in[-1] == ref[-1]) {
+            in--;
+            ref--;
+        }
+        
+        const uint8_t *match_end = in + LZ_MIN_MATCH;
+        const uint8_t *ref_end = ref + LZ_MIN_MATCH;
+        while (match_end < end - LZ_LAST_LITERALS && *match_end == *ref_end) {
+            match_end++;
+            ref_end++;
+        }
+        
+        uint32_t match_length = (uint32_t)(match_end - in);
+        out = write_sequence(out, anchor, (uint32_t)(in - anchor), (uint32_t)(in - ref), match_length);
+        in = match_end;
+        anchor = in;
+    }
+    
+    out = write_sequence(out, anchor, (uint32_t)(end - anchor), 0, 0);
+    
+    return (uint32_t)(out - dest);
+}
+
+int lz_decompress(const uint8_t *src, uint32_t length, uint8_t *dest, uint32_t decompressed_length) {
+    const uint8_t *in = src;
+    const uint8_t *end = src + length;
+    uint8_t *out = dest;
+    uint8_t *out_end = dest + decompressed_length;
+    
+    while (in < end) {
+        uint8_t token = *in++;
+        
+        uint32_t literals_length = token >> 4;
+        if (literals_length == LZ_LENGTH_MASK) {
+            assert(read_length(&in, end, &literals_length) != -1);
+        }
+        assert(literals_length <= (uint32_t)(end - in) && literals_length <= (uint32_t)(out_end - out));
+        memcpy(out, in, literals_length);
+        in += literals_length;
+        out += literals_length;
+        
+        // The last token only holds literals.
+        if (in == end) {
+            break;
+        }
+        
+        assert(end - in >= 2);
+        uint32_t offset = in[0] | (uint32_t)in[1] << 8;
+        in += 2;
+        assert(offset > 0 && offset <= (uint32_t)(out - dest));
+        
+        uint32_t match_length = token & LZ_LENGTH_MASK;
+        if (match_length == LZ_LENGTH_MASK) {
+            assert(read_length(&in, end, &match_length) != -1);
+        }
+        match_length += LZ_MIN_MATCH;
+        assert(match_length <= (uint32_t)(out_end - out));
+        
+        // A match may overlap the bytes it produces (to repeat a short pattern), so it is then copied byte by byte.
+        const uint8_t *ref = out - offset;
+        if (offset >= match_length) {
+            memcpy(out, ref, match_length);
+        } else {
+            for (uint32_t i = 0; i < match_length; i++) {
+                out[i] = ref[i];
+            }
+        }
+        out += match_length;
+    }
+    
+    return out == out_end ? 0 : -1;
+}
@@ -10,6 +10,7 @@ static const char *reply_item_names_array[] = {
 static const char *reply_error_item_names_array[] = {
     [SERVER_REPLY_ERROR_NOT_FOUND] = "SERVER_REPLY_ERROR_NOT_FOUND",
     [SERVER_REPLY_ERROR_NEVER_RUN] = "SERVER_REPLY_ERROR_NEVER_RUN",
+    [SERVER_REPLY_ERROR_NO_HISTORY] = "SERVER_REPLY_ERROR_NO_HISTORY",
     
     [SERVER_REPLY_ERROR_COUNT] = 0,
 };
@@ -1,4 +1,5 @@
 #include <sy5/request.h>
+#include <stddef.h>
 
 static const char *request_item_names_array[] = {
     [0] = "CLIENT_REQUEST_NULL",
@@ -10,10 +11,24 @@ static const char *request_item_names_array[] = {
     [CLIENT_REQUEST_GET_STDOUT] = "CLIENT_REQUEST_GET_STDOUT",
     [CLIENT_REQUEST_GET_STDERR] = "CLIENT_REQUEST_GET_STDERR",
     [CLIENT_REQUEST_TERMINATE] = "CLIENT_REQUEST_TERMINATE",
+    [CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE] = "CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE",
+    [CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY] = "CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY",
+    [CLIENT_REQUEST_GET_PAST_OUTPUT] = "CLIENT_REQUEST_GET_PAST_OUTPUT",
+    [CLIENT_REQUEST_GET_PAST_OUTPUT_AT] = "CLIENT_REQUEST_GET_PAST_OUTPUT_AT",
+    [CLIENT_REQUEST_BATCH] = "CLIENT_REQUEST_BATCH",
+    [CLIENT_REQUEST_LIST_TASKS_SINCE] = "CLIENT_REQUEST_LIST_TASKS_SINCE",
     
     [CLIENT_REQUEST_COUNT] = 0,
 };
 
 const char **request_item_names() {
     return request_item_names_array;
+}
+
+const char *request_item_name(uint16_t opcode) {
+    if (opcode >= sizeof(request_item_names_array) / sizeof(request_item_names_array[0])) {
+        return NULL;
+    }
+    
+    return request_item_names_array[opcode];
 }
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -6,15 +9,22 @@
 #include <syslog.h>
 #include <dirent.h>
 #include <limits.h>
+#include <signal.h>
 #include <pthread.h>
+#include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/poll.h>
+#include <sys/socket.h>
 #include <sys/fcntl.h>
 #include <sy5/utils.h>
 #include <sy5/reply.h>
 #include <sy5/array.h>
 #include <sy5/request.h>
 #include <sy5/common.h>
+#include <sy5/store.h>
+#include <sy5/journal.h>
 #include <sy5/worker.h>
+#include <sy5/scheduler.h>
 #ifdef __linux__
 #include <unistd.h>
 #endif
@@ -23,26 +33,1276 @@ static const char g_help[] =
     "usage: saturnd [OPTIONS]\n"
     "\n"
     "options:\n"
-    "\t-p PIPES_DIR -> look for the pipes (or creates them if not existing) in PIPES_DIR (default: /tmp/<USERNAME>/saturnd/pipes)\n";
+    "\t-p PIPES_DIR -> look for the pipes (or creates them if not existing) in PIPES_DIR (default: /tmp/<USERNAME>/saturnd/pipes)\n"
+    "\t-j EXECUTORS -> run the tasks with EXECUTORS threads (default: 4)\n"
+    "\t-s -> also accept clients on a Unix domain socket in PIPES_DIR (saturnd-socket)\n"
+    "\t-w HANDLERS -> handle the requests received on the socket with HANDLERS threads (default: 4)\n"
+    "\t-n MAX_RUNS -> keep at most the MAX_RUNS latest runs of each task (default: 1000)\n"
+    "\t-a MAX_AGE -> forget the runs older than MAX_AGE seconds (default: 0, never)\n"
+    "\t-m MAX_OUTPUT -> keep at most MAX_OUTPUT bytes of each output of a run, its head and its tail (default: 1048576)\n"
+    "\t-c -> keep every task in a single file (<TASKS_DIR>/store) instead of a directory per task\n"
+    "\t-J -> record the creations and removals of tasks in a journal (<TASKS_DIR>/journal) instead of a task file per\n"
+    "\t      task (always done once the tasks directory has a journal, and not compatible with -c)\n";
+
+// Maximum length of a frame received on the socket (bigger frames close the connection).
+#define FRAME_MAX_LENGTH (16 * 1024 * 1024)
+
+// The default number of threads handling the requests received on the socket.
+#define DEFAULT_HANDLERS_COUNT 4
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Describes the running tasks serialized once (as a `task[]`) and shared by the replies listing them.
+typedef struct task_list {
+    // Value of `g_workers_seq` when the tasks were serialized.
+    uint64_t seq;
+    
+    // Number of references to the list (the cache holding one of them), updated atomically.
+    uint32_t references;
+    
+    // Serialized tasks.
+    buffer data;
+} task_list;
+
+// Describes bytes of a reply which are already in memory, sent right after the reply's `buffer` (with `writev`)
+// instead of being copied in it.
+typedef struct reply_payload {
+    const uint8_t *data;
+    uint32_t length;
+    
+    // Serialized list of tasks holding `data` (released once it is sent), or `NULL` if `data` is owned by the payload.
+    task_list *list;
+} reply_payload;
+
+// Describes the end of a reply sent to a client once the replies written before it are sent: a payload sent from
+// memory, then an output streamed straight from its file.
+typedef struct pending_stream {
+    // Position in the `output` of the connection at which the payload and the output are sent.
+    uint32_t position;
+    
+    reply_payload payload;
+    
+    // Number of bytes of the payload already sent.
+    uint32_t payload_position;
+    
+    file_range range;
+} pending_stream;
 
-typedef struct thread_handle {
-    pthread_t pthread;
-    uint64_t taskid;
-} thread_handle;
+// Describes a client connected to the socket.
+typedef struct connection {
+    // Unique ID of the connection (a handled request refers to its connection by its ID, as the connection may be
+    // closed in the meantime).
+    uint64_t id;
+    
+    // Socket of the connection.
+    int fd;
+    
+    // Non-zero while a request of the connection is handled by a handler thread (the requests of a connection are
+    // handled one after the other, in order).
+    int busy;
+    
+    // Bytes received that do not make a whole frame yet.
+    buffer input;
+    
+    // Serialized replies that are not sent yet (from `output_position`).
+    buffer output;
+    
+    // Position of the first byte of `output` that is not sent yet.
+    uint32_t output_position;
+    
+    // Outputs streamed between the replies of `output` (ordered by position).
+    pending_stream *streams;
+} connection;
+
+// Describes a request received on the socket, handled by a handler thread.
+typedef struct request_job {
+    uint64_t connection_id;
+    uint64_t requestid;
+    request request;
+    
+    // Frame of the reply (once the request is handled).
+    buffer reply;
+    
+    // Payload sent after the frame of the reply, then output streamed after it (if any).
+    reply_payload payload;
+    file_range stream;
+    
+    // Non-zero if the request could not be answered (not even with an error), its connection is then closed.
+    int failed;
+    
+    // Next job in its queue.
+    struct request_job *next;
+} request_job;
+
+// Describes a FIFO queue of jobs.
+typedef struct job_queue {
+    request_job *head;
+    request_job *tail;
+} job_queue;
 
 static uint64_t g_last_taskid = 0;
-static thread_handle *g_threads = NULL;
+static char *g_tasks_directory_path = NULL;
+
+// Array of clients connected to the socket.
+static connection *g_connections = NULL;
+
+// ID of the next client connected to the socket.
+static uint64_t g_next_connection_id = 0;
+
+// Non-zero once a `CLIENT_REQUEST_TERMINATE` has been handled (accessed atomically, see `is_terminating`).
+static int g_terminating = 0;
+
+// Lock protecting the queues of jobs and `g_handlers_stopping`.
+static pthread_mutex_t g_jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Condition signaled when a job is queued in `g_pending_jobs` or when the handlers must stop.
+static pthread_cond_t g_jobs_cond = PTHREAD_COND_INITIALIZER;
+
+// Jobs waiting for a handler thread, then handled jobs waiting for the main thread to send their reply.
+static job_queue g_pending_jobs = { NULL, NULL };
+static job_queue g_handled_jobs = { NULL, NULL };
+
+// Non-zero once the handler threads must stop.
+static int g_handlers_stopping = 0;
+
+// Array of the handler threads.
+static pthread_t *g_handler_threads = NULL;
+
+// Thread handling the requests received on the request pipe.
+static pthread_t g_pipe_thread;
+
+// Non-zero if the pipe thread stopped because of a failure (accessed atomically).
+static int g_pipe_thread_failed = 0;
+
+// Pipe waking up the main thread when a job is handled or when the pipe thread stops.
+static int g_wake_pipe[2] = { -1, -1 };
+
+// Latest serialized list of the running tasks (serialized again on the first listing after a change).
+static task_list *g_task_list = NULL;
+
+// Lock protecting `g_task_list`.
+static pthread_mutex_t g_task_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Checks if a `CLIENT_REQUEST_TERMINATE` has been handled (from any thread).
+static int is_terminating() {
+    return __atomic_load_n(&g_terminating, __ATOMIC_ACQUIRE);
+}
+
+// Frees what is owned by a request which has not been handled.
+static void free_request(request *request) {
+    switch (request->opcode) {
+    case CLIENT_REQUEST_CREATE_TASK:
+    case CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY:
+        free_task(&request->task);
+        break;
+    case CLIENT_REQUEST_BATCH:
+        for (uint64_t i = 0; i < array_size(request->batch); i++) {
+            free_request(&request->batch[i]);
+        }
+        array_free(request->batch);
+        break;
+    default:
+        break;
+    }
+}
+
+// Checks if a request can be part of a batch (the requests whose reply is streamed cannot).
+static int is_batch_item(uint16_t opcode) {
+    switch (opcode) {
+    case CLIENT_REQUEST_CREATE_TASK:
+    case CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY:
+    case CLIENT_REQUEST_REMOVE_TASK:
+    case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES:
+    case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Reads the fields of a request (following its opcode), except for a `CLIENT_REQUEST_BATCH`.
+// Returns `-1` in case of failure, else 0.
+static int read_request_fields(reader *rd, request *request) {
+    switch (request->opcode) {
+    case CLIENT_REQUEST_CREATE_TASK:
+    case CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY:
+        assert(read_task(rd, &request->task, 0) != -1);
+        break;
+    case CLIENT_REQUEST_REMOVE_TASK:
+    case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES:
+    case CLIENT_REQUEST_GET_STDOUT:
+    case CLIENT_REQUEST_GET_STDERR:
+        assert(read_uint64(rd, &request->taskid) != -1);
+        break;
+    case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE:
+        assert(read_uint64(rd, &request->taskid) != -1);
+        assert(read_uint64(rd, &request->since) != -1);
+        assert(read_uint64(rd, &request->until) != -1);
+        assert(read_uint32(rd, &request->offset) != -1);
+        assert(read_uint32(rd, &request->limit) != -1);
+        break;
+    case CLIENT_REQUEST_GET_PAST_OUTPUT:
+        assert(read_uint64(rd, &request->taskid) != -1);
+        assert(read_uint8(rd, &request->stream) != -1);
+        assert(read_uint32(rd, &request->run_index) != -1);
+        break;
+    case CLIENT_REQUEST_GET_PAST_OUTPUT_AT:
+        assert(read_uint64(rd, &request->taskid) != -1);
+        assert(read_uint8(rd, &request->stream) != -1);
+        assert(read_uint64(rd, &request->run_time) != -1);
+        break;
+    case CLIENT_REQUEST_LIST_TASKS_SINCE:
+        assert(read_uint64(rd, &request->cursor) != -1);
+        break;
+    default:
+        break;
+    }
+    
+    return 0;
+}
+
+// Reads the requests of a `CLIENT_REQUEST_BATCH` (a batch cannot hold another batch).
+// Returns `-1` in case of failure, else 0.
+static int read_batch(reader *rd, request **batch) {
+    uint32_t count;
+    assert(read_uint32(rd, &count) != -1);
+    
+    // The array grows as the requests are read (a malformed count must not reserve more than what is received).
+    *batch = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        request item;
+        if (read_uint16(rd, &item.opcode) == -1 || item.opcode == CLIENT_REQUEST_BATCH ||
+            read_request_fields(rd, &item) == -1 || array_push(*batch, item) == -1) {
+            request failed = { .opcode = CLIENT_REQUEST_BATCH, .batch = *batch };
+            free_request(&failed);
+            *batch = NULL;
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+// Reads a request.
+// Returns `-1` in case of failure, else 0.
+static int read_request(reader *rd, request *request) {
+    assert(read_uint16(rd, &request->opcode) != -1);
+    
+    if (request->opcode == CLIENT_REQUEST_BATCH) {
+        return read_batch(rd, &request->batch);
+    }
+    
+    return read_request_fields(rd, request);
+}
+
+// Releases a reference to a serialized list of tasks, freeing it once it is not used anymore.
+static void release_task_list(task_list *list) {
+    if (list != NULL && __atomic_sub_fetch(&list->references, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(list->data.data);
+        free(list);
+    }
+}
+
+static reply_payload create_reply_payload() {
+    reply_payload payload = { .data = NULL, .length = 0, .list = NULL };
+    
+    return payload;
+}
+
+// Frees a reply payload (whether or not it is entirely sent).
+static void free_reply_payload(reply_payload *payload) {
+    if (payload->list != NULL) {
+        release_task_list(payload->list);
+    } else {
+        free((void *)payload->data);
+    }
+    
+    *payload = create_reply_payload();
+}
+
+// Writes the reply to a request which failed (an error with no error code, like the reply to an unknown request) in a
+// `data`.
+// Returns `-1` in case of failure, else 0.
+static int write_failure_reply(buffer *buf) {
+    uint16_t fields[] = { SERVER_REPLY_ERROR, 0 };
+    assert(write_uint16(buf, &fields[0]) != -1 && write_uint16(buf, &fields[1]) != -1);
+    
+    return 0;
+}
+
+// Gets the serialized list of the running tasks and holds a reference to it (to be released with `release_task_list`),
+// serializing it again if the running tasks changed since the latest one (a read lock of `g_workers_lock` must be held,
+// so that they cannot change in the meantime).
+// Returns `NULL` in case of failure, else the list.
+static task_list *acquire_task_list() {
+    pthread_mutex_lock(&g_task_list_lock);
+    task_list *list = g_task_list;
+    if (list != NULL && list->seq == g_workers_seq) {
+        __atomic_add_fetch(&list->references, 1, __ATOMIC_ACQ_REL);
+        pthread_mutex_unlock(&g_task_list_lock);
+        return list;
+    }
+    pthread_mutex_unlock(&g_task_list_lock);
+    
+    // The tasks are serialized without the lock (concurrent listings may serialize them too, the latest one is kept).
+    list = malloc(sizeof(task_list));
+    if (list == NULL) {
+        return NULL;
+    }
+    list->seq = g_workers_seq;
+    list->references = 2;
+    list->data = create_buffer();
+    
+    task *tasks = NULL;
+    int err = array_reserve(tasks, array_size(g_workers));
+    for (uint64_t i = 0; err != -1 && i < array_size(g_workers); i++) {
+        if (g_workers[i] != NULL) {
+            array_push(tasks, g_workers[i]->task);
+        }
+    }
+    err = err != -1 ? write_task_array(&list->data, tasks) : err;
+    array_free(tasks);
+    
+    if (err == -1) {
+        free(list->data.data);
+        free(list);
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&g_task_list_lock);
+    task_list *previous = g_task_list;
+    g_task_list = list;
+    pthread_mutex_unlock(&g_task_list_lock);
+    release_task_list(previous);
+    
+    return list;
+}
+
+// Removes the directory of a task, with its worker's lock held (so that an execution in progress cannot save its
+// results in the meantime, see `finish_execution`).
+// Returns `-1` in case of failure, else 0.
+static int remove_task_directory(worker *task_worker) {
+    static const char *file_names[] = {
+        "task", "runs", "last_stdout", "last_stderr", "last_stdout" OUTPUT_FILE_NEW_SUFFIX,
+        "last_stderr" OUTPUT_FILE_NEW_SUFFIX
+    };
+    char file_path[PATH_MAX];
+    int err = 0;
+    
+    pthread_mutex_lock(&task_worker->lock);
+    for (uint32_t i = 0; err != -1 && i < sizeof(file_names) / sizeof(file_names[0]); i++) {
+        // Only the `task` file always exists (the others are created once the task's results are loaded).
+        snprintf(file_path, sizeof(file_path), "%s%s", task_worker->dir_path, file_names[i]);
+        err = unlink(file_path) != -1 || (i > 0 && errno == ENOENT) ? 0 : -1;
+    }
+    err = err != -1 ? rmdir(task_worker->dir_path) : err;
+    pthread_mutex_unlock(&task_worker->lock);
+    
+    return err;
+}
+
+// Undoes the creation of a task whose worker could not be added (if `added` is zero) or scheduled: its record in the
+// journal (if `journal_seq` is not `NULL`, which then gets the sequence number of its removal), its store slot or its
+// directory and its history are removed, and its worker (which owns the task) is freed once unused.
+static void discard_new_worker(worker *new_worker, int added, int64_t *journal_seq) {
+    uint64_t taskid = new_worker->task.taskid;
+    int err = added && remove_worker(taskid) == -1 ? -1 : 0;
+    if (journal_seq != NULL) {
+        *journal_seq = journal_remove_task(taskid);
+        err = *journal_seq == -1 ? -1 : err;
+    }
+    
+    // The files of a task of the journal are deleted in the background once its worker is freed.
+    if (!is_journal_opened()) {
+        err = unlink(new_worker->history_path) == -1 && errno != ENOENT ? -1 : err;
+        if (new_worker->store_slot != WORKER_NO_STORE_SLOT) {
+            err = remove_store_slot(new_worker->store_slot) == -1 ? -1 : err;
+        } else {
+            err = remove_task_directory(new_worker) == -1 ? -1 : err;
+        }
+    }
+    
+    if (added) {
+        err = unschedule_worker(new_worker) == -1 ? -1 : err;
+    } else {
+        new_worker->removed = 1;
+        err = free_worker(new_worker) == -1 ? -1 : err;
+    }
+    
+    if (err == -1) {
+        log("cannot undo the creation of a task!\n");
+    }
+}
+
+// Handles a request like `handle_request`, without waiting for its mutations to be durable: the sequence number of its
+// last record in the journal (if any) is written in `*journal_seq`.
+// Returns `-1` in case of failure, else 0.
+static int handle_request_without_sync(request *request, buffer *buf, reply_payload *payload, file_range *stream,
+    int64_t *journal_seq) {
+    int err = 0;
+    *payload = create_reply_payload();
+    *stream = create_file_range();
+    
+    const char *request_name = request_item_name(request->opcode);
+    log2("request received `%s`.\n", request_name ? request_name : "CLIENT_REQUEST_UNKNOWN");
+    
+    // Writes a reply (the worker whose results are sent is acquired and kept locked until the reply is serialized, and
+    // the listed tasks cannot be removed until they are serialized).
+    reply reply;
+    worker *reply_worker = NULL;
+    task_list *listed_tasks = NULL;
+    int workers_locked = 0;
+    switch (request->opcode) {
+    case CLIENT_REQUEST_LIST_TASKS: {
+        // The tasks are only serialized again if they changed since the latest listing.
+        pthread_rwlock_rdlock(&g_workers_lock);
+        listed_tasks = acquire_task_list();
+        pthread_rwlock_unlock(&g_workers_lock);
+        fatal_assert(listed_tasks != NULL);
+        
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    }
+    case CLIENT_REQUEST_LIST_TASKS_SINCE: {
+        // Only the changes made since the cursor are listed (every task is listed if they are not known anymore).
+        worker **added = NULL;
+        task *tasks = NULL;
+        
+        pthread_rwlock_rdlock(&g_workers_lock);
+        workers_locked = 1;
+        int changes_status = list_worker_changes(request->cursor, &added, &reply.removed_taskids);
+        fatal_assert(changes_status != -1);
+        
+        // Every running task is listed from the serialized list of tasks.
+        listed_tasks = changes_status == 1 ? acquire_task_list() : NULL;
+        int list_err = (changes_status == 1 && listed_tasks == NULL) || array_reserve(tasks, array_size(added)) == -1;
+        for (uint64_t i = 0; !list_err && i < array_size(added); i++) {
+            array_push(tasks, added[i]->task);
+        }
+        array_free(added);
+        if (list_err) {
+            array_free(reply.removed_taskids);
+            goto error;
+        }
+        
+        reply.tasks = tasks;
+        reply.cursor = g_workers_seq;
+        reply.reset = changes_status == 1;
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    }
+    case CLIENT_REQUEST_CREATE_TASK:
+    case CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY: {
+        request->task.taskid = __atomic_fetch_add(&g_last_taskid, 1, __ATOMIC_RELAXED);
+        
+        // Creates the task worker and schedules it (the worker owns the task from then on, and the creation is undone
+        // if any of the next steps fails).
+        worker *new_worker = NULL;
+        int keep_history = request->opcode == CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY;
+        fatal_assert(create_worker(&new_worker, &request->task, g_tasks_directory_path, request->task.taskid,
+            keep_history) != -1);
+        int journaled = 0;
+        if (is_journal_opened()) {
+            *journal_seq = journal_create_task(&request->task);
+            journaled = *journal_seq != -1;
+        }
+        int added = (journaled || !is_journal_opened()) && add_worker(new_worker) != -1;
+        if (!added || schedule_worker(new_worker) == -1) {
+            discard_new_worker(new_worker, added, journaled ? journal_seq : NULL);
+            goto error;
+        }
+        
+        reply.taskid = request->task.taskid;
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    }
+    case CLIENT_REQUEST_REMOVE_TASK: {
+        // Only one of concurrent removals of a task removes it (the worker stays allocated until it is released).
+        worker *task_worker = acquire_worker(request->taskid);
+        int remove_status = task_worker != NULL ? remove_worker(request->taskid) : 1;
+        if (remove_status != 0) {
+            if (task_worker != NULL) {
+                release_worker(task_worker);
+            }
+            fatal_assert(remove_status != -1);
+            reply.reptype = SERVER_REPLY_ERROR;
+            reply.errcode = SERVER_REPLY_ERROR_NOT_FOUND;
+            break;
+        }
+        
+        // The removal of a task of the journal is journaled, its files are deleted in the background once its worker
+        // is freed.
+        if (is_journal_opened()) {
+            *journal_seq = journal_remove_task(request->taskid);
+            int remove_err = *journal_seq == -1 || unschedule_worker(task_worker) == -1 ||
+                release_worker(task_worker) == -1;
+            fatal_assert(!remove_err);
+            reply.reptype = SERVER_REPLY_OK;
+            break;
+        }
+        
+        // The history of the task (if any) is removed with it.
+        fatal_assert(unlink(task_worker->history_path) != -1 || errno == ENOENT);
+        
+        // A task in the store is removed at once (its pages are freed with its worker).
+        if (task_worker->store_slot != WORKER_NO_STORE_SLOT) {
+            int remove_err = remove_store_slot(task_worker->store_slot) == -1 ||
+                unschedule_worker(task_worker) == -1 || release_worker(task_worker) == -1;
+            fatal_assert(!remove_err);
+            reply.reptype = SERVER_REPLY_OK;
+            break;
+        }
+        
+        // The worker is unscheduled before its directory is removed, so that an execution in progress either saves its
+        // results before they are removed or finds the worker removed (and drops them). The worker is freed by the
+        // scheduler (once its execution ends if it is currently running) or when it is released by the last request
+        // using it.
+        int remove_err = unschedule_worker(task_worker) == -1 || remove_task_directory(task_worker) == -1 ? -1 : 0;
+        remove_err = release_worker(task_worker) == -1 ? -1 : remove_err;
+        fatal_assert(remove_err != -1);
+        
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    }
+    case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES:
+    case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE: {
+        reply_worker = acquire_worker(request->taskid);
+        if (reply_worker == NULL) {
+            reply.reptype = SERVER_REPLY_ERROR;
+            reply.errcode = SERVER_REPLY_ERROR_NOT_FOUND;
+            break;
+        }
+        
+        pthread_mutex_lock(&reply_worker->lock);
+        fatal_assert(load_worker_results(reply_worker) != -1);
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    }
+    case CLIENT_REQUEST_GET_STDOUT:
+    case CLIENT_REQUEST_GET_STDERR: {
+        reply_worker = acquire_worker(request->taskid);
+        if (reply_worker == NULL) {
+            reply.reptype = SERVER_REPLY_ERROR;
+            reply.errcode = SERVER_REPLY_ERROR_NOT_FOUND;
+            break;
+        }
+        
+        pthread_mutex_lock(&reply_worker->lock);
+        fatal_assert(load_worker_results(reply_worker) != -1);
+        
+        if (reply_worker->runs_count == 0) {
+            reply.reptype = SERVER_REPLY_ERROR;
+            reply.errcode = SERVER_REPLY_ERROR_NEVER_RUN;
+            break;
+        }
+        
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    }
+    case CLIENT_REQUEST_GET_PAST_OUTPUT:
+    case CLIENT_REQUEST_GET_PAST_OUTPUT_AT: {
+        reply_worker = acquire_worker(request->taskid);
+        if (reply_worker == NULL) {
+            reply.reptype = SERVER_REPLY_ERROR;
+            reply.errcode = SERVER_REPLY_ERROR_NOT_FOUND;
+            break;
+        }
+        
+        pthread_mutex_lock(&reply_worker->lock);
+        fatal_assert(load_worker_results(reply_worker) != -1);
+        
+        history *task_history = &reply_worker->history;
+        if (task_history->fd == -1) {
+            reply.reptype = SERVER_REPLY_ERROR;
+            reply.errcode = SERVER_REPLY_ERROR_NO_HISTORY;
+            break;
+        }
+        
+        uint64_t run;
+        int found = request->opcode == CLIENT_REQUEST_GET_PAST_OUTPUT ?
+            find_history_run(task_history, request->run_index, &run) :
+            find_history_run_at(task_history, request->run_time, &run);
+        if (found == -1 || request->stream > 1) {
+            reply.reptype = SERVER_REPLY_ERROR;
+            reply.errcode = SERVER_REPLY_ERROR_NEVER_RUN;
+            break;
+        }
+        
+        // The output is decompressed in memory (it is freed once serialized).
+        reply.run_time = task_history->runs[run].time;
+        fatal_assert(read_history_output(task_history, run, request->stream, &reply.run_output) != -1);
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    }
+    case CLIENT_REQUEST_BATCH:
+        // The requests of the batch are handled while the reply is written.
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    case CLIENT_REQUEST_TERMINATE:
+        __atomic_store_n(&g_terminating, 1, __ATOMIC_RELEASE);
+        reply.reptype = SERVER_REPLY_OK;
+        break;
+    default:
+        reply.reptype = SERVER_REPLY_ERROR;
+        reply.errcode = 0;
+        break;
+    }
+    
+    if (reply.reptype == SERVER_REPLY_OK) {
+        log2("sending to client `%s`.\n", reply_item_names()[reply.reptype]);
+    } else {
+        log2("sending to client `%s` with error `%s`.\n", reply_item_names()[reply.reptype], reply_error_item_names()[reply.errcode]);
+    }
+    
+    fatal_assert(write_uint16(buf, &reply.reptype) != -1);
+    
+    if (reply.reptype == SERVER_REPLY_OK) {
+        switch (request->opcode) {
+        case CLIENT_REQUEST_LIST_TASKS:
+            // The serialized tasks are sent from the shared list (which the payload holds until they are sent).
+            payload->data = listed_tasks->data.data;
+            payload->length = listed_tasks->data.length;
+            payload->list = listed_tasks;
+            listed_tasks = NULL;
+            break;
+        case CLIENT_REQUEST_LIST_TASKS_SINCE: {
+            uint32_t nbremoved = (uint32_t)array_size(reply.removed_taskids);
+            int write_err = write_uint64(buf, &reply.cursor) == -1 || write_uint8(buf, &reply.reset) == -1 ||
+                (listed_tasks != NULL ? write_bytes(buf, listed_tasks->data.data, listed_tasks->data.length) :
+                write_task_array(buf, reply.tasks)) == -1 || write_uint32(buf, &nbremoved) == -1;
+            for (uint32_t i = 0; !write_err && i < nbremoved; i++) {
+                write_err = write_uint64(buf, &reply.removed_taskids[i]) == -1;
+            }
+            array_free(reply.tasks);
+            array_free(reply.removed_taskids);
+            fatal_assert(!write_err);
+            break;
+        }
+        case CLIENT_REQUEST_CREATE_TASK:
+        case CLIENT_REQUEST_CREATE_TASK_WITH_HISTORY:
+            fatal_assert(write_uint64(buf, &reply.taskid) != -1);
+            break;
+        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES:
+            fatal_assert(write_worker_runs(buf, reply_worker) != -1);
+            break;
+        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES_RANGE:
+            fatal_assert(write_worker_runs_range(buf, reply_worker, request->since, request->until, request->offset,
+                request->limit) != -1);
+            break;
+        case CLIENT_REQUEST_GET_STDOUT:
+        case CLIENT_REQUEST_GET_STDERR: {
+            uint32_t output_stream = request->opcode == CLIENT_REQUEST_GET_STDOUT ? 0 : 1;
+            fatal_assert(write_worker_output(buf, stream, reply_worker, output_stream) != -1);
+            break;
+        }
+        case CLIENT_REQUEST_GET_PAST_OUTPUT:
+        case CLIENT_REQUEST_GET_PAST_OUTPUT_AT: {
+            // The decompressed output is sent from where it is (the payload owns it).
+            payload->data = reply.run_output.data;
+            payload->length = reply.run_output.length;
+            fatal_assert(write_uint64(buf, &reply.run_time) != -1 && write_uint32(buf, &reply.run_output.length) != -1);
+            break;
+        }
+        case CLIENT_REQUEST_BATCH: {
+            // The replies follow each other in the order of the requests (a request which cannot be part of a batch
+            // is answered with an error, like an unknown request). A request which fails is answered with an error
+            // too, without preventing the next ones from being handled (the previous ones are already applied).
+            uint32_t count = (uint32_t)array_size(request->batch);
+            int batch_err = write_uint32(buf, &count);
+            for (uint32_t i = 0; i < count; i++) {
+                struct request *item = &request->batch[i];
+                if (batch_err == -1) {
+                    free_request(item);
+                    continue;
+                }
+                
+                // The replies of a batch have no payload nor streamed output.
+                item->opcode = is_batch_item(item->opcode) ? item->opcode : 0;
+                reply_payload item_payload;
+                file_range item_stream;
+                int64_t item_seq = 0;
+                uint32_t reply_start = buf->length;
+                if (handle_request_without_sync(item, buf, &item_payload, &item_stream, &item_seq) == -1) {
+                    log2("request %u of the batch failed.\n", i);
+                    buf->length = reply_start;
+                    batch_err = write_failure_reply(buf);
+                }
+                *journal_seq = item_seq > *journal_seq ? item_seq : *journal_seq;
+            }
+            array_free(request->batch);
+            fatal_assert(batch_err != -1);
+            break;
+        }
+        default:
+            break;
+        }
+    } else {
+        fatal_assert(write_uint16(buf, &reply.errcode) != -1);
+    }
+    
+    goto cleanup;
+    
+    error:
+    err = -1;
+    free_reply_payload(payload);
+    close_file_range(stream);
+    
+    cleanup:
+    release_task_list(listed_tasks);
+    if (reply_worker != NULL) {
+        pthread_mutex_unlock(&reply_worker->lock);
+        err = release_worker(reply_worker) == -1 ? -1 : err;
+    }
+    if (workers_locked) {
+        pthread_rwlock_unlock(&g_workers_lock);
+    }
+    
+    return err;
+}
+
+// Handles a request and writes its reply in a `data`, except for the bytes of the reply already in memory (the listed
+// tasks of a `LIST_TASKS` reply and the output of a `GET_PAST_OUTPUT` reply), left in `*payload` to be sent after the
+// `data`, and for the output of a `GET_STDOUT` or `GET_STDERR` reply which may be left in `*stream` (to be streamed
+// from its file after them). The reply is only written once the mutations of the request are durable (the requests
+// handled concurrently being synced together).
+// Returns `-1` in case of failure, else 0.
+static int handle_request(request *request, buffer *buf, reply_payload *payload, file_range *stream) {
+    int64_t journal_seq = 0;
+    int err = handle_request_without_sync(request, buf, payload, stream, &journal_seq);
+    
+    if (err != -1 && journal_seq > 0 && sync_journal(journal_seq) == -1) {
+        free_reply_payload(payload);
+        close_file_range(stream);
+        return -1;
+    }
+    
+    return err;
+}
+
+static int compare_taskids(const void *a, const void *b) {
+    uint64_t first = *(const uint64_t *)a;
+    uint64_t second = *(const uint64_t *)b;
+    
+    return first < second ? -1 : first > second ? 1 : 0;
+}
+
+// Wakes up the main thread (from any thread).
+static void wake_main_thread() {
+    uint8_t byte = 0;
+    if (write(g_wake_pipe[1], &byte, sizeof(byte)) == -1) {
+        // The pipe is full, so the main thread is already going to wake up.
+    }
+}
+
+// Handles the requests received on the request pipe one after the other (their replies are sent through the reply
+// pipe, which every client shares), until a `CLIENT_REQUEST_TERMINATE` is handled.
+// Returns `-1` in case of failure, else 0.
+static int handle_pipe_requests(reader *rd) {
+    while (!is_terminating()) {
+        // A request with no reply required may only be there to wake up this thread (see `stop_pipe_thread`).
+        // A malformed request is dropped along with the bytes read with it (the next requests are read from the pipe).
+        request request;
+        if (read_request(rd, &request) == -1) {
+            log("malformed request received on the pipe.\n");
+            rd->position = rd->length;
+            errno = 0;
+            continue;
+        }
+        
+        if (request.opcode == 0) {
+            log("no reply required.\n");
+            continue;
+        }
+        
+        buffer buf = create_buffer();
+        reply_payload payload;
+        file_range stream;
+        // A request which fails is answered with an error, the next ones are still handled.
+        if (handle_request(&request, &buf, &payload, &stream) == -1) {
+            log("cannot handle the request, answering with an error.\n");
+            buf.length = 0;
+            errno = 0;
+            if (write_failure_reply(&buf) == -1) {
+                free(buf.data);
+                return -1;
+            }
+        }
+        
+        // The payload of the reply is gathered with the rest of the reply, then its output (if any) is streamed right
+        // after them (the pipe is blocking).
+        struct iovec iovs[] = {
+            { .iov_base = buf.data, .iov_len = buf.length },
+            { .iov_base = (void *)payload.data, .iov_len = payload.length }
+        };
+        int reply_write_fd = open(g_reply_pipe_path, O_WRONLY | O_CLOEXEC);
+        int err = reply_write_fd == -1 ? -1 : write_iovecs(reply_write_fd, iovs, 2);
+        err = err != -1 ? send_file_range(reply_write_fd, &stream) : err;
+        free_reply_payload(&payload);
+        close_file_range(&stream);
+        free(buf.data);
+        
+        // A client which stops reading its reply (e.g. `cassini -o TASKID | head`) or whose reply cannot be sent only
+        // loses the rest of its reply (the daemon only stops if the reply pipe cannot be opened anymore).
+        assert(reply_write_fd != -1);
+        if (err == -1 && errno == EPIPE) {
+            log("client left before the end of its reply.\n");
+        } else if (err == -1) {
+            log("cannot send the reply to the client!\n");
+        }
+        errno = 0;
+        close(reply_write_fd);
+    }
+    
+    return 0;
+}
+
+// Runs the requests of the request pipe in their own thread, as opening the reply pipe blocks until the client opens
+// it (so that clients on the socket are never blocked by a client on the pipes).
+static void *pipe_thread_main(void *arg) {
+    if (handle_pipe_requests(arg) == -1) {
+        __atomic_store_n(&g_pipe_thread_failed, 1, __ATOMIC_RELEASE);
+    }
+    
+    wake_main_thread();
+    
+    return NULL;
+}
+
+// Stops the pipe thread once it has handled the request in progress (if any).
+static void stop_pipe_thread(int request_fd) {
+    if (!__atomic_load_n(&g_pipe_thread_failed, __ATOMIC_ACQUIRE)) {
+        // The thread is woken up by a request with no reply required (like the one sent to detect a running daemon).
+        uint16_t opcode = 0;
+        buffer buf = create_buffer();
+        if (write_uint16(&buf, &opcode) != -1 && write_buffer(request_fd, &buf) == -1) {
+            log("cannot wake up the pipe thread!\n");
+        }
+        free(buf.data);
+    }
+    
+    pthread_join(g_pipe_thread, NULL);
+}
+
+static void push_job(job_queue *queue, request_job *job) {
+    job->next = NULL;
+    if (queue->tail != NULL) {
+        queue->tail->next = job;
+    } else {
+        queue->head = job;
+    }
+    queue->tail = job;
+}
+
+// Frees a job (and what is left of its reply).
+static void free_job(request_job *job) {
+    free(job->reply.data);
+    free_reply_payload(&job->payload);
+    close_file_range(&job->stream);
+    free(job);
+}
+
+// Handles the jobs queued by the main thread, then hands them back to it (which sends their replies).
+static void *handler_main(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_jobs_lock);
+    
+    while (1) {
+        while (g_pending_jobs.head == NULL && !g_handlers_stopping) {
+            pthread_cond_wait(&g_jobs_cond, &g_jobs_lock);
+        }
+        
+        if (g_handlers_stopping) {
+            break;
+        }
+        
+        request_job *job = g_pending_jobs.head;
+        g_pending_jobs.head = job->next;
+        if (g_pending_jobs.head == NULL) {
+            g_pending_jobs.tail = NULL;
+        }
+        
+        pthread_mutex_unlock(&g_jobs_lock);
+        
+        // The reply is tagged with the ID of its request (so that a client can send requests without waiting), its
+        // payload and its streamed output (if any) being part of its frame.
+        // A request which fails is answered with an error (its connection is only closed if even that fails).
+        uint32_t frame_start;
+        int err = begin_frame(&job->reply, job->requestid, &frame_start) == -1 ||
+            handle_request(&job->request, &job->reply, &job->payload, &job->stream) == -1 ? -1 : 0;
+        if (err == -1) {
+            log("cannot handle the request, answering with an error.\n");
+            job->reply.length = 0;
+            errno = 0;
+            err = begin_frame(&job->reply, job->requestid, &frame_start) == -1 ? -1 : write_failure_reply(&job->reply);
+        }
+        job->failed = err == -1 ||
+            end_frame(&job->reply, frame_start, job->payload.length + (uint32_t)job->stream.remaining) == -1;
+        
+        pthread_mutex_lock(&g_jobs_lock);
+        push_job(&g_handled_jobs, job);
+        wake_main_thread();
+    }
+    
+    pthread_mutex_unlock(&g_jobs_lock);
+    
+    return NULL;
+}
+
+// Starts `count` handler threads.
+// Returns `-1` in case of failure, else 0.
+static int start_handlers(uint32_t count) {
+    assert(pipe(g_wake_pipe) != -1);
+    for (uint32_t i = 0; i < 2; i++) {
+        assert(fcntl(g_wake_pipe[i], F_SETFL, O_NONBLOCK) != -1 && fcntl(g_wake_pipe[i], F_SETFD, FD_CLOEXEC) != -1);
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        pthread_t thread;
+        assert(pthread_create(&thread, NULL, handler_main, NULL) == 0);
+        assert(array_push(g_handler_threads, thread) != -1);
+    }
+    
+    return 0;
+}
+
+// Stops the handler threads once they have handled their current job (the jobs left are freed).
+static void stop_handlers() {
+    pthread_mutex_lock(&g_jobs_lock);
+    g_handlers_stopping = 1;
+    pthread_cond_broadcast(&g_jobs_cond);
+    pthread_mutex_unlock(&g_jobs_lock);
+    
+    for (uint64_t i = 0; i < array_size(g_handler_threads); i++) {
+        pthread_join(g_handler_threads[i], NULL);
+    }
+    array_free(g_handler_threads);
+    
+    for (request_job *job = g_pending_jobs.head; job != NULL;) {
+        request_job *next = job->next;
+        free_request(&job->request);
+        free_job(job);
+        job = next;
+    }
+    g_pending_jobs.head = NULL;
+    g_pending_jobs.tail = NULL;
+}
+
+// Opens the socket and starts listening on it.
+// Returns `-1` in case of failure, else the socket.
+static int open_listener() {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    assert(strlen(g_socket_path) < sizeof(address.sun_path));
+    strcpy(address.sun_path, g_socket_path);
+    
+    // Removes the socket left by a previous daemon (the pipes already tell us that no other daemon is running).
+    assert(unlink(g_socket_path) != -1 || errno == ENOENT);
+    errno = 0;
+    
+    // The socket (like the connections) is not inherited by the spawned tasks (atomically on Linux, else right after).
+#ifdef __linux__
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+#endif
+    assert(listen_fd != -1);
+    
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(listen_fd, SOMAXCONN) == -1 ||
+        fcntl(listen_fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(listen_fd, F_SETFD, FD_CLOEXEC) == -1) {
+        close(listen_fd);
+        return -1;
+    }
+    
+    return listen_fd;
+}
+
+// Accepts every pending connection on the socket.
+// Returns `-1` in case of failure, else 0.
+static int accept_connections(int listen_fd) {
+    while (1) {
+#ifdef __linux__
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+#else
+        int fd = accept(listen_fd, NULL, NULL);
+#endif
+        
+        if (fd == -1) {
+            assert(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED);
+            errno = 0;
+            return 0;
+        }
+        
+#ifdef __APPLE__
+        int enabled = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+        
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+            close(fd);
+            return -1;
+        }
+        
+        connection new_connection = {
+            .id = g_next_connection_id++,
+            .fd = fd,
+            .busy = 0,
+            .input = create_buffer(),
+            .output = create_buffer(),
+            .output_position = 0,
+            .streams = NULL
+        };
+        assert(array_push(g_connections, new_connection) != -1);
+        log("client connected.\n");
+    }
+}
+
+// Closes a connection and removes it from the connected clients.
+static void close_connection(uint64_t index) {
+    connection *conn = &g_connections[index];
+    
+    close(conn->fd);
+    free(conn->input.data);
+    free(conn->output.data);
+    for (uint64_t i = 0; i < array_size(conn->streams); i++) {
+        free_reply_payload(&conn->streams[i].payload);
+        close_file_range(&conn->streams[i].range);
+    }
+    array_free(conn->streams);
+    array_remove(g_connections, index);
+    log("client disconnected.\n");
+}
+
+// Checks if a connection has replies (or outputs) that are not sent yet.
+static int has_pending_output(const connection *conn) {
+    return conn->output_position < conn->output.length || array_size(conn->streams) > 0;
+}
+
+// Sends as much of the pending replies of a connection as possible (the replies before a payload are sent along with
+// it, and each streamed output is sent once the replies and the payload before it are sent).
+// Returns `-1` if the connection is broken, else 0.
+static int flush_connection(connection *conn) {
+    while (has_pending_output(conn)) {
+        pending_stream *pending = array_size(conn->streams) > 0 ? &conn->streams[0] : NULL;
+        if (pending != NULL && pending->position == conn->output_position &&
+            pending->payload_position == pending->payload.length) {
+            file_range *range = &pending->range;
+            assert(send_file_range(conn->fd, range) != -1);
+            
+            if (range->remaining > 0) {
+                return 0;
+            }
+            
+            free_reply_payload(&pending->payload);
+            close_file_range(range);
+            array_remove(conn->streams, 0);
+            continue;
+        }
+        
+        uint32_t end = pending != NULL ? pending->position : conn->output.length;
+        struct iovec iovs[2] = {
+            { .iov_base = conn->output.data + conn->output_position, .iov_len = end - conn->output_position },
+            { .iov_base = NULL, .iov_len = 0 }
+        };
+        if (pending != NULL) {
+            iovs[1].iov_base = (uint8_t *)pending->payload.data + pending->payload_position;
+            iovs[1].iov_len = pending->payload.length - pending->payload_position;
+        }
+        struct msghdr message = { .msg_iov = iovs, .msg_iovlen = 2 };
+        ssize_t count = sendmsg(conn->fd, &message, MSG_NOSIGNAL);
+        
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            
+            assert(errno == EAGAIN || errno == EWOULDBLOCK);
+            errno = 0;
+            return 0;
+        }
+        
+        uint32_t output_count = (size_t)count < iovs[0].iov_len ? (uint32_t)count : (uint32_t)iovs[0].iov_len;
+        conn->output_position += output_count;
+        if (pending != NULL) {
+            pending->payload_position += (uint32_t)count - output_count;
+        }
+    }
+    
+    conn->output.length = 0;
+    conn->output_position = 0;
+    
+    return 0;
+}
+
+// Hands the next request frame received from a client (if any) to the handler threads, unless a request of the client
+// is already being handled.
+// Returns `-1` in case of failure, `1` if the connection must be closed, else 0.
+static int dispatch_connection_input(connection *conn) {
+    uint32_t consumed = 0;
+    while (!conn->busy && !g_handlers_stopping && conn->input.length - consumed >= sizeof(uint32_t)) {
+        reader header_reader = create_memory_reader(conn->input.data + consumed, sizeof(uint32_t));
+        uint32_t frame_length;
+        assert(read_uint32(&header_reader, &frame_length) != -1);
+        
+        if (frame_length > FRAME_MAX_LENGTH) {
+            return 1;
+        }
+        
+        if (conn->input.length - consumed - sizeof(uint32_t) < frame_length) {
+            break;
+        }
+        
+        reader frame_reader = create_memory_reader(conn->input.data + consumed + sizeof(uint32_t), frame_length);
+        consumed += sizeof(uint32_t) + frame_length;
+        
+        request_job *job = calloc(1, sizeof(request_job));
+        assert(job);
+        if (read_uint64(&frame_reader, &job->requestid) == -1 || read_request(&frame_reader, &job->request) == -1) {
+            free(job);
+            errno = 0;
+            return 1;
+        }
+        
+        if (job->request.opcode == 0) {
+            log("no reply required.\n");
+            free(job);
+            continue;
+        }
+        
+        job->connection_id = conn->id;
+        job->reply = create_buffer();
+        job->payload = create_reply_payload();
+        job->stream = create_file_range();
+        conn->busy = 1;
+        
+        pthread_mutex_lock(&g_jobs_lock);
+        push_job(&g_pending_jobs, job);
+        pthread_cond_signal(&g_jobs_cond);
+        pthread_mutex_unlock(&g_jobs_lock);
+    }
+    
+    if (consumed > 0) {
+        assert(memmove(conn->input.data, conn->input.data + consumed, conn->input.length - consumed) != NULL);
+        conn->input.length -= consumed;
+    }
+    
+    return 0;
+}
+
+// Receives the data sent by a client and hands its next request to the handler threads.
+// Returns `-1` in case of failure, `1` if the connection must be closed, else 0.
+static int handle_connection_input(connection *conn) {
+    uint8_t chunk[READER_BUFFER_SIZE];
+    
+    while (1) {
+        ssize_t count = recv(conn->fd, chunk, sizeof(chunk), 0);
+        
+        if (count == 0) {
+            return 1;
+        }
+        
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            
+            int would_block = errno == EAGAIN || errno == EWOULDBLOCK;
+            errno = 0;
+            if (!would_block) {
+                return 1;
+            }
+            
+            break;
+        }
+        
+        assert(write_bytes(&conn->input, chunk, (uint32_t)count) != -1);
+    }
+    
+    return dispatch_connection_input(conn);
+}
+
+// Adds the reply of a handled job to the pending replies of its connection.
+// Returns `-1` in case of failure, else 0.
+static int add_job_reply(connection *conn, request_job *job) {
+    // The payload and the streamed output (if any) are part of the frame, they are sent once the frame's beginning is
+    // sent.
+    assert(write_bytes(&conn->output, job->reply.data, job->reply.length) != -1);
+    if (job->payload.length > 0 || job->stream.fd != -1) {
+        pending_stream pending = {
+            .position = conn->output.length,
+            .payload = job->payload,
+            .payload_position = 0,
+            .range = job->stream
+        };
+        assert(array_push(conn->streams, pending) != -1);
+        job->payload = create_reply_payload();
+        job->stream = create_file_range();
+    }
+    
+    return 0;
+}
+
+// Sends the replies of the jobs handled by the handler threads (to the connections still opened), then hands the next
+// request of their connections to the handler threads. A connection whose reply cannot be sent is closed.
+static void send_handled_jobs() {
+    pthread_mutex_lock(&g_jobs_lock);
+    request_job *job = g_handled_jobs.head;
+    g_handled_jobs.head = NULL;
+    g_handled_jobs.tail = NULL;
+    pthread_mutex_unlock(&g_jobs_lock);
+    
+    while (job != NULL) {
+        request_job *next = job->next;
+        
+        // Connections are few, so they are searched linearly (their indices change as they are closed).
+        for (uint64_t i = 0; i < array_size(g_connections); i++) {
+            connection *conn = &g_connections[i];
+            if (conn->id != job->connection_id) {
+                continue;
+            }
+            
+            conn->busy = 0;
+            int status = 1;
+            if (job->failed || add_job_reply(conn, job) == -1) {
+                log("cannot send the reply to the client!\n");
+            } else {
+                status = dispatch_connection_input(conn);
+            }
+            if (status != 0 || flush_connection(conn) == -1) {
+                close_connection(i);
+                errno = 0;
+            }
+            break;
+        }
+        
+        free_job(job);
+        job = next;
+    }
+}
 
 int main(int argc, char *argv[]) {
     errno = 0;
     
     int exit_code = EXIT_SUCCESS;
     int used_unexisting_option = 0;
-    char *tasks_directory_path = NULL;
+    uint32_t executors_count = DEFAULT_EXECUTORS_COUNT;
+    uint32_t handlers_count = DEFAULT_HANDLERS_COUNT;
+    int scheduler_started = 0;
+    int handlers_started = 0;
+    int pipe_thread_started = 0;
+    int use_socket = 0;
+    int use_store = 0;
+    int use_journal = 0;
+    int request_fd = -1;
+    int listen_fd = -1;
+    char *strtoul_endp = NULL;
     
     // Parse options.
     int opt;
-    while ((opt = getopt(argc, argv, "hp:")) != -1) {
+    while ((opt = getopt(argc, argv, "hp:j:sw:n:a:m:cJ")) != -1) {
         switch (opt) {
         case 'h':
             printf("%s", g_help);
@@ -51,6 +1311,35 @@ int main(int argc, char *argv[]) {
             g_pipes_path = strdup(optarg);
             fatal_assert(g_pipes_path != NULL);
             break;
+        case 'j':
+            executors_count = strtoul(optarg, &strtoul_endp, 10);
+            fatal_assert(strtoul_endp != optarg && strtoul_endp[0] == '\0' && executors_count > 0);
+            break;
+        case 's':
+            use_socket = 1;
+            break;
+        case 'w':
+            handlers_count = strtoul(optarg, &strtoul_endp, 10);
+            fatal_assert(strtoul_endp != optarg && strtoul_endp[0] == '\0' && handlers_count > 0);
+            break;
+        case 'c':
+            use_store = 1;
+            break;
+        case 'J':
+            use_journal = 1;
+            break;
+        case 'n':
+            g_runs_retention_count = strtoul(optarg, &strtoul_endp, 10);
+            fatal_assert(strtoul_endp != optarg && strtoul_endp[0] == '\0' && g_runs_retention_count > 0);
+            break;
+        case 'a':
+            g_runs_retention_age = strtoull(optarg, &strtoul_endp, 10);
+            fatal_assert(strtoul_endp != optarg && strtoul_endp[0] == '\0');
+            break;
+        case 'm':
+            g_output_cap = strtoul(optarg, &strtoul_endp, 10);
+            fatal_assert(strtoul_endp != optarg && strtoul_endp[0] == '\0');
+            break;
         case '?':
             used_unexisting_option = 1;
             break;
@@ -63,11 +1352,13 @@ int main(int argc, char *argv[]) {
         error("use `-h` for more informations\n");
     }
     
+    fatal_assert_with_log(!use_store || !use_journal, "the options `-c` and `-J` cannot be used together\n");
+    
     fatal_assert(allocate_paths() != -1);
     
-    tasks_directory_path = calloc(1, PATH_MAX);
-    assert(tasks_directory_path);
-    assert(sprintf(tasks_directory_path, "%s../tasks/", g_pipes_path) != -1);
+    g_tasks_directory_path = calloc(1, PATH_MAX);
+    assert(g_tasks_directory_path);
+    assert(sprintf(g_tasks_directory_path, "%s../tasks/", g_pipes_path) != -1);
     
     DIR *pipes_dir = opendir(g_pipes_path);
     
@@ -136,27 +1427,49 @@ int main(int argc, char *argv[]) {
     }
 #endif
     
-    DIR *tasks_dir = opendir(tasks_directory_path);
+    DIR *tasks_dir = opendir(g_tasks_directory_path);
     
     // Creates the tasks directory if it doesn't exists.
     if (!tasks_dir) {
-        fatal_assert(errno == ENOENT && mkdir_recursively(tasks_directory_path, 0777) != -1);
-        tasks_dir = opendir(tasks_directory_path);
+        fatal_assert(errno == ENOENT && mkdir_recursively(g_tasks_directory_path, 0777) != -1);
+        tasks_dir = opendir(g_tasks_directory_path);
         fatal_assert(tasks_dir);
     }
     
     uint64_t *existing_taskids = NULL;
-    // Searches for existing tasks.
-    while ((entry = readdir(tasks_dir)) != NULL) {
-        char* unparsed = NULL;
-        uint64_t taskid = strtoull(entry->d_name, &unparsed, 10);
     
+    // Searches for existing tasks in the store (the tasks directory then only holds the store).
+    if (use_store) {
+        fatal_assert_with_log(open_store(g_tasks_directory_path) != -1, "cannot open the store\n");
+        fatal_assert(list_store_taskids(&existing_taskids) != -1);
+        
+        for (uint64_t i = 0; i < array_size(existing_taskids); i++) {
+            if (existing_taskids[i] >= g_last_taskid) {
+                g_last_taskid = existing_taskids[i] + 1;
+            }
+        }
+    }
+    
+    // Searches for existing tasks in the journal (which imports the tasks of the directories written without it), which
+    // is used as soon as the tasks directory has one (as its tasks have no `task` file).
+    use_journal = use_journal || (!use_store && faccessat(dirfd(tasks_dir), JOURNAL_FILE_NAME, F_OK, 0) == 0);
+    if (use_journal) {
+        fatal_assert_with_log(open_journal(g_tasks_directory_path) != -1, "cannot open the journal\n");
+        fatal_assert(list_journal_taskids(&existing_taskids) != -1);
+        g_last_taskid = get_journal_next_taskid();
+    }
+    
+    // Searches for existing tasks in the directories (named by their taskid) otherwise.
+    while (!use_store && !use_journal && (entry = readdir(tasks_dir)) != NULL) {
+        char *unparsed = NULL;
+        uint64_t taskid = strtoull(entry->d_name, &unparsed, 10);
+        
         if (errno || (!taskid && entry->d_name == unparsed)) {
             errno = 0;
             continue;
         }
         
-        array_push(existing_taskids, taskid);
+        fatal_assert(array_push(existing_taskids, taskid) != -1);
         
         // Calculate the last taskid used based on directories names.
         if (taskid >= g_last_taskid) {
@@ -167,242 +1480,113 @@ int main(int argc, char *argv[]) {
     fatal_assert(closedir(tasks_dir) != -1);
     
     // Sort existing tasks.
-    if (!array_empty(existing_taskids)) {
-        uint64_t k;
-        for (uint64_t i = 0; i < array_size(existing_taskids) - 1; i++) {
-            k = i;
-        
-            for (uint64_t j = i + 1; j < array_size(existing_taskids); j++) {
-                if (existing_taskids[j] < existing_taskids[k]) {
-                    k = j;
-                }
-            }
-        
-            uint64_t tmp = existing_taskids[k];
-            existing_taskids[k] = existing_taskids[i];
-            existing_taskids[i] = tmp;
-        }
-    }
+    qsort(existing_taskids, array_size(existing_taskids), sizeof(uint64_t), compare_taskids);
     
-    // Loads any existing task and create its thread.
-    for (uint64_t i = 0; i < array_size(existing_taskids); i++) {
-        thread_handle thread_handle = { .taskid = existing_taskids[i] };
-        fatal_assert(array_push(g_threads, thread_handle) != -1);
-        worker *new_worker = NULL;
-        fatal_assert(create_worker(&new_worker, NULL, tasks_directory_path, existing_taskids[i]) != -1);
-        fatal_assert(array_push(g_workers, new_worker) != -1); // NOLINT
-        fatal_assert(array_push(g_running_taskids, existing_taskids[i]) != -1);
-        fatal_assert(pthread_create(&(array_last(g_threads).pthread), NULL, worker_main, (void *) array_last(g_workers)) == 0);
+    // A client leaving in the middle of a reply must only make its write fail (outputs are streamed with `sendfile`,
+    // which cannot be told not to raise `SIGPIPE`).
+    fatal_assert(signal(SIGPIPE, SIG_IGN) != SIG_ERR);
+    
+    fatal_assert(start_scheduler(executors_count) != -1);
+    scheduler_started = 1;
+    
+    // Loads any existing task (in parallel) and schedules it.
+    worker **existing_workers = calloc(array_size(existing_taskids) + 1, sizeof(worker *));
+    fatal_assert(existing_workers);
+    int load_err = load_workers(existing_workers, existing_taskids, array_size(existing_taskids),
+        g_tasks_directory_path);
+    for (uint64_t i = 0; load_err != -1 && i < array_size(existing_taskids); i++) {
+        load_err = add_worker(existing_workers[i]) == -1 || schedule_worker(existing_workers[i]) == -1 ? -1 : 0;
     }
     
+    free(existing_workers);
     array_free(existing_taskids);
+    fatal_assert_with_log(load_err != -1, "cannot load the existing tasks\n");
     
     log("daemon started.\n");
     
-    while (1) {
-        // Waits for requests to handle...
-        int request_read_fd = open(g_request_pipe_path, O_RDONLY);
-        fatal_assert(request_read_fd != -1);
-        
-        // Reads a request.
-        request request;
-        fatal_assert(read_uint16(request_read_fd, &request.opcode) != -1);
+    // The main thread only accepts the clients of the socket and reads their requests, which are handled by a pool of
+    // handler threads (so that a slow request does not block the other clients), the requests of the pipes being
+    // handled by their own thread.
+    fatal_assert(start_handlers(handlers_count) != -1);
+    handlers_started = 1;
     
-        log2("request received `%s`.\n", request_item_names()[request.opcode]);
-        
-        if (request.opcode == 0) {
-            log("no reply required.\n");
-            fatal_assert(close(request_read_fd) != -1);
-            continue;
-        }
-        
-        switch (request.opcode) {
-        case CLIENT_REQUEST_CREATE_TASK:
-            fatal_assert(read_task(request_read_fd, &request.task, 0) != -1);
-            break;
-        case CLIENT_REQUEST_REMOVE_TASK:
-        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES:
-        case CLIENT_REQUEST_GET_STDOUT:
-        case CLIENT_REQUEST_GET_STDERR:
-            fatal_assert(read_uint64(request_read_fd, &request.taskid) != -1);
-            break;
-        default:
-            break;
-        }
+    // The request pipe is also opened for writing so that it never reaches the end of file when clients close it (it
+    // is not inherited by the tasks, which would keep it opened, so that a daemon would seem to be still running).
+    request_fd = open(g_request_pipe_path, O_RDWR | O_CLOEXEC);
+    fatal_assert(request_fd != -1);
+    reader request_reader = create_reader(request_fd);
+    fatal_assert(pthread_create(&g_pipe_thread, NULL, pipe_thread_main, &request_reader) == 0);
+    pipe_thread_started = 1;
     
-        fatal_assert(close(request_read_fd) != -1);
-        
-        // Writes a reply.
-        reply reply;
-        switch (request.opcode) {
-        case CLIENT_REQUEST_LIST_TASKS: {
-            task *tasks = NULL;
+    if (use_socket) {
+        listen_fd = open_listener();
+        fatal_assert_with_log(listen_fd != -1, "cannot listen on the socket\n");
+    }
     
-            for (uint64_t i = 0; i < array_size(g_workers); i++) {
-                worker *worker = g_workers[i];
-                
-                if (worker != NULL) {
-                    if (is_worker_running(worker->task.taskid)) {
-                        fatal_assert(array_push(tasks, worker->task) != -1);
-                    }
-                }
-            }
+    struct pollfd *poll_fds = NULL;
     
-            reply.tasks = tasks;
-            reply.reptype = SERVER_REPLY_OK;
-            break;
+    while (!is_terminating()) {
+        // Waits for requests to handle (on the socket or from a connected client) or for handled requests...
+        array_clear(poll_fds);
+        struct pollfd wake_poll_fd = { .fd = g_wake_pipe[0], .events = POLLIN, .revents = 0 };
+        fatal_assert(array_push(poll_fds, wake_poll_fd) != -1);
+        struct pollfd listen_poll_fd = { .fd = listen_fd, .events = POLLIN, .revents = 0 };
+        fatal_assert(array_push(poll_fds, listen_poll_fd) != -1);
+        for (uint64_t i = 0; i < array_size(g_connections); i++) {
+            // The next requests of a client are left in the socket while one of its requests is handled.
+            connection *conn = &g_connections[i];
+            short events = (conn->busy ? 0 : POLLIN) | (has_pending_output(conn) ? POLLOUT : 0);
+            struct pollfd connection_poll_fd = { .fd = conn->fd, .events = events, .revents = 0 };
+            fatal_assert(array_push(poll_fds, connection_poll_fd) != -1);
         }
-        case CLIENT_REQUEST_CREATE_TASK: {
-            request.task.taskid = g_last_taskid++;
-    
-            // Creates the task thread and save it.
-            thread_handle thread_handle = { .taskid = request.task.taskid };
-            fatal_assert(array_push(g_threads, thread_handle) != -1);
-            worker *new_worker = NULL;
-            fatal_assert(create_worker(&new_worker, &request.task, tasks_directory_path, request.task.taskid) != -1);
-            fatal_assert(array_push(g_workers, new_worker) != -1); // NOLINT
-            fatal_assert(array_push(g_running_taskids, request.task.taskid) != -1);
-            fatal_assert(pthread_create(&(array_last(g_threads).pthread), NULL, worker_main, (void *) array_last(g_workers)) == 0);
-    
-            reply.taskid = request.task.taskid;
-            reply.reptype = SERVER_REPLY_OK;
-            break;
+        
+        if (poll(poll_fds, array_size(poll_fds), -1) == -1) {
+            fatal_assert(errno == EINTR);
+            errno = 0;
+            continue;
         }
-        case CLIENT_REQUEST_REMOVE_TASK: {
-            if (!is_worker_running(request.taskid)) {
-                reply.reptype = SERVER_REPLY_ERROR;
-                reply.errcode = SERVER_REPLY_ERROR_NOT_FOUND;
-                break;
-            }
-    
-            char dir_path[PATH_MAX];
-            char *tmp = strcpy(dir_path, get_worker(request.taskid)->dir_path);
-            fatal_assert(tmp);
-            
-            for (uint64_t i = 0; i < array_size(g_workers); i++) {
-                if (g_threads[i].taskid == request.taskid) {
-                    fatal_assert(pthread_cancel(g_threads[i].pthread) == 0);
-                    fatal_assert(pthread_join(g_threads[i].pthread, NULL) == 0);
-                    g_workers[i] = NULL;
-                    break;
-                }
-            }
-    
-            fatal_assert(remove_worker(request.taskid) != -1);
-    
-            char *task_file_path = calloc(1, PATH_MAX);
-            fatal_assert(sprintf(task_file_path, "%stask", dir_path) != -1);
-            char *runs_file_path = calloc(1, PATH_MAX);
-            fatal_assert(sprintf(runs_file_path, "%sruns", dir_path) != -1);
-            char *last_stdout_file_path = calloc(1, PATH_MAX);
-            fatal_assert(sprintf(last_stdout_file_path, "%slast_stdout", dir_path) != -1);
-            char *last_stderr_file_path = calloc(1, PATH_MAX);
-            fatal_assert(sprintf(last_stderr_file_path, "%slast_stderr", dir_path) != -1);
-            fatal_assert(unlink(task_file_path) != -1);
-            fatal_assert(unlink(runs_file_path) != -1);
-            fatal_assert(unlink(last_stdout_file_path) != -1);
-            fatal_assert(unlink(last_stderr_file_path) != -1);
-            fatal_assert(rmdir(dir_path) != -1);
-            free(task_file_path);
-            free(runs_file_path);
-            free(last_stdout_file_path);
-            free(last_stderr_file_path);
+        
+        // Connections are handled from the last one so that closing one does not move the ones left to handle.
+        for (uint64_t i = array_size(g_connections); i > 0 && !is_terminating(); i--) {
+            connection *conn = &g_connections[i - 1];
+            short revents = poll_fds[i + 1].revents;
+            int status = 0;
             
-            reply.reptype = SERVER_REPLY_OK;
-            break;
-        }
-        case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES: {
-            if (!is_worker_running(request.taskid)) {
-                reply.reptype = SERVER_REPLY_ERROR;
-                reply.errcode = SERVER_REPLY_ERROR_NOT_FOUND;
-                break;
+            if (revents & POLLOUT) {
+                status = flush_connection(conn) == -1 ? 1 : 0;
             }
-    
-            reply.runs = get_worker(request.taskid)->runs;
-            reply.reptype = SERVER_REPLY_OK;
-            break;
-        }
-        case CLIENT_REQUEST_GET_STDOUT:
-        case CLIENT_REQUEST_GET_STDERR: {
-            if (!is_worker_running(request.taskid)) {
-                reply.reptype = SERVER_REPLY_ERROR;
-                reply.errcode = SERVER_REPLY_ERROR_NOT_FOUND;
-                break;
-            }
-            
-            worker *task_worker = get_worker(request.taskid);
-            fatal_assert(task_worker);
             
-            if (array_empty(task_worker->runs)) {
-                reply.reptype = SERVER_REPLY_ERROR;
-                reply.errcode = SERVER_REPLY_ERROR_NEVER_RUN;
-                break;
+            if (status == 0 && revents & (POLLIN | POLLHUP | POLLERR)) {
+                status = handle_connection_input(conn);
+                fatal_assert(status != -1);
             }
             
-            if (request.opcode == CLIENT_REQUEST_GET_STDOUT) {
-                reply.output = task_worker->last_stdout;
-            } else {
-                reply.output = task_worker->last_stderr;
+            if (status == 1) {
+                close_connection(i - 1);
+                errno = 0;
             }
-            
-            reply.reptype = SERVER_REPLY_OK;
-            break;
-        }
-        case CLIENT_REQUEST_TERMINATE:
-            reply.reptype = SERVER_REPLY_OK;
-            break;
-        default:
-            reply.reptype = SERVER_REPLY_ERROR;
-            reply.errcode = 0;
-            break;
         }
         
-        int reply_write_fd = open(g_reply_pipe_path, O_WRONLY);
-        fatal_assert(reply_write_fd != -1);
-        
-        if (reply.reptype == SERVER_REPLY_OK) {
-            log2("sending to client `%s`.\n", reply_item_names()[reply.reptype]);
-        } else {
-            log2("sending to client `%s` with error `%s`.\n", reply_item_names()[reply.reptype], reply_error_item_names()[reply.errcode]);
-        }
-    
-        buffer buf = create_buffer();
-        fatal_assert(write_uint16(&buf, &reply.reptype) != -1);
-        
-        if (reply.reptype == SERVER_REPLY_OK) {
-            switch (request.opcode) {
-            case CLIENT_REQUEST_LIST_TASKS: {
-                fatal_assert(write_task_array(&buf, reply.tasks) != -1);
-                array_free(reply.tasks);
-                break;
+        // Sends the replies of the handled requests (once the polled connections are handled, as it may close some).
+        if (poll_fds[0].revents & POLLIN) {
+            uint8_t bytes[64];
+            while (read(g_wake_pipe[0], bytes, sizeof(bytes)) > 0) {
+                // Drains the pipe.
             }
-            case CLIENT_REQUEST_CREATE_TASK:
-                fatal_assert(write_uint64(&buf, &reply.taskid) != -1);
-                break;
-            case CLIENT_REQUEST_GET_TIMES_AND_EXITCODES: {
-                fatal_assert(write_run_array(&buf, reply.runs) != -1);
-                break;
-            }
-            case CLIENT_REQUEST_GET_STDOUT:
-            case CLIENT_REQUEST_GET_STDERR:
-                fatal_assert(write_string(&buf, &reply.output) != -1);
-                break;
-            default:
-                break;
-            }
-        } else {
-            fatal_assert(write_uint16(&buf, &reply.errcode) != -1);
+            errno = 0;
+            
+            fatal_assert_with_log(!__atomic_load_n(&g_pipe_thread_failed, __ATOMIC_ACQUIRE),
+                "cannot handle the requests of the pipes\n");
+            send_handled_jobs();
         }
-    
-        fatal_assert(write_buffer(reply_write_fd, &buf) != -1);
-        free(buf.data);
-        fatal_assert(close(reply_write_fd) != -1);
         
-        if (request.opcode == CLIENT_REQUEST_TERMINATE) {
-            break;
+        if (!is_terminating() && poll_fds[1].revents & POLLIN) {
+            fatal_assert(accept_connections(listen_fd) != -1);
         }
     }
     
+    array_free(poll_fds);
+    
     log("daemon shutting down...");
     
     goto cleanup;
@@ -411,14 +1595,42 @@ int main(int argc, char *argv[]) {
     exit_code = get_error();
     
     cleanup:
-    array_free(g_running_taskids);
-    for (uint64_t i = 0; i < array_size(g_threads); i++) {
-        pthread_cancel(g_threads[i].pthread);
-        pthread_join(g_threads[i].pthread, NULL);
-    }
-    array_free(g_threads);
-    array_free(g_workers);
-    free(tasks_directory_path);
+    // Waits for the requests in progress, then sends the replies left (including the reply to
+    // `CLIENT_REQUEST_TERMINATE`) before closing the connections.
+    if (pipe_thread_started) {
+        stop_pipe_thread(request_fd);
+    }
+    if (handlers_started) {
+        stop_handlers();
+        send_handled_jobs();
+    }
+    while (!array_empty(g_connections)) {
+        connection *conn = &array_last(g_connections);
+        if (fcntl(conn->fd, F_SETFL, 0) != -1) {
+            flush_connection(conn);
+        }
+        close_connection(array_size(g_connections) - 1);
+    }
+    array_free(g_connections);
+    if (listen_fd != -1) {
+        close(listen_fd);
+        unlink(g_socket_path);
+    }
+    if (request_fd != -1) {
+        close(request_fd);
+    }
+    if (handlers_started) {
+        close(g_wake_pipe[0]);
+        close(g_wake_pipe[1]);
+    }
+    if (scheduler_started) {
+        stop_scheduler();
+    }
+    cleanup_workers();
+    release_task_list(g_task_list);
+    close_journal();
+    close_store();
+    free(g_tasks_directory_path);
     cleanup_paths();
     
     return exit_code;
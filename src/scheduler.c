@@ -0,0 +1,505 @@
+#include <sy5/scheduler.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+
+// Value of `next_run_time` for a worker whose timing never matches.
+#define NEVER_RUN_TIME UINT64_MAX
+
+// Lock protecting every variable of the scheduler (and the scheduling fields of the workers).
+static pthread_mutex_t g_scheduler_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Signaled when the earliest worker of the heap changes (or when stopping).
+static pthread_cond_t g_scheduler_cond = PTHREAD_COND_INITIALIZER;
+
+// Signaled when a worker is added to the executors queue (or when stopping).
+static pthread_cond_t g_executors_cond = PTHREAD_COND_INITIALIZER;
+
+// Min-heap of scheduled workers ordered by `next_run_time`.
+static worker **g_heap = NULL;
+
+// First and last workers of the executors queue.
+static worker *g_jobs_head = NULL;
+static worker *g_jobs_tail = NULL;
+
+// Executions spawned by the executors and not yet handed to the supervisor.
+static execution **g_started = NULL;
+
+// Executions in progress (only accessed by the supervisor).
+static execution **g_executions = NULL;
+
+// Self-pipe waking up the supervisor (when an execution is started, when a child exits or when stopping).
+static int g_wake_pipe[2] = { -1, -1 };
+
+static pthread_t g_scheduler_thread;
+static pthread_t g_supervisor_thread;
+static pthread_t *g_executor_threads = NULL;
+static int g_stopping = 0;
+
+// Computes the first minute at or after `from` matching a timing (in seconds since EPOCH).
+// Returns `NEVER_RUN_TIME` if the timing never matches.
+static uint64_t compute_next_run_time(const timing *timing, uint64_t from) {
+    time_t timestamp = timing_next_fire(timing, (time_t)from);
+    
+    return timestamp == -1 ? NEVER_RUN_TIME : (uint64_t)timestamp;
+}
+
+static void heap_swap(uint64_t i, uint64_t j) {
+    worker *tmp = g_heap[i];
+    g_heap[i] = g_heap[j];
+    g_heap[j] = tmp;
+    g_heap[i]->heap_index = i;
+    g_heap[j]->heap_index = j;
+}
+
+static void heap_sift_up(uint64_t i) {
+    while (i > 0 && g_heap[(i - 1) / 2]->next_run_time > g_heap[i]->next_run_time) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_sift_down(uint64_t i) {
+    uint64_t size = array_size(g_heap);
+    
+    while (1) {
+        uint64_t smallest = i;
+        uint64_t left = 2 * i + 1;
+        uint64_t right = 2 * i + 2;
+        
+        if (left < size && g_heap[left]->next_run_time < g_heap[smallest]->next_run_time) {
+            smallest = left;
+        }
+        
+        if (right < size && g_heap[right]->next_run_time < g_heap[smallest]->next_run_time) {
+            smallest = right;
+        }
+        
+        if (smallest == i) {
+            break;
+        }
+        
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static int heap_push(worker *worker) {
+    if (worker->next_run_time == NEVER_RUN_TIME) {
+        return 0;
+    }
+    
+    worker->heap_index = array_size(g_heap);
+    assert(array_push(g_heap, worker) != -1);
+    heap_sift_up(worker->heap_index);
+    
+    return 0;
+}
+
+static int heap_remove(worker *worker) {
+    uint64_t i = worker->heap_index;
+    
+    if (i >= array_size(g_heap) || g_heap[i] != worker) {
+        return 0;
+    }
+    
+    uint64_t last = array_size(g_heap) - 1;
+    if (i != last) {
+        heap_swap(i, last);
+    }
+    assert(array_pop(g_heap) != -1);
+    
+    if (i < array_size(g_heap)) {
+        heap_sift_up(i);
+        heap_sift_down(g_heap[i]->heap_index);
+    }
+    
+    return 0;
+}
+
+static void *scheduler_main(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_scheduler_lock);
+    
+    while (!g_stopping) {
+        if (array_empty(g_heap)) {
+            pthread_cond_wait(&g_scheduler_cond, &g_scheduler_lock);
+            continue;
+        }
+        
+        // Sleeps until the earliest worker is due (or until the heap changes).
+        worker *next = array_first(g_heap);
+        uint64_t now = time(NULL);
+        if (next->next_run_time > now) {
+            struct timespec deadline = { .tv_sec = (time_t)next->next_run_time, .tv_nsec = 0 };
+            pthread_cond_timedwait(&g_scheduler_cond, &g_scheduler_lock, &deadline);
+            continue;
+        }
+        
+        heap_remove(next);
+        
+        // Hands the worker to the executors, unless its previous execution is still in progress.
+        if (next->busy) {
+            log2("task %lu is still running, skipping this execution.\n", (unsigned long)next->task.taskid);
+        } else {
+            next->busy = 1;
+            next->next_job = NULL;
+            if (g_jobs_tail != NULL) {
+                g_jobs_tail->next_job = next;
+            } else {
+                g_jobs_head = next;
+            }
+            g_jobs_tail = next;
+            pthread_cond_signal(&g_executors_cond);
+        }
+        
+        // Missed minutes (if the scheduler is late) are skipped.
+        next->next_run_time = compute_next_run_time(&next->task.timing, now - now % 60 + 60);
+        if (heap_push(next) == -1) {
+            log("cannot reschedule worker!\n");
+        }
+    }
+    
+    pthread_mutex_unlock(&g_scheduler_lock);
+    
+    return NULL;
+}
+
+// Wakes up the supervisor (can be called from a signal handler).
+static void wake_supervisor() {
+    int saved_errno = errno;
+    uint8_t byte = 0;
+    if (write(g_wake_pipe[1], &byte, sizeof(byte)) == -1) {
+        // The pipe is full, so the supervisor is already going to wake up.
+    }
+    errno = saved_errno;
+}
+
+static void handle_sigchld(int signal) {
+    (void)signal;
+    
+    wake_supervisor();
+}
+
+// Frees a worker if it has been unscheduled and is not busy nor used by a request anymore, must be called with the
+// scheduler's lock held.
+// Returns `-1` in case of failure, else 0.
+static int free_unused_worker(worker *worker) {
+    if (worker->removed && !worker->busy && __atomic_load_n(&worker->references, __ATOMIC_ACQUIRE) == 0) {
+        return free_worker(worker);
+    }
+    
+    return 0;
+}
+
+// Marks a worker as not busy anymore (and frees it if it has been unscheduled in the meantime).
+static void release_busy_worker(worker *worker) {
+    pthread_mutex_lock(&g_scheduler_lock);
+    
+    worker->busy = 0;
+    free_unused_worker(worker);
+    
+    pthread_mutex_unlock(&g_scheduler_lock);
+}
+
+static void *executor_main(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&g_scheduler_lock);
+    
+    while (1) {
+        while (g_jobs_head == NULL && !g_stopping) {
+            pthread_cond_wait(&g_executors_cond, &g_scheduler_lock);
+        }
+        
+        if (g_stopping) {
+            break;
+        }
+        
+        worker *job = g_jobs_head;
+        g_jobs_head = job->next_job;
+        if (g_jobs_head == NULL) {
+            g_jobs_tail = NULL;
+        }
+        
+        // The worker may have been unscheduled while it was waiting in the queue.
+        if (job->removed) {
+            job->busy = 0;
+            free_unused_worker(job);
+            continue;
+        }
+        
+        pthread_mutex_unlock(&g_scheduler_lock);
+        
+        // Only spawns the task, the supervisor then waits for it (so that executors are never blocked by a task).
+        execution *cur_execution = malloc(sizeof(execution));
+        if (cur_execution == NULL || start_execution(cur_execution, job, time(NULL)) == -1) {
+            log("cannot start an execution!\n");
+            free(cur_execution);
+            release_busy_worker(job);
+            pthread_mutex_lock(&g_scheduler_lock);
+            continue;
+        }
+        
+        pthread_mutex_lock(&g_scheduler_lock);
+        
+        if (array_push(g_started, cur_execution) == -1) {
+            // The execution cannot be supervised, its process is reaped right away (without saving its results).
+            log("cannot supervise an execution!\n");
+            pthread_mutex_unlock(&g_scheduler_lock);
+            free_execution(cur_execution);
+            if (cur_execution->pid != -1) {
+                waitpid(cur_execution->pid, NULL, 0);
+            }
+            free(cur_execution);
+            release_busy_worker(job);
+            pthread_mutex_lock(&g_scheduler_lock);
+            continue;
+        }
+        
+        wake_supervisor();
+    }
+    
+    pthread_mutex_unlock(&g_scheduler_lock);
+    
+    return NULL;
+}
+
+// Reaps the processes of the executions which have exited.
+static void reap_executions() {
+    for (uint64_t i = 0; i < array_size(g_executions); i++) {
+        execution *cur_execution = g_executions[i];
+        if (cur_execution->exited) {
+            continue;
+        }
+        
+        pid_t pid = waitpid(cur_execution->pid, &cur_execution->status, WNOHANG);
+        if (pid == cur_execution->pid || (pid == -1 && errno != EINTR)) {
+            cur_execution->exited = 1;
+        }
+    }
+}
+
+// Saves the results of the executions which have exited and whose outputs are closed, and removes them.
+static void finish_executions() {
+    for (uint64_t i = array_size(g_executions); i-- > 0;) {
+        execution *cur_execution = g_executions[i];
+        if (!cur_execution->exited || cur_execution->captures[0].fd != -1 || cur_execution->captures[1].fd != -1) {
+            continue;
+        }
+        
+        if (finish_execution(cur_execution) == -1) {
+            log("cannot save the results of an execution!\n");
+        }
+        release_busy_worker(cur_execution->worker);
+        free(cur_execution);
+        
+        g_executions[i] = array_last(g_executions);
+        array_pop(g_executions);
+    }
+}
+
+// The supervisor is a single thread waiting for every execution in progress: it reads their outputs as soon as they
+// are available and reaps their processes when woken up by `SIGCHLD` (which only it can receive).
+static void *supervisor_main(void *arg) {
+    (void)arg;
+    
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    
+    struct pollfd *fds = NULL;
+    
+    while (1) {
+        pthread_mutex_lock(&g_scheduler_lock);
+        
+        if (g_stopping) {
+            pthread_mutex_unlock(&g_scheduler_lock);
+            break;
+        }
+        
+        int err = 0;
+        if (!array_empty(g_started)) {
+            err = array_push_n(g_executions, g_started, array_size(g_started));
+            array_clear(g_started);
+        }
+        
+        pthread_mutex_unlock(&g_scheduler_lock);
+        
+        if (err == -1) {
+            log("cannot supervise the started executions!\n");
+        }
+        
+        // Reaps before finishing, so that an execution whose outputs are already closed is finished right away.
+        reap_executions();
+        finish_executions();
+        
+        array_clear(fds);
+        struct pollfd wake_fd = { .fd = g_wake_pipe[0], .events = POLLIN, .revents = 0 };
+        err = array_push(fds, wake_fd);
+        for (uint64_t i = 0; err != -1 && i < array_size(g_executions); i++) {
+            for (uint32_t j = 0; err != -1 && j < 2; j++) {
+                struct pollfd output_fd = { .fd = g_executions[i]->captures[j].fd, .events = POLLIN, .revents = 0 };
+                err = array_push(fds, output_fd);
+            }
+        }
+        
+        if (err == -1 || poll(fds, array_size(fds), -1) == -1) {
+            if (err == -1 || errno != EINTR) {
+                log("error in supervisor thread!\n");
+                sleep(1);
+            }
+            continue;
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            uint8_t bytes[64];
+            while (read(g_wake_pipe[0], bytes, sizeof(bytes)) > 0) {
+            }
+        }
+        
+        for (uint64_t i = 1; i < array_size(fds); i++) {
+            if (fds[i].fd == -1 || fds[i].revents == 0) {
+                continue;
+            }
+            
+            if (read_execution_output(g_executions[(i - 1) / 2], (i - 1) % 2) == -1) {
+                log("cannot read the output of an execution!\n");
+            }
+        }
+    }
+    
+    array_free(fds);
+    
+    return NULL;
+}
+
+int start_scheduler(uint32_t executors_count) {
+    assert(executors_count > 0);
+    
+    // `SIGCHLD` is only received by the supervisor, so it is blocked before creating the other threads (which inherit
+    // the mask of this one).
+    assert(pipe(g_wake_pipe) != -1);
+    for (uint32_t i = 0; i < 2; i++) {
+        assert(fcntl(g_wake_pipe[i], F_SETFL, O_NONBLOCK) != -1 && fcntl(g_wake_pipe[i], F_SETFD, FD_CLOEXEC) != -1);
+    }
+    
+    struct sigaction action = { 0 };
+    action.sa_handler = handle_sigchld;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    assert(sigaction(SIGCHLD, &action, NULL) != -1);
+    
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    assert(pthread_sigmask(SIG_BLOCK, &mask, NULL) == 0);
+    
+    g_stopping = 0;
+    assert(pthread_create(&g_scheduler_thread, NULL, scheduler_main, NULL) == 0);
+    assert(pthread_create(&g_supervisor_thread, NULL, supervisor_main, NULL) == 0);
+    
+    for (uint32_t i = 0; i < executors_count; i++) {
+        pthread_t thread;
+        assert(pthread_create(&thread, NULL, executor_main, NULL) == 0);
+        assert(array_push(g_executor_threads, thread) != -1);
+    }
+    
+    return 0;
+}
+
+int stop_scheduler() {
+    pthread_mutex_lock(&g_scheduler_lock);
+    g_stopping = 1;
+    pthread_cond_broadcast(&g_scheduler_cond);
+    pthread_cond_broadcast(&g_executors_cond);
+    pthread_mutex_unlock(&g_scheduler_lock);
+    wake_supervisor();
+    
+    assert(pthread_join(g_scheduler_thread, NULL) == 0);
+    assert(pthread_join(g_supervisor_thread, NULL) == 0);
+    
+    for (uint64_t i = 0; i < array_size(g_executor_threads); i++) {
+        pthread_join(g_executor_threads[i], NULL);
+    }
+    
+    // The executions in progress are abandoned (their processes are left running and their results are not saved).
+    // Their workers may still be released or unscheduled by the threads handling requests, hence the lock.
+    if (!array_empty(g_started)) {
+        assert(array_push_n(g_executions, g_started, array_size(g_started)) != -1);
+    }
+    pthread_mutex_lock(&g_scheduler_lock);
+    for (uint64_t i = 0; i < array_size(g_executions); i++) {
+        free_execution(g_executions[i]);
+        g_executions[i]->worker->busy = 0;
+        free_unused_worker(g_executions[i]->worker);
+        free(g_executions[i]);
+    }
+    pthread_mutex_unlock(&g_scheduler_lock);
+    
+    close(g_wake_pipe[0]);
+    close(g_wake_pipe[1]);
+    array_free(g_started);
+    array_free(g_executions);
+    array_free(g_executor_threads);
+    array_free(g_heap);
+    g_jobs_head = NULL;
+    g_jobs_tail = NULL;
+    
+    return 0;
+}
+
+int schedule_worker(worker *worker) {
+    pthread_mutex_lock(&g_scheduler_lock);
+    
+    worker->busy = 0;
+    worker->removed = 0;
+    worker->next_run_time = compute_next_run_time(&worker->task.timing, time(NULL));
+    int err = heap_push(worker);
+    
+    // Wakes up the scheduler in case the new worker is the earliest one.
+    pthread_cond_signal(&g_scheduler_cond);
+    pthread_mutex_unlock(&g_scheduler_lock);
+    
+    return err;
+}
+
+int unschedule_worker(worker *worker) {
+    pthread_mutex_lock(&g_scheduler_lock);
+    
+    int err = heap_remove(worker);
+    worker->removed = 1;
+    
+    if (free_unused_worker(worker) == -1) {
+        err = -1;
+    }
+    
+    pthread_cond_signal(&g_scheduler_cond);
+    pthread_mutex_unlock(&g_scheduler_lock);
+    
+    return err;
+}
+
+int release_worker(worker *worker) {
+    pthread_mutex_lock(&g_scheduler_lock);
+    
+    // The reference is dropped with the lock held, so that the worker cannot be unscheduled and freed in the meantime.
+    __atomic_sub_fetch(&worker->references, 1, __ATOMIC_ACQ_REL);
+    int err = free_unused_worker(worker);
+    
+    pthread_mutex_unlock(&g_scheduler_lock);
+    
+    return err;
+}
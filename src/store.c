@@ -0,0 +1,490 @@
+#include <sy5/store.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/fcntl.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+#include <sy5/taskmap.h>
+
+// Magic number at the beginning of the store ('STOR').
+#define STORE_MAGIC 0x53544F52
+
+// Version of the format of the store.
+#define STORE_VERSION 1
+
+// Size of a page of the store (every extent starts on a page).
+#define STORE_PAGE_SIZE 4096
+
+// Size of the range of addresses reserved for the mapping of the store (which is also the maximum size of the store).
+#define STORE_MAP_SIZE ((uint64_t)1 << 36)
+
+// Offset of the extent of the table in the header (its first page and its number of pages, as two `uint32`).
+#define STORE_TABLE_OFFSET (2 * sizeof(uint32_t))
+
+// Size of an entry of the table: its taskid (`uint64`), its state (`uint32`), a reserved `uint32`, then the first page
+// and the length of each extent (as two `uint32`), padded so that an entry never straddles two sectors.
+#define STORE_ENTRY_SIZE 64
+
+// Offset of the state in an entry.
+#define STORE_ENTRY_STATE_OFFSET sizeof(uint64_t)
+
+// Offset of the first extent in an entry.
+#define STORE_ENTRY_EXTENTS_OFFSET (sizeof(uint64_t) + 2 * sizeof(uint32_t))
+
+// States of a slot (only `STORE_SLOT_USED` is written in the file, the others are written as `STORE_SLOT_FREE`).
+#define STORE_SLOT_FREE 0
+#define STORE_SLOT_USED 1
+#define STORE_SLOT_REMOVED 2
+
+// Describes an extent of the store (in pages).
+typedef struct store_extent {
+    uint32_t page;
+    uint32_t pages;
+} store_extent;
+
+// Lock protecting every variable of the store (and the table).
+static pthread_mutex_t g_store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int g_store_fd = -1;
+static uint8_t *g_store_map = NULL;
+
+// Number of pages of the store.
+static uint32_t g_pages = 0;
+
+// Extent of the table.
+static store_extent g_table = { 0 };
+
+// State of each slot of the table.
+static uint8_t *g_slot_states = NULL;
+
+// Index of the used slots by taskid.
+static taskmap g_slots_index = { 0 };
+
+// Free extents ordered by page (computed when the store is opened).
+static store_extent *g_free_extents = NULL;
+
+static uint32_t pages_of(uint32_t length) {
+    return (uint32_t)(((uint64_t)length + STORE_PAGE_SIZE - 1) / STORE_PAGE_SIZE);
+}
+
+// Reads a `uint32` in the mapping.
+static uint32_t map_uint32(uint64_t offset) {
+    reader rd = create_memory_reader(g_store_map + offset, sizeof(uint32_t));
+    uint32_t value = 0;
+    read_uint32(&rd, &value);
+    
+    return value;
+}
+
+// Writes `count` `uint32` at `offset` in the store (with a single `pwrite`).
+// Returns `-1` in case of failure, else 0.
+static int write_uint32s(uint64_t offset, const uint32_t *values, uint32_t count) {
+    buffer buf = create_buffer();
+    int err = 0;
+    for (uint32_t i = 0; err != -1 && i < count; i++) {
+        err = write_uint32(&buf, &values[i]);
+    }
+    
+    if (err != -1) {
+        err = pwrite(g_store_fd, buf.data, buf.length, (off_t)offset) == buf.length ? 0 : -1;
+    }
+    
+    free(buf.data);
+    
+    return err;
+}
+
+static uint64_t entry_offset(uint32_t slot) {
+    return (uint64_t)g_table.page * STORE_PAGE_SIZE + (uint64_t)slot * STORE_ENTRY_SIZE;
+}
+
+static uint64_t extent_offset(uint32_t slot, store_extent_kind kind) {
+    return entry_offset(slot) + STORE_ENTRY_EXTENTS_OFFSET + (uint64_t)kind * 2 * sizeof(uint32_t);
+}
+
+static uint32_t slots_count() {
+    return (uint32_t)((uint64_t)g_table.pages * STORE_PAGE_SIZE / STORE_ENTRY_SIZE);
+}
+
+static uint64_t entry_taskid(uint32_t slot) {
+    reader rd = create_memory_reader(g_store_map + entry_offset(slot), sizeof(uint64_t));
+    uint64_t taskid = 0;
+    read_uint64(&rd, &taskid);
+    
+    return taskid;
+}
+
+static store_extent entry_extent(uint32_t slot, store_extent_kind kind, uint32_t *length) {
+    uint64_t offset = extent_offset(slot, kind);
+    *length = map_uint32(offset + sizeof(uint32_t));
+    store_extent extent = { .page = map_uint32(offset), .pages = pages_of(*length) };
+    
+    return extent;
+}
+
+// Adds an extent to the free extents (merging it with its neighbours).
+// Returns `-1` in case of failure, else 0.
+static int free_extent(store_extent extent) {
+    if (extent.pages == 0) {
+        return 0;
+    }
+    
+    uint64_t i = 0;
+    while (i < array_size(g_free_extents) && g_free_extents[i].page < extent.page) {
+        i++;
+    }
+    
+    if (i > 0 && g_free_extents[i - 1].page + g_free_extents[i - 1].pages == extent.page) {
+        g_free_extents[i - 1].pages += extent.pages;
+        if (i < array_size(g_free_extents) && extent.page + extent.pages == g_free_extents[i].page) {
+            g_free_extents[i - 1].pages += g_free_extents[i].pages;
+            assert(memmove(&g_free_extents[i], &g_free_extents[i + 1],
+                (array_size(g_free_extents) - i - 1) * sizeof(store_extent)) != NULL);
+            array_pop(g_free_extents);
+        }
+        
+        return 0;
+    }
+    
+    if (i < array_size(g_free_extents) && extent.page + extent.pages == g_free_extents[i].page) {
+        g_free_extents[i].page = extent.page;
+        g_free_extents[i].pages += extent.pages;
+        
+        return 0;
+    }
+    
+    assert(array_push(g_free_extents, extent) != -1);
+    assert(memmove(&g_free_extents[i + 1], &g_free_extents[i],
+        (array_size(g_free_extents) - i - 1) * sizeof(store_extent)) != NULL);
+    g_free_extents[i] = extent;
+    
+    return 0;
+}
+
+// Allocates an extent of `pages` pages (the first free extent big enough, or new pages at the end of the store).
+// Returns `-1` in case of failure, else 0.
+static int allocate_extent(store_extent *dest, uint32_t pages) {
+    for (uint64_t i = 0; i < array_size(g_free_extents); i++) {
+        if (g_free_extents[i].pages >= pages) {
+            dest->page = g_free_extents[i].page;
+            dest->pages = pages;
+            g_free_extents[i].page += pages;
+            g_free_extents[i].pages -= pages;
+            
+            if (g_free_extents[i].pages == 0) {
+                assert(memmove(&g_free_extents[i], &g_free_extents[i + 1],
+                    (array_size(g_free_extents) - i - 1) * sizeof(store_extent)) != NULL);
+                array_pop(g_free_extents);
+            }
+            
+            return 0;
+        }
+    }
+    
+    assert(((uint64_t)g_pages + pages) * STORE_PAGE_SIZE <= STORE_MAP_SIZE);
+    assert(ftruncate(g_store_fd, (off_t)(((uint64_t)g_pages + pages) * STORE_PAGE_SIZE)) != -1);
+    dest->page = g_pages;
+    dest->pages = pages;
+    g_pages += pages;
+    
+    return 0;
+}
+
+// Doubles the size of the table (which is copied to new pages before the header points to it).
+// Returns `-1` in case of failure, else 0.
+static int grow_table() {
+    store_extent table;
+    assert(allocate_extent(&table, g_table.pages * 2) != -1);
+    
+    uint64_t old_size = (uint64_t)g_table.pages * STORE_PAGE_SIZE;
+    uint8_t *data = calloc(1, old_size * 2);
+    assert(data);
+    assert(memcpy(data, g_store_map + (uint64_t)g_table.page * STORE_PAGE_SIZE, old_size) != NULL);
+    ssize_t count = pwrite(g_store_fd, data, old_size * 2, (off_t)((uint64_t)table.page * STORE_PAGE_SIZE));
+    free(data);
+    assert(count == (ssize_t)(old_size * 2));
+    
+    // The new table is on the disk before the header points to it, and the header before the old pages can be reused.
+    uint32_t values[2] = { table.page, table.pages };
+    assert(fdatasync(g_store_fd) != -1);
+    assert(write_uint32s(STORE_TABLE_OFFSET, values, 2) != -1);
+    assert(fdatasync(g_store_fd) != -1);
+    
+    uint32_t old_count = slots_count();
+    assert(free_extent(g_table) != -1);
+    g_table = table;
+    
+    for (uint32_t i = old_count; i < slots_count(); i++) {
+        uint8_t state = STORE_SLOT_FREE;
+        assert(array_push(g_slot_states, state) != -1);
+    }
+    
+    return 0;
+}
+
+static int compare_extents(const void *a, const void *b) {
+    const store_extent *first = a;
+    const store_extent *second = b;
+    
+    return first->page < second->page ? -1 : first->page > second->page ? 1 : 0;
+}
+
+// Reads the table (dropping the tasks which were not completely added) and computes the free extents.
+// Returns `-1` in case of failure, else 0.
+static int load_table() {
+    store_extent *used = NULL;
+    store_extent header = { .page = 0, .pages = 1 };
+    assert(array_push(used, header) != -1);
+    assert(array_push(used, g_table) != -1);
+    
+    for (uint32_t slot = 0; slot < slots_count(); slot++) {
+        uint8_t state = map_uint32(entry_offset(slot) + STORE_ENTRY_STATE_OFFSET) == STORE_SLOT_USED ?
+            STORE_SLOT_USED : STORE_SLOT_FREE;
+        
+        uint32_t length;
+        if (state == STORE_SLOT_USED && entry_extent(slot, STORE_EXTENT_TASK, &length).pages == 0) {
+            // The task was being added when the daemon stopped.
+            uint32_t free_state = STORE_SLOT_FREE;
+            assert(write_uint32s(entry_offset(slot) + STORE_ENTRY_STATE_OFFSET, &free_state, 1) != -1);
+            state = STORE_SLOT_FREE;
+        }
+        
+        assert(array_push(g_slot_states, state) != -1);
+        if (state != STORE_SLOT_USED) {
+            continue;
+        }
+        
+        assert(taskmap_put(&g_slots_index, entry_taskid(slot), slot) != -1);
+        for (uint32_t kind = 0; kind < STORE_EXTENT_COUNT; kind++) {
+            store_extent extent = entry_extent(slot, kind, &length);
+            if (extent.pages > 0) {
+                assert(array_push(used, extent) != -1);
+            }
+        }
+    }
+    
+    // The free extents are the gaps between the used ones.
+    qsort(used, array_size(used), sizeof(store_extent), compare_extents);
+    uint32_t page = 0;
+    for (uint64_t i = 0; i < array_size(used); i++) {
+        assert(used[i].page >= page && (uint64_t)used[i].page + used[i].pages <= g_pages);
+        
+        if (used[i].page > page) {
+            store_extent extent = { .page = page, .pages = used[i].page - page };
+            assert(array_push(g_free_extents, extent) != -1);
+        }
+        page = used[i].page + used[i].pages;
+    }
+    
+    if (page < g_pages) {
+        store_extent extent = { .page = page, .pages = g_pages - page };
+        assert(array_push(g_free_extents, extent) != -1);
+    }
+    
+    array_free(used);
+    
+    return 0;
+}
+
+int open_store(const char *tasks_path) {
+    assert(open_file(&g_store_fd, tasks_path, STORE_FILE_NAME, O_RDWR | O_CREAT) != -1);
+    assert(fcntl(g_store_fd, F_SETFD, FD_CLOEXEC) != -1);
+    off_t size = lseek(g_store_fd, 0L, SEEK_END);
+    assert(size != -1 && size % STORE_PAGE_SIZE == 0);
+    
+    // Creates an empty store (its header followed by a table of one page).
+    if (size == 0) {
+        assert(ftruncate(g_store_fd, 2 * STORE_PAGE_SIZE) != -1);
+        uint32_t header[4] = { STORE_MAGIC, STORE_VERSION, 1, 1 };
+        assert(write_uint32s(0, header, 4) != -1);
+        size = 2 * STORE_PAGE_SIZE;
+    }
+    
+    void *map = mmap(NULL, STORE_MAP_SIZE, PROT_READ, MAP_SHARED, g_store_fd, 0);
+    assert(map != MAP_FAILED);
+    g_store_map = map;
+    g_pages = (uint32_t)(size / STORE_PAGE_SIZE);
+    
+    assert(map_uint32(0) == STORE_MAGIC && map_uint32(sizeof(uint32_t)) == STORE_VERSION);
+    g_table.page = map_uint32(STORE_TABLE_OFFSET);
+    g_table.pages = map_uint32(STORE_TABLE_OFFSET + sizeof(uint32_t));
+    assert(g_table.page > 0 && g_table.pages > 0 && (uint64_t)g_table.page + g_table.pages <= g_pages);
+    
+    return load_table();
+}
+
+void close_store() {
+    if (g_store_fd == -1) {
+        return;
+    }
+    
+    munmap(g_store_map, STORE_MAP_SIZE);
+    close(g_store_fd);
+    g_store_fd = -1;
+    g_store_map = NULL;
+    array_free(g_slot_states);
+    array_free(g_free_extents);
+    free_taskmap(&g_slots_index);
+}
+
+int is_store_opened() {
+    return g_store_fd != -1;
+}
+
+int list_store_taskids(uint64_t **taskids) {
+    pthread_mutex_lock(&g_store_lock);
+    
+    int err = 0;
+    for (uint32_t slot = 0; err != -1 && slot < array_size(g_slot_states); slot++) {
+        if (g_slot_states[slot] == STORE_SLOT_USED) {
+            uint64_t taskid = entry_taskid(slot);
+            err = array_push(*taskids, taskid);
+        }
+    }
+    
+    pthread_mutex_unlock(&g_store_lock);
+    
+    return err;
+}
+
+int add_store_slot(uint32_t *slot, uint64_t taskid) {
+    pthread_mutex_lock(&g_store_lock);
+    
+    uint32_t free_slot = 0;
+    while (free_slot < array_size(g_slot_states) && g_slot_states[free_slot] != STORE_SLOT_FREE) {
+        free_slot++;
+    }
+    
+    // The whole entry (with empty extents) is written at once.
+    int err = free_slot < array_size(g_slot_states) ? 0 : grow_table();
+    if (err != -1) {
+        buffer entry = create_buffer();
+        uint32_t state = STORE_SLOT_USED;
+        err = write_uint64(&entry, &taskid) == -1 || write_uint32(&entry, &state) == -1 ? -1 : 0;
+        if (err != -1) {
+            err = buffer_reserve(&entry, STORE_ENTRY_SIZE);
+        }
+        if (err != -1) {
+            memset(entry.data + entry.length, 0, STORE_ENTRY_SIZE - entry.length);
+            entry.length = STORE_ENTRY_SIZE;
+            err = pwrite(g_store_fd, entry.data, entry.length, (off_t)entry_offset(free_slot)) == entry.length ? 0 : -1;
+        }
+        free(entry.data);
+    }
+    
+    if (err != -1) {
+        err = taskmap_put(&g_slots_index, taskid, free_slot);
+    }
+    
+    if (err != -1) {
+        g_slot_states[free_slot] = STORE_SLOT_USED;
+        *slot = free_slot;
+    }
+    
+    pthread_mutex_unlock(&g_store_lock);
+    
+    return err;
+}
+
+int find_store_slot(uint32_t *slot, uint64_t taskid) {
+    pthread_mutex_lock(&g_store_lock);
+    
+    uint64_t value;
+    int found = taskmap_get(&g_slots_index, taskid, &value);
+    if (found) {
+        *slot = (uint32_t)value;
+    }
+    
+    pthread_mutex_unlock(&g_store_lock);
+    
+    return found ? 0 : -1;
+}
+
+int remove_store_slot(uint32_t slot) {
+    pthread_mutex_lock(&g_store_lock);
+    
+    // The removal is on the disk before `release_store_slot` lets the pages of the task be reused.
+    uint32_t state = STORE_SLOT_FREE;
+    int err = write_uint32s(entry_offset(slot) + STORE_ENTRY_STATE_OFFSET, &state, 1);
+    if (err != -1) {
+        err = fdatasync(g_store_fd);
+    }
+    if (err != -1) {
+        taskmap_remove(&g_slots_index, entry_taskid(slot));
+        g_slot_states[slot] = STORE_SLOT_REMOVED;
+    }
+    
+    pthread_mutex_unlock(&g_store_lock);
+    
+    return err;
+}
+
+void release_store_slot(uint32_t slot) {
+    pthread_mutex_lock(&g_store_lock);
+    
+    if (g_slot_states[slot] == STORE_SLOT_REMOVED) {
+        for (uint32_t kind = 0; kind < STORE_EXTENT_COUNT; kind++) {
+            uint32_t length;
+            free_extent(entry_extent(slot, kind, &length));
+        }
+        
+        g_slot_states[slot] = STORE_SLOT_FREE;
+    }
+    
+    pthread_mutex_unlock(&g_store_lock);
+}
+
+int write_store_extent(uint32_t slot, store_extent_kind kind, const void *data, uint32_t length) {
+    pthread_mutex_lock(&g_store_lock);
+    
+    uint32_t old_length;
+    store_extent old_extent = entry_extent(slot, kind, &old_length);
+    store_extent extent = { .page = 0, .pages = 0 };
+    int err = 0;
+    
+    // Writes the data in new pages and waits for it to reach the disk, then points the entry to them (a crash before
+    // that leaves the old data intact).
+    if (length > 0) {
+        err = allocate_extent(&extent, pages_of(length));
+        if (err != -1) {
+            ssize_t count = pwrite(g_store_fd, data, length, (off_t)((uint64_t)extent.page * STORE_PAGE_SIZE));
+            err = count == length && fdatasync(g_store_fd) != -1 ? 0 : -1;
+        }
+    }
+    
+    // The entry is on the disk before the old pages can be reused (a crash can then not point it to overwritten data).
+    if (err != -1) {
+        uint32_t values[2] = { extent.page, length };
+        err = write_uint32s(extent_offset(slot, kind), values, 2) == -1 || fdatasync(g_store_fd) == -1 ? -1 : 0;
+    }
+    
+    // Frees the old pages once nothing points to them anymore (or the new ones if they could not be used).
+    if (err != -1) {
+        err = free_extent(old_extent);
+    } else if (extent.pages > 0) {
+        free_extent(extent);
+    }
+    
+    pthread_mutex_unlock(&g_store_lock);
+    
+    return err;
+}
+
+int get_store_extent(uint32_t slot, store_extent_kind kind, const uint8_t **data, uint32_t *length, uint64_t *offset) {
+    pthread_mutex_lock(&g_store_lock);
+    
+    store_extent extent = entry_extent(slot, kind, length);
+    *offset = (uint64_t)extent.page * STORE_PAGE_SIZE;
+    *data = g_store_map + *offset;
+    
+    pthread_mutex_unlock(&g_store_lock);
+    
+    return 0;
+}
+
+int get_store_fd() {
+    return g_store_fd;
+}
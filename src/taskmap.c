@@ -0,0 +1,141 @@
+#include <sy5/taskmap.h>
+#include <stdlib.h>
+#include <sy5/utils.h>
+
+// Initial number of entries of a task map.
+#define TASKMAP_INITIAL_CAPACITY 64
+
+// Mixes the bits of a taskid (consecutive taskids would otherwise fill consecutive entries).
+static uint64_t taskmap_hash(uint64_t taskid) {
+    taskid ^= taskid >> 30;
+    taskid *= 0xBF58476D1CE4E5B9ULL;
+    taskid ^= taskid >> 27;
+    taskid *= 0x94D049BB133111EBULL;
+    taskid ^= taskid >> 31;
+    
+    return taskid;
+}
+
+// Returns the index of the entry holding `taskid`, or of the empty entry where it should be inserted.
+static uint64_t taskmap_find(const taskmap *map, uint64_t taskid) {
+    uint64_t mask = map->capacity - 1;
+    uint64_t i = taskmap_hash(taskid) & mask;
+    
+    while (map->entries[i].taskid != taskid && map->entries[i].taskid != TASKMAP_EMPTY_KEY) {
+        i = (i + 1) & mask;
+    }
+    
+    return i;
+}
+
+static int taskmap_grow(taskmap *map) {
+    uint64_t capacity = map->capacity ? map->capacity * 2 : TASKMAP_INITIAL_CAPACITY;
+    taskmap_entry *entries = malloc(capacity * sizeof(taskmap_entry));
+    assert(entries);
+    
+    for (uint64_t i = 0; i < capacity; i++) {
+        entries[i].taskid = TASKMAP_EMPTY_KEY;
+    }
+    
+    taskmap grown = { .size = map->size, .capacity = capacity, .entries = entries };
+    for (uint64_t i = 0; i < map->capacity; i++) {
+        if (map->entries[i].taskid != TASKMAP_EMPTY_KEY) {
+            grown.entries[taskmap_find(&grown, map->entries[i].taskid)] = map->entries[i];
+        }
+    }
+    
+    free(map->entries);
+    *map = grown;
+    
+    return 0;
+}
+
+taskmap create_taskmap() {
+    taskmap map = {
+        .size = 0,
+        .capacity = 0,
+        .entries = NULL
+    };
+    
+    return map;
+}
+
+int taskmap_put(taskmap *map, uint64_t taskid, uint64_t value) {
+    assert(taskid != TASKMAP_EMPTY_KEY);
+    
+    // Keeps the load factor under 70% so that probing sequences stay short.
+    if ((map->size + 1) * 10 > map->capacity * 7) {
+        assert(taskmap_grow(map) != -1);
+    }
+    
+    uint64_t i = taskmap_find(map, taskid);
+    if (map->entries[i].taskid == TASKMAP_EMPTY_KEY) {
+        map->entries[i].taskid = taskid;
+        map->size++;
+    }
+    map->entries[i].value = value;
+    
+    return 0;
+}
+
+int taskmap_get(const taskmap *map, uint64_t taskid, uint64_t *dest) {
+    if (map->size == 0 || taskid == TASKMAP_EMPTY_KEY) {
+        return 0;
+    }
+    
+    uint64_t i = taskmap_find(map, taskid);
+    if (map->entries[i].taskid == TASKMAP_EMPTY_KEY) {
+        return 0;
+    }
+    
+    if (dest != NULL) {
+        *dest = map->entries[i].value;
+    }
+    
+    return 1;
+}
+
+int taskmap_remove(taskmap *map, uint64_t taskid) {
+    if (map->size == 0 || taskid == TASKMAP_EMPTY_KEY) {
+        return 0;
+    }
+    
+    uint64_t mask = map->capacity - 1;
+    uint64_t i = taskmap_find(map, taskid);
+    if (map->entries[i].taskid == TASKMAP_EMPTY_KEY) {
+        return 0;
+    }
+    
+    // Shifts back the following entries of the probing sequence instead of leaving a tombstone.
+    uint64_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (map->entries[j].taskid == TASKMAP_EMPTY_KEY) {
+            break;
+        }
+        
+        uint64_t home = taskmap_hash(map->entries[j].taskid) & mask;
+        
+        // The entry at `j` can only move to `i` if its home is not cyclically in `(i, j]`.
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            map->entries[i] = map->entries[j];
+            i = j;
+        }
+    }
+    
+    map->entries[i].taskid = TASKMAP_EMPTY_KEY;
+    map->size--;
+    
+    return 1;
+}
+
+void free_taskmap(taskmap *map) {
+    if (map == NULL) {
+        return;
+    }
+    
+    free(map->entries);
+    map->entries = NULL;
+    map->size = 0;
+    map->capacity = 0;
+}
@@ -1,3 +1,6 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 #include <sy5/utils.h>
 #include <pwd.h>
 #include <stdio.h>
@@ -6,6 +9,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/file.h>
 #include <sys/errno.h>
@@ -21,19 +25,237 @@
 #define be32toh(x) OSSwapBigToHostInt32(x)
 #define be64toh(x) OSSwapBigToHostInt64(x)
 #else
+#include <fcntl.h>
 #include <limits.h>
 #include <endian.h>
+#include <sys/sendfile.h>
 #endif
 
+// Initial capacity of a buffer (in bytes).
+#define BUFFER_INITIAL_CAPACITY 64
+
+// Size of a serialized `run`.
+#define RUN_SERIALIZED_SIZE (sizeof(uint64_t) + sizeof(uint16_t))
+
 buffer create_buffer() {
     buffer buffer = {
         .length = 0,
+        .capacity = 0,
         .data = NULL
     };
     
     return buffer;
 }
 
+int buffer_reserve(buffer *buf, uint32_t capacity) {
+    if (capacity <= buf->capacity) {
+        return 0;
+    }
+    
+    // Grows geometrically so that successive writes only reallocate a logarithmic number of times.
+    uint64_t new_capacity = buf->capacity ? buf->capacity : BUFFER_INITIAL_CAPACITY;
+    while (new_capacity < capacity) {
+        new_capacity *= 2;
+    }
+    
+    if (new_capacity > UINT32_MAX) {
+        new_capacity = UINT32_MAX;
+    }
+    
+    uint8_t *data = realloc(buf->data, new_capacity);
+    assert(data);
+    buf->data = data;
+    buf->capacity = (uint32_t)new_capacity;
+    
+    return 0;
+}
+
+reader create_reader(int fd) {
+    reader reader = {
+        .fd = fd,
+        .memory = NULL,
+        .position = 0,
+        .length = 0
+    };
+    
+    return reader;
+}
+
+reader create_memory_reader(const uint8_t *memory, uint32_t length) {
+    reader reader = {
+        .fd = -1,
+        .memory = memory,
+        .position = 0,
+        .length = length
+    };
+    
+    return reader;
+}
+
+int read_exact(reader *rd, void *dest, uint32_t length) {
+    uint8_t *out = dest;
+    
+    while (length > 0) {
+        if (rd->position == rd->length) {
+            assert(rd->memory == NULL);
+            
+            // Large reads bypass the internal buffer (there is nothing to gain by copying them twice).
+            uint8_t *target = length >= READER_BUFFER_SIZE ? out : rd->data;
+            ssize_t count = read(rd->fd, target, length >= READER_BUFFER_SIZE ? length : READER_BUFFER_SIZE);
+            
+            if (count == -1 && errno == EINTR) {
+                continue;
+            }
+            
+            assert(count > 0);
+            
+            if (target == out) {
+                out += count;
+                length -= count;
+                continue;
+            }
+            
+            rd->position = 0;
+            rd->length = (uint32_t)count;
+        }
+        
+        uint32_t available = rd->length - rd->position;
+        uint32_t copied = available < length ? available : length;
+        assert(memcpy(out, (rd->memory ? rd->memory : rd->data) + rd->position, copied) != NULL);
+        rd->position += copied;
+        out += copied;
+        length -= copied;
+    }
+    
+    return 0;
+}
+
+int read_to_fd(reader *rd, int fd, uint32_t length) {
+    // Sends the bytes already in the reader's buffer first.
+    while (length > 0 && rd->position < rd->length) {
+        uint32_t available = rd->length - rd->position;
+        const uint8_t *data = (rd->memory ? rd->memory : rd->data) + rd->position;
+        ssize_t count = write(fd, data, available < length ? available : length);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        
+        assert(count > 0);
+        rd->position += count;
+        length -= count;
+    }
+    
+#ifdef __linux__
+    // Moves the rest in the kernel (one of both descriptors must be a pipe, else the bytes are copied).
+    int use_splice = rd->memory == NULL;
+    while (use_splice && length > 0) {
+        ssize_t count = splice(rd->fd, NULL, fd, NULL, length, SPLICE_F_MOVE);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        
+        if (count == -1 && errno == EINVAL) {
+            errno = 0;
+            break;
+        }
+        
+        assert(count > 0);
+        length -= count;
+    }
+#endif
+    
+    uint8_t chunk[STREAM_CHUNK_SIZE];
+    while (length > 0) {
+        uint32_t chunk_length = length < sizeof(chunk) ? length : sizeof(chunk);
+        assert(read_exact(rd, chunk, chunk_length) != -1);
+        
+        for (uint32_t written = 0; written < chunk_length;) {
+            ssize_t count = write(fd, chunk + written, chunk_length - written);
+            if (count == -1 && errno == EINTR) {
+                continue;
+            }
+            
+            assert(count > 0);
+            written += count;
+        }
+        
+        length -= chunk_length;
+    }
+    
+    return 0;
+}
+
+file_range create_file_range() {
+    file_range range = {
+        .fd = -1,
+        .offset = 0,
+        .remaining = 0
+    };
+    
+    return range;
+}
+
+int send_file_range(int fd, file_range *range) {
+    while (range->remaining > 0) {
+        size_t length = range->remaining < STREAM_CHUNK_SIZE ? range->remaining : STREAM_CHUNK_SIZE;
+#ifdef __linux__
+        off_t offset = (off_t)range->offset;
+        ssize_t count = sendfile(fd, range->fd, &offset, length);
+#else
+        uint8_t chunk[STREAM_CHUNK_SIZE];
+        ssize_t count = pread(range->fd, chunk, length, (off_t)range->offset);
+        count = count > 0 ? write(fd, chunk, count) : count;
+#endif
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        
+        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            errno = 0;
+            return 0;
+        }
+        
+        // The file cannot be shorter than the range.
+        assert(count > 0);
+        range->offset += count;
+        range->remaining -= count;
+    }
+    
+    return 0;
+}
+
+void close_file_range(file_range *range) {
+    if (range->fd != -1) {
+        close(range->fd);
+    }
+    
+    *range = create_file_range();
+}
+
+// Returns the size of a serialized `string`.
+static uint64_t string_serialized_size(const string *string) {
+    return sizeof(uint32_t) + string->length;
+}
+
+// Returns the size of a serialized `task`.
+static uint64_t task_serialized_size(const task *task, int write_taskid) {
+    uint64_t size = (write_taskid ? sizeof(uint64_t) : 0) + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t) +
+        sizeof(uint32_t);
+    
+    for (uint32_t i = 0; i < task->commandline.argc; i++) {
+        size += string_serialized_size(&task->commandline.argv[i]);
+    }
+    
+    return size;
+}
+
+// Makes sure that `size` more bytes can be written to a buffer.
+static int buffer_reserve_more(buffer *buf, uint64_t size) {
+    assert(buf->length + size <= UINT32_MAX);
+    
+    return buffer_reserve(buf, (uint32_t)(buf->length + size));
+}
+
 int allocate_paths() {
     if (g_pipes_path == NULL) {
         g_pipes_path = calloc(1, PATH_MAX);
@@ -54,6 +276,10 @@ int allocate_paths() {
     assert(g_reply_pipe_path);
     assert(sprintf(g_reply_pipe_path, "%s%s", g_pipes_path, REPLY_PIPE_NAME) != -1);
     
+    g_socket_path = calloc(1, PATH_MAX);
+    assert(g_socket_path);
+    assert(sprintf(g_socket_path, "%s%s", g_pipes_path, SOCKET_NAME) != -1);
+    
     return 0;
 }
 
@@ -72,6 +298,11 @@ void cleanup_paths() {
         free(g_reply_pipe_path);
         g_reply_pipe_path = NULL;
     }
+    
+    if (g_socket_path != NULL) {
+        free(g_socket_path);
+        g_socket_path = NULL;
+    }
 }
 
 int get_error() {
@@ -328,6 +559,94 @@ int timing_string_from_range(char *dest, unsigned int start, unsigned int stop)
     return sprintf_result;
 }
 
+// Returns the index of the first set bit of `field` at or after `start` (or -1 if there is none).
+static int timing_next_bit(uint64_t field, unsigned int start) {
+    if (start > 63) {
+        return -1;
+    }
+    
+    uint64_t bits = field & (~0ULL << start);
+    
+    return bits ? __builtin_ctzll(bits) : -1;
+}
+
+// Normalizes a broken-down local time and returns it in seconds since EPOCH (making sure to always move forward from
+// `previous`, in case of a DST transition). A local time repeated when DST ends is also taken with the DST flag of
+// `previous` (left in `*time_info`), so that the earliest of its occurrences after `previous` is found.
+static time_t timing_advance(struct tm *time_info, time_t previous) {
+    struct tm same_dst_info = *time_info;
+    same_dst_info.tm_sec = 0;
+    time_t same_dst_timestamp = mktime(&same_dst_info);
+    
+    time_info->tm_sec = 0;
+    time_info->tm_isdst = -1;
+    time_t timestamp = mktime(time_info);
+    if (same_dst_timestamp > previous && (timestamp <= previous || same_dst_timestamp < timestamp)) {
+        timestamp = same_dst_timestamp;
+    }
+    
+    return timestamp > previous ? timestamp : previous + 60;
+}
+
+time_t timing_next_fire(const timing *timing, time_t from) {
+    uint64_t minutes = timing->minutes & ((1ULL << 60) - 1);
+    uint64_t hours = timing->hours & ((1ULL << 24) - 1);
+    uint64_t daysofweek = timing->daysofweek & ((1ULL << 7) - 1);
+    
+    if (minutes == 0 || hours == 0 || daysofweek == 0) {
+        return -1;
+    }
+    
+    time_t timestamp = from - from % 60;
+    
+    // Each iteration jumps to the next matching day, hour or minute, 8 days worth of jumps is more than enough.
+    for (unsigned int i = 0; i < 8 * (24 + 1) * 2; i++) {
+        struct tm time_info;
+        if (localtime_r(&timestamp, &time_info) == NULL) {
+            return -1;
+        }
+        
+        // Jumps to the beginning of the next matching day (looking at the days of the following week if needed).
+        if (((daysofweek >> time_info.tm_wday) & 1) == 0) {
+            int day = timing_next_bit(daysofweek | (daysofweek << 7), time_info.tm_wday);
+            time_info.tm_mday += day - time_info.tm_wday;
+            time_info.tm_hour = 0;
+            time_info.tm_min = 0;
+            timestamp = timing_advance(&time_info, timestamp);
+            continue;
+        }
+        
+        // Jumps to the beginning of the next matching hour (or to the next day if there is none left today).
+        if (((hours >> time_info.tm_hour) & 1) == 0) {
+            int hour = timing_next_bit(hours, time_info.tm_hour);
+            if (hour == -1) {
+                time_info.tm_mday += 1;
+                hour = 0;
+            }
+            time_info.tm_hour = hour;
+            time_info.tm_min = 0;
+            timestamp = timing_advance(&time_info, timestamp);
+            continue;
+        }
+        
+        // Jumps to the next matching minute (or to the next hour if there is none left in this one).
+        if (((minutes >> time_info.tm_min) & 1) == 0) {
+            int minute = timing_next_bit(minutes, time_info.tm_min);
+            if (minute == -1) {
+                time_info.tm_hour += 1;
+                minute = 0;
+            }
+            time_info.tm_min = minute;
+            timestamp = timing_advance(&time_info, timestamp);
+            continue;
+        }
+        
+        return timestamp;
+    }
+    
+    return -1;
+}
+
 int commandline_from_args(commandline *dest, unsigned int argc, char *argv[]) {
     dest->argc = argc;
     
@@ -341,67 +660,95 @@ int commandline_from_args(commandline *dest, unsigned int argc, char *argv[]) {
 }
 
 int write_buffer(int fd, const buffer *buf) {
-    uint32_t remaining = buf->length;
-    uint32_t i = 0;
+    struct iovec iov = { .iov_base = buf->data, .iov_len = buf->length };
     
-    do {
-        if (i > 0) {
-            remaining -= PIPE_BUF;
+    return write_iovecs(fd, &iov, 1);
+}
+
+int write_iovecs(int fd, struct iovec *iovs, uint32_t count) {
+    while (count > 0) {
+        if (iovs->iov_len == 0) {
+            iovs++;
+            count--;
+            continue;
         }
         
-        assert(write(fd, buf->data + i * PIPE_BUF, remaining > PIPE_BUF ? PIPE_BUF : remaining) != -1);
+        ssize_t written = writev(fd, iovs, count < IOV_MAX ? (int)count : IOV_MAX);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        assert(written > 0);
+        
+        // A short write resumes in the middle of the vector it stopped in.
+        while (count > 0 && (size_t)written >= iovs->iov_len) {
+            written -= (ssize_t)iovs->iov_len;
+            iovs++;
+            count--;
+        }
+        if (count > 0) {
+            iovs->iov_base = (uint8_t *)iovs->iov_base + written;
+            iovs->iov_len -= (size_t)written;
+        }
+    }
     
-        i++;
-    } while (remaining > PIPE_BUF);
+    return 0;
+}
+
+int write_bytes(buffer *buf, const void *bytes, uint32_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    
+    assert(buffer_reserve_more(buf, length) != -1);
+    assert(memcpy(buf->data + buf->length, bytes, length) != NULL);
+    buf->length += length;
     
     return 0;
 }
 
-int write_uint8(buffer *buf, const uint8_t *n) {
-    buf->data = realloc(buf->data, buf->length + sizeof(uint8_t));
-    assert(buf->data);
-    assert(memcpy(buf->data + buf->length, n, sizeof(uint8_t)) != NULL);
-    buf->length += sizeof(uint8_t);
+int begin_frame(buffer *buf, uint64_t requestid, uint32_t *frame_start) {
+    uint32_t length = 0;
+    *frame_start = buf->length;
+    assert(write_uint32(buf, &length) != -1);
+    assert(write_uint64(buf, &requestid) != -1);
     
     return 0;
 }
 
+int end_frame(buffer *buf, uint32_t frame_start, uint32_t streamed_length) {
+    assert(buf->length >= frame_start + sizeof(uint32_t));
+    uint32_t be_length = htobe32(buf->length - frame_start - (uint32_t)sizeof(uint32_t) + streamed_length);
+    assert(memcpy(buf->data + frame_start, &be_length, sizeof(uint32_t)) != NULL);
+    
+    return 0;
+}
+
+int write_uint8(buffer *buf, const uint8_t *n) {
+    return write_bytes(buf, n, sizeof(uint8_t));
+}
+
 int write_uint16(buffer *buf, const uint16_t *n) {
-    buf->data = realloc(buf->data, buf->length + sizeof(uint16_t));
-    assert(buf->data);
     uint16_t be_n = htobe16(*n);
-    assert(memcpy(buf->data + buf->length, &be_n, sizeof(uint16_t)) != NULL);
-    buf->length += sizeof(uint16_t);
     
-    return 0;
+    return write_bytes(buf, &be_n, sizeof(uint16_t));
 }
 
 int write_uint32(buffer *buf, const uint32_t *n) {
-    buf->data = realloc(buf->data, buf->length + sizeof(uint32_t));
-    assert(buf->data);
     uint32_t be_n = htobe32(*n);
-    assert(memcpy(buf->data + buf->length, &be_n, sizeof(uint32_t)) != NULL);
-    buf->length += sizeof(uint32_t);
     
-    return 0;
+    return write_bytes(buf, &be_n, sizeof(uint32_t));
 }
 
 int write_uint64(buffer *buf, const uint64_t *n) {
-    buf->data = realloc(buf->data, buf->length + sizeof(uint64_t));
-    assert(buf->data);
     uint64_t be_n = htobe64(*n);
-    assert(memcpy(buf->data + buf->length, &be_n, sizeof(uint64_t)) != NULL);
-    buf->length += sizeof(uint64_t);
     
-    return 0;
+    return write_bytes(buf, &be_n, sizeof(uint64_t));
 }
 
 int write_string(buffer *buf, const string *string) {
+    assert(buffer_reserve_more(buf, string_serialized_size(string)) != -1);
     assert(write_uint32(buf, &string->length) != -1);
-    
-    for (uint32_t i = 0; i < string->length; i++) {
-        assert(write_uint8(buf, &string->data[i]) != -1);
-    }
+    assert(write_bytes(buf, string->data, string->length) != -1);
     
     return 0;
 }
@@ -425,6 +772,8 @@ int write_commandline(buffer *buf, const commandline *commandline) {
 }
 
 int write_task(buffer *buf, const task *task, int write_taskid) {
+    assert(buffer_reserve_more(buf, task_serialized_size(task, write_taskid)) != -1);
+    
     if (write_taskid) {
         assert(write_uint64(buf, &task->taskid) != -1);
     }
@@ -437,6 +786,14 @@ int write_task(buffer *buf, const task *task, int write_taskid) {
 
 int write_task_array(buffer *buf, const task *tasks) {
     uint32_t size = array_size(tasks);
+    
+    // Sizes the buffer up front so that the whole array is serialized without any reallocation.
+    uint64_t serialized_size = sizeof(uint32_t);
+    for (uint32_t i = 0; i < size; i++) {
+        serialized_size += task_serialized_size(&tasks[i], 1);
+    }
+    assert(buffer_reserve_more(buf, serialized_size) != -1);
+    
     assert(write_uint32(buf, &size) != -1);
     
     for (uint32_t i = 0; i < size; i++) {
@@ -455,6 +812,7 @@ int write_run(buffer *buf, const run *run) {
 
 int write_run_array(buffer *buf, const run *runs) {
     uint32_t size = array_size(runs);
+    assert(buffer_reserve_more(buf, sizeof(uint32_t) + (uint64_t)size * RUN_SERIALIZED_SIZE) != -1);
     assert(write_uint32(buf, &size) != -1);
     
     for (uint32_t i = 0; i < size; i++) {
@@ -464,106 +822,129 @@ int write_run_array(buffer *buf, const run *runs) {
     return 0;
 }
 
-int read_uint8(int fd, uint8_t *n) {
-    return (int)read(fd, n, sizeof(uint8_t));
+int read_uint8(reader *rd, uint8_t *n) {
+    return read_exact(rd, n, sizeof(uint8_t));
 }
 
-int read_uint16(int fd, uint16_t *n) {
+int read_uint16(reader *rd, uint16_t *n) {
     uint16_t be_n;
-    assert(read(fd, &be_n, sizeof(uint16_t)) != -1);
+    assert(read_exact(rd, &be_n, sizeof(uint16_t)) != -1);
     *n = be16toh(be_n);
     
     return 0;
 }
 
-int read_uint32(int fd, uint32_t *n) {
+int read_uint32(reader *rd, uint32_t *n) {
     uint32_t be_n;
-    assert(read(fd, &be_n, sizeof(uint32_t)) != -1);
+    assert(read_exact(rd, &be_n, sizeof(uint32_t)) != -1);
     *n = be32toh(be_n);
     
     return 0;
 }
 
-int read_uint64(int fd, uint64_t *n) {
+int read_uint64(reader *rd, uint64_t *n) {
     uint64_t be_n;
-    assert(read(fd, &be_n, sizeof(uint64_t)) != -1);
+    assert(read_exact(rd, &be_n, sizeof(uint64_t)) != -1);
     *n = be64toh(be_n);
     
     return 0;
 }
 
-int read_string(int fd, string *string) {
-    assert(read_uint32(fd, &string->length) != -1);
+// Returns the maximum number of bytes which can be read from a reader for a string or a command line (the bytes left
+// in memory, or `STRING_MAX_LENGTH` from a file descriptor).
+static uint64_t readable_length(const reader *rd) {
+    return rd->memory != NULL ? rd->length - rd->position : STRING_MAX_LENGTH;
+}
+
+int read_string(reader *rd, string *string) {
+    assert(read_uint32(rd, &string->length) != -1);
+    assert(string->length <= readable_length(rd));
     
-    string->data = malloc(string->length);
+    string->data = malloc((size_t)string->length + 1);
     assert(string->data);
+    string->data[string->length] = '\0';
     
-    for (uint32_t i = 0; i < string->length; i++) {
-        assert(read_uint8(fd, &string->data[i]) != -1);
+    if (read_exact(rd, string->data, string->length) == -1) {
+        free(string->data);
+        string->data = NULL;
+        return -1;
     }
     
     return 0;
 }
 
-int read_timing(int fd, timing *timing) {
-    assert(read_uint64(fd, &timing->minutes) != -1);
-    assert(read_uint32(fd, &timing->hours) != -1);
-    assert(read_uint8(fd, &timing->daysofweek) != -1);
+int read_timing(reader *rd, timing *timing) {
+    assert(read_uint64(rd, &timing->minutes) != -1);
+    assert(read_uint32(rd, &timing->hours) != -1);
+    assert(read_uint8(rd, &timing->daysofweek) != -1);
     
     return 0;
 }
 
-int read_commandline(int fd, commandline *commandline) {
-    assert(read_uint32(fd, &commandline->argc) != -1);
+int read_commandline(reader *rd, commandline *commandline) {
+    // The command line is left empty in case of failure.
+    commandline->argc = 0;
+    commandline->argv = NULL;
     
-    commandline->argv = malloc(commandline->argc * sizeof(string));
-    assert(commandline->argv);
+    // Each argument takes at least its length.
+    uint32_t argc;
+    assert(read_uint32(rd, &argc) != -1);
+    assert(argc <= readable_length(rd) / sizeof(uint32_t));
     
-    for (uint32_t i = 0; i < commandline->argc; i++) {
-        assert(read_string(fd, &commandline->argv[i]) != -1);
+    commandline->argv = malloc((size_t)argc * sizeof(string));
+    assert(commandline->argv || argc == 0);
+    
+    for (; commandline->argc < argc; commandline->argc++) {
+        if (read_string(rd, &commandline->argv[commandline->argc]) == -1) {
+            free_commandline(commandline);
+            commandline->argc = 0;
+            return -1;
+        }
     }
     
     return 0;
 }
 
-int read_task(int fd, task *task, int read_taskid) {
+int read_task(reader *rd, task *task, int read_taskid) {
     if (read_taskid) {
-        assert(read_uint64(fd, &task->taskid) != -1);
+        assert(read_uint64(rd, &task->taskid) != -1);
     }
     
-    assert(read_timing(fd, &task->timing) != -1);
-    assert(read_commandline(fd, &task->commandline) != -1);
+    assert(read_timing(rd, &task->timing) != -1);
+    assert(read_commandline(rd, &task->commandline) != -1);
     
     return 0;
 }
 
-int read_task_array(int fd, task **tasks) {
+int read_task_array(reader *rd, task **tasks) {
     uint32_t nbtasks;
-    assert(read_uint32(fd, &nbtasks) != -1);
+    assert(read_uint32(rd, &nbtasks) != -1);
+    assert(array_reserve(*tasks, array_size(*tasks) + nbtasks) != -1);
     
     for (uint32_t i = 0; i < nbtasks; i++) {
         task task;
-        assert(read_task(fd, &task, 1) != -1);
+        assert(read_task(rd, &task, 1) != -1);
         array_push(*tasks, task);
     }
     
     return (int)nbtasks;
 }
 
-int read_run(int fd, run *run) {
-    assert(read_uint64(fd, &run->time) != -1);
-    assert(read_uint16(fd, &run->exitcode) != -1);
+int read_run(reader *rd, run *run) {
+    assert(read_uint64(rd, &run->time) != -1);
+    assert(read_uint16(rd, &run->exitcode) != -1);
     
     return 0;
 }
 
-int read_run_array(int fd, run **runs) {
+int read_run_array(reader *rd, run **runs) {
     uint32_t nbruns;
-    assert(read_uint32(fd, &nbruns) != -1);
+    assert(read_uint32(rd, &nbruns) != -1);
+    assert(array_reserve(*runs, array_size(*runs) + nbruns) != -1);
     
     for (uint32_t i = 0; i < nbruns; i++) {
         run run;
-        assert(read_run(fd, &run) != -1);
+        assert(read_run(rd, &run) != -1);
         array_push(*runs, run);
     }
     
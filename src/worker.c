@@ -1,39 +1,519 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 #include <sy5/worker.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <errno.h>
 #include <limits.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/fcntl.h>
 #include <sy5/utils.h>
 #include <sy5/array.h>
+#include <sy5/store.h>
+#include <sy5/journal.h>
+#include <sy5/taskmap.h>
+
+// Magic number at the beginning of a `runs` file ('RUNS').
+#define RUNS_FILE_MAGIC 0x52554E53
+
+// Version of the format of the `runs` file (1 was an unbounded log, 2 is a ring of `capacity` slots).
+#define RUNS_FILE_VERSION 2
+
+// Size of the header of a `runs` file (its magic number, its version, its capacity, the slot of its oldest run and its
+// number of runs, as five `uint32`).
+#define RUNS_FILE_HEADER_SIZE (5 * sizeof(uint32_t))
+
+// Offset of the slot of the oldest run in the header of a `runs` file (followed by the number of runs).
+#define RUNS_FILE_START_OFFSET (3 * sizeof(uint32_t))
+
+// Size of the header of a `runs` file in version 1 (its magic number and its version).
+#define RUNS_FILE_V1_HEADER_SIZE (2 * sizeof(uint32_t))
+
+// Size of a run in a `runs` file (a `uint64` time followed by a `uint16` exit code, like in a reply).
+#define RUNS_FILE_RECORD_SIZE (sizeof(uint64_t) + sizeof(uint16_t))
+
+// Minimum number of tasks loaded by each thread of `load_workers`.
+#define LOAD_MIN_TASKS_PER_THREAD 256
+
+// Size of the chunks read from the pipes of a running task.
+#define CAPTURE_CHUNK_SIZE (64 * 1024)
+
+// Initial capacity of the buffer capturing a stream of a running task (it grows up to `g_output_cap`).
+#define CAPTURE_INITIAL_CAPACITY (16 * 1024)
+
+// Environment of the daemon (given to the tasks).
+extern char **environ;
 
 worker **g_workers = NULL;
-uint64_t *g_running_taskids = NULL;
+pthread_rwlock_t g_workers_lock = PTHREAD_RWLOCK_INITIALIZER;
+uint32_t g_runs_retention_count = DEFAULT_RUNS_RETENTION_COUNT;
+uint64_t g_runs_retention_age = 0;
+uint32_t g_output_cap = DEFAULT_OUTPUT_CAP;
 
-typedef struct worker_cleanup_handle {
-    worker *worker;
-    pthread_mutex_t *mutex;
-} worker_cleanup_handle;
+// Index of `g_workers` by taskid.
+static taskmap g_workers_index = { 0 };
 
-int create_worker(worker **dest, task *task, const char *tasks_path, uint64_t taskid) {
-    worker *tmp = malloc(sizeof(worker));
-    assert(tmp);
+// Number of `NULL` holes in `g_workers`.
+static uint64_t g_workers_holes = 0;
+
+uint64_t g_workers_seq = 0;
+
+// Describes a change of the running workers.
+typedef struct worker_change {
+    uint64_t taskid;
     
-    if (task != NULL) {
-        tmp->task = *task;
+    // Non-zero for a removal, else an addition.
+    uint8_t removed;
+} worker_change;
+
+// Array of the latest changes of the running workers, the change at index `i` having the sequence number
+// `g_workers_changes_start + i + 1` (the oldest changes are forgotten so that it stays proportional to the workers).
+static worker_change *g_workers_changes = NULL;
+static uint64_t g_workers_changes_start = 0;
+
+// Minimum number of changes kept (more are kept when there are more running workers).
+#define WORKER_CHANGES_MIN_COUNT 1024
+
+// Returns the address of the run in slot `slot` of the mapping of a `runs` file.
+static const uint8_t *run_slot(const worker *worker, uint32_t slot) {
+    return worker->runs_map + RUNS_FILE_HEADER_SIZE + (uint64_t)slot * RUNS_FILE_RECORD_SIZE;
+}
+
+// Returns the time of the `index`-th oldest run of a worker.
+static uint64_t run_time(const worker *worker, uint32_t index) {
+    reader rd = create_memory_reader(run_slot(worker, (worker->runs_start + index) % worker->runs_capacity),
+        RUNS_FILE_RECORD_SIZE);
+    uint64_t time = 0;
+    read_uint64(&rd, &time);
+    
+    return time;
+}
+
+// Returns the index of the oldest run of a worker at or after `time` (or `runs_count` if there is none).
+static uint32_t find_first_run(const worker *worker, uint64_t time) {
+    // The runs are ordered by time, so they can be searched with a binary search.
+    uint32_t low = 0;
+    uint32_t high = worker->runs_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (run_time(worker, middle) < time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    
+    return low;
+}
+
+// Returns the number of the oldest runs of a worker that are older than the retention age at `now`.
+static uint32_t count_expired_runs(const worker *worker, uint64_t now) {
+    if (g_runs_retention_age == 0 || now < g_runs_retention_age) {
+        return 0;
+    }
+    
+    return find_first_run(worker, now - g_runs_retention_age);
+}
+
+// Writes the slot of the oldest run and the number of runs of a worker in the header of its `runs` file.
+// Returns `-1` in case of failure, else 0.
+static int write_runs_file_position(worker *worker) {
+    buffer position = create_buffer();
+    int err = write_uint32(&position, &worker->runs_start);
+    
+    if (err != -1) {
+        err = write_uint32(&position, &worker->runs_count);
+    }
+    
+    if (err != -1) {
+        ssize_t count = pwrite(worker->runs_file_fd, position.data, position.length,
+            (off_t)(worker->runs_file_offset + RUNS_FILE_START_OFFSET));
+        err = count == position.length ? 0 : -1;
+    }
+    
+    free(position.data);
+    
+    return err;
+}
+
+// Reads every run of a `runs` file (whatever its format) of `size` bytes, from the oldest to the latest, in `*runs`.
+// Returns `-1` in case of failure, else 0.
+static int read_runs_data(const uint8_t *data, uint64_t size, run **runs) {
+    if (size == 0) {
+        return 0;
     }
-    tmp->runs = NULL;
-    tmp->last_stdout.length = 0;
-    tmp->last_stdout.data = NULL;
-    tmp->last_stderr.length = 0;
-    tmp->last_stderr.data = NULL;
+    
+    reader rd = create_memory_reader(data, (uint32_t)size);
+    
+    uint32_t magic = 0;
+    if (size >= RUNS_FILE_V1_HEADER_SIZE) {
+        reader magic_reader = create_memory_reader(data, sizeof(uint32_t));
+        assert(read_uint32(&magic_reader, &magic) != -1);
+    }
+    
+    if (magic != RUNS_FILE_MAGIC) {
+        // Unversioned format (a whole `run[]`).
+        return read_run_array(&rd, runs) == -1 ? -1 : 0;
+    }
+    
+    uint32_t version;
+    assert(read_uint32(&rd, &magic) != -1);
+    assert(read_uint32(&rd, &version) != -1);
+    
+    if (version == 1) {
+        // Log of every run (a run partially appended, if the daemon was stopped in the middle of a write, is dropped).
+        uint64_t count = (size - RUNS_FILE_V1_HEADER_SIZE) / RUNS_FILE_RECORD_SIZE;
+        for (uint64_t i = 0; i < count; i++) {
+            run cur_run;
+            assert(read_run(&rd, &cur_run) != -1);
+            assert(array_push(*runs, cur_run) != -1);
+        }
+        
+        return 0;
+    }
+    
+    assert(version == RUNS_FILE_VERSION);
+    uint32_t capacity;
+    uint32_t start;
+    uint32_t count;
+    assert(read_uint32(&rd, &capacity) != -1);
+    assert(read_uint32(&rd, &start) != -1);
+    assert(read_uint32(&rd, &count) != -1);
+    assert(count <= capacity && (capacity == 0 || start < capacity));
+    assert(size >= RUNS_FILE_HEADER_SIZE + (uint64_t)capacity * RUNS_FILE_RECORD_SIZE);
+    
+    assert(array_reserve(*runs, count) != -1);
+    for (uint32_t i = 0; i < count; i++) {
+        reader slot_reader = create_memory_reader(data + RUNS_FILE_HEADER_SIZE +
+            (uint64_t)((start + i) % capacity) * RUNS_FILE_RECORD_SIZE, RUNS_FILE_RECORD_SIZE);
+        run cur_run;
+        assert(read_run(&slot_reader, &cur_run) != -1);
+        array_push(*runs, cur_run);
+    }
+    
+    return 0;
+}
+
+// Checks if `size` bytes of `data` are a ring of runs of the worker's capacity, in which case its position is read.
+static int is_runs_ring(worker *worker, const uint8_t *data, uint64_t size) {
+    if (size != RUNS_FILE_HEADER_SIZE + (uint64_t)worker->runs_capacity * RUNS_FILE_RECORD_SIZE) {
+        return 0;
+    }
+    
+    reader rd = create_memory_reader(data, RUNS_FILE_HEADER_SIZE);
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    if (read_uint32(&rd, &magic) == -1 || read_uint32(&rd, &version) == -1 || read_uint32(&rd, &capacity) == -1 ||
+        read_uint32(&rd, &worker->runs_start) == -1 || read_uint32(&rd, &worker->runs_count) == -1) {
+        return 0;
+    }
+    
+    return magic == RUNS_FILE_MAGIC && version == RUNS_FILE_VERSION && capacity == worker->runs_capacity &&
+        worker->runs_count <= capacity && (capacity == 0 || worker->runs_start < capacity);
+}
+
+// Writes a ring of the worker's capacity holding the latest of `runs` (with its header, and with its free slots
+// zeroed) to a `data`.
+// Returns `-1` in case of failure, else 0.
+static int write_runs_ring(buffer *buf, worker *worker, const run *runs) {
+    uint64_t first = array_size(runs) > worker->runs_capacity ? array_size(runs) - worker->runs_capacity : 0;
+    worker->runs_start = 0;
+    worker->runs_count = (uint32_t)(array_size(runs) - first);
+    
+    uint32_t size = RUNS_FILE_HEADER_SIZE + worker->runs_capacity * RUNS_FILE_RECORD_SIZE;
+    uint32_t magic = RUNS_FILE_MAGIC;
+    uint32_t version = RUNS_FILE_VERSION;
+    assert(buffer_reserve(buf, buf->length + size) != -1);
+    assert(write_uint32(buf, &magic) != -1 && write_uint32(buf, &version) != -1 &&
+        write_uint32(buf, &worker->runs_capacity) != -1 && write_uint32(buf, &worker->runs_start) != -1 &&
+        write_uint32(buf, &worker->runs_count) != -1);
+    for (uint64_t i = first; i < array_size(runs); i++) {
+        assert(write_run(buf, &runs[i]) != -1);
+    }
+    
+    uint32_t free_slots = (worker->runs_capacity - worker->runs_count) * RUNS_FILE_RECORD_SIZE;
+    assert(memset(buf->data + buf->length, 0, free_slots) != NULL);
+    buf->length += free_slots;
+    
+    return 0;
+}
+
+// Opens the `runs` file of a worker (rewriting it if its format or its capacity changed) and maps it.
+// Returns `-1` in case of failure, else 0.
+static int open_runs_file(worker *worker) {
+    assert(open_file(&worker->runs_file_fd, worker->dir_path, "runs", O_RDWR | O_CREAT | O_CLOEXEC) != -1);
+    off_t size = lseek(worker->runs_file_fd, 0L, SEEK_END);
+    assert(size != -1);
+    
+    worker->runs_capacity = g_runs_retention_count;
+    worker->runs_map_size = RUNS_FILE_HEADER_SIZE + (uint64_t)worker->runs_capacity * RUNS_FILE_RECORD_SIZE;
+    
+    uint8_t *map = NULL;
+    if (size > 0) {
+        map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, worker->runs_file_fd, 0);
+        assert(map != MAP_FAILED);
+    }
+    
+    // Reuses the file as is if it is already a ring of the right capacity.
+    if (is_runs_ring(worker, map, (uint64_t)size)) {
+        worker->runs_map = map;
+        return 0;
+    }
+    
+    // Otherwise, rewrites the file with its latest runs (as many as the capacity allows).
+    run *runs = NULL;
+    int err = read_runs_data(map, (uint64_t)size, &runs);
+    if (map != NULL) {
+        munmap(map, (size_t)size);
+    }
+    
+    buffer buf = create_buffer();
+    if (err != -1) {
+        err = write_runs_ring(&buf, worker, runs);
+    }
+    if (err != -1) {
+        err = ftruncate(worker->runs_file_fd, 0) == -1 || lseek(worker->runs_file_fd, 0L, SEEK_SET) == -1 ? -1 : 0;
+    }
+    if (err != -1) {
+        err = write_buffer(worker->runs_file_fd, &buf);
+    }
+    
+    free(buf.data);
+    array_free(runs);
+    assert(err != -1);
+    
+    map = mmap(NULL, worker->runs_map_size, PROT_READ, MAP_SHARED, worker->runs_file_fd, 0);
+    assert(map != MAP_FAILED);
+    worker->runs_map = map;
+    
+    return 0;
+}
+
+// Opens the runs of a worker in the store (rewriting them if their capacity changed), they are then updated in place
+// like a `runs` file.
+// Returns `-1` in case of failure, else 0.
+static int open_store_runs(worker *worker) {
+    worker->runs_capacity = g_runs_retention_count;
+    worker->runs_map_size = RUNS_FILE_HEADER_SIZE + (uint64_t)worker->runs_capacity * RUNS_FILE_RECORD_SIZE;
+    worker->runs_file_fd = get_store_fd();
+    
+    const uint8_t *data;
+    uint32_t length;
+    assert(get_store_extent(worker->store_slot, STORE_EXTENT_RUNS, &data, &length, &worker->runs_file_offset) != -1);
+    
+    if (!is_runs_ring(worker, data, length)) {
+        run *runs = NULL;
+        buffer buf = create_buffer();
+        int err = read_runs_data(data, length, &runs);
+        if (err != -1) {
+            err = write_runs_ring(&buf, worker, runs);
+        }
+        if (err != -1) {
+            err = write_store_extent(worker->store_slot, STORE_EXTENT_RUNS, buf.data, buf.length);
+        }
+        if (err != -1) {
+            err = get_store_extent(worker->store_slot, STORE_EXTENT_RUNS, &data, &length, &worker->runs_file_offset);
+        }
+        
+        free(buf.data);
+        array_free(runs);
+        assert(err != -1);
+    }
+    
+    worker->runs_map = (uint8_t *)data;
+    
+    return 0;
+}
+
+// Adds a run to the `runs` file of a worker, replacing its oldest run if the ring is full and forgetting the runs older
+// than the retention age (the worker's lock must be held).
+// Returns `-1` in case of failure, else 0.
+static int append_run(worker *worker, const run *run) {
+    if (worker->runs_capacity == 0) {
+        return 0;
+    }
+    
+    uint32_t expired = count_expired_runs(worker, run->time);
+    worker->runs_start = (worker->runs_start + expired) % worker->runs_capacity;
+    worker->runs_count -= expired;
+    
+    uint32_t slot = (worker->runs_start + worker->runs_count) % worker->runs_capacity;
+    buffer record = create_buffer();
+    int err = write_run(&record, run);
+    
+    if (err != -1) {
+        off_t offset = (off_t)(worker->runs_file_offset + (uint64_t)(run_slot(worker, slot) - worker->runs_map));
+        ssize_t count = pwrite(worker->runs_file_fd, record.data, record.length, offset);
+        err = count == record.length ? 0 : -1;
+    }
+    
+    free(record.data);
+    assert(err != -1);
+    
+    if (worker->runs_count < worker->runs_capacity) {
+        worker->runs_count++;
+    } else {
+        worker->runs_start = (worker->runs_start + 1) % worker->runs_capacity;
+    }
+    
+    // The header is only updated once the run is written (so a crash in the middle of the write loses this run only).
+    return write_runs_file_position(worker);
+}
+
+int write_worker_runs(buffer *buf, const worker *worker) {
+    return write_worker_runs_range(buf, worker, 0, UINT64_MAX, 0, 0);
+}
+
+int write_worker_runs_range(buffer *buf, const worker *worker, uint64_t since, uint64_t until, uint32_t offset,
+    uint32_t limit) {
+    // Finds the window of runs to send (`[first, last)`, from the oldest to the latest).
+    uint32_t first = count_expired_runs(worker, (uint64_t)time(NULL));
+    uint32_t last = worker->runs_count;
+    
+    if (since > 0) {
+        uint32_t since_first = find_first_run(worker, since);
+        first = since_first > first ? since_first : first;
+    }
+    
+    if (until < UINT64_MAX) {
+        last = find_first_run(worker, until + 1);
+    }
+    
+    if (last < first) {
+        last = first;
+    }
+    
+    // Pages are counted from the latest run (so that the latest runs can be asked without knowing how many there are).
+    last -= offset < last - first ? offset : last - first;
+    if (limit > 0 && last - first > limit) {
+        first = last - limit;
+    }
+    
+    uint32_t count = last - first;
+    assert(buffer_reserve(buf, buf->length + sizeof(uint32_t) + count * RUNS_FILE_RECORD_SIZE) != -1);
+    assert(write_uint32(buf, &count) != -1);
+    
+    if (count == 0) {
+        return 0;
+    }
+    
+    // The runs are stored in the file exactly as they are sent, so they are copied as is (in two parts if the runs wrap
+    // around the end of the ring).
+    uint32_t first_slot = (worker->runs_start + first) % worker->runs_capacity;
+    uint32_t first_part = worker->runs_capacity - first_slot < count ? worker->runs_capacity - first_slot : count;
+    assert(write_bytes(buf, run_slot(worker, first_slot), first_part * RUNS_FILE_RECORD_SIZE) != -1);
+    
+    if (first_part < count) {
+        assert(write_bytes(buf, run_slot(worker, 0), (count - first_part) * RUNS_FILE_RECORD_SIZE) != -1);
+    }
+    
+    return 0;
+}
+
+int write_worker_output(buffer *buf, file_range *range, const worker *worker, uint32_t stream) {
+    if (range != NULL) {
+        *range = create_file_range();
+    }
+    
+    // The outputs in the store are copied (their pages may be reused as soon as the worker's lock is released).
+    if (worker->store_slot != WORKER_NO_STORE_SLOT) {
+        const uint8_t *data;
+        uint32_t length;
+        uint64_t offset;
+        assert(get_store_extent(worker->store_slot, stream == 0 ? STORE_EXTENT_STDOUT : STORE_EXTENT_STDERR, &data,
+            &length, &offset) != -1);
+        assert(buffer_reserve(buf, buf->length + sizeof(uint32_t) + length) != -1);
+        assert(write_uint32(buf, &length) != -1);
+        
+        return write_bytes(buf, data, length);
+    }
+    
+    // The file holds the output serialized like in a reply, so it is sent as is (a file which is empty or shorter than
+    // its length, after a crash in the middle of a write, is sent as far as it goes).
+    int fd = stream == 0 ? worker->last_stdout_file_fd : worker->last_stderr_file_fd;
+    struct stat file_stat;
+    assert(fstat(fd, &file_stat) != -1);
+    
+    uint32_t length = 0;
+    uint8_t header[sizeof(uint32_t)];
+    if (file_stat.st_size >= (off_t)sizeof(header) && pread(fd, header, sizeof(header), 0) == sizeof(header)) {
+        reader header_reader = create_memory_reader(header, sizeof(header));
+        assert(read_uint32(&header_reader, &length) != -1);
+        uint64_t available = (uint64_t)file_stat.st_size - sizeof(header);
+        length = length > available ? (uint32_t)available : length;
+    }
+    
+    assert(write_uint32(buf, &length) != -1);
+    
+    // The file is never written again once replaced (see `save_output`), so it can be streamed from its own descriptor
+    // after the worker's lock is released.
+    if (range != NULL && length > 0) {
+        range->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        assert(range->fd != -1);
+        range->offset = sizeof(header);
+        range->remaining = length;
+        
+        return 0;
+    }
+    
+    assert(buffer_reserve(buf, buf->length + length) != -1);
+    uint32_t copied = 0;
+    while (copied < length) {
+        ssize_t count = pread(fd, buf->data + buf->length + copied, length - copied, sizeof(header) + copied);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        assert(count > 0);
+        copied += (uint32_t)count;
+    }
+    buf->length += length;
+    
+    return 0;
+}
+
+// Creates the `NULL`-terminated arguments of a command line for `posix_spawnp`, in a single block (the array of pointers
+// followed by the NUL-terminated arguments) which can be freed at once.
+// Returns `-1` in case of failure, else 0.
+static int create_exec_argv(char ***dest, const commandline *commandline) {
+    uint64_t size = (commandline->argc + 1) * sizeof(char *);
+    for (uint32_t i = 0; i < commandline->argc; i++) {
+        size += commandline->argv[i].length + 1;
+    }
+    
+    char **argv = malloc(size);
+    assert(argv);
+    
+    char *arg = (char *)(argv + commandline->argc + 1);
+    for (uint32_t i = 0; i < commandline->argc; i++) {
+        argv[i] = arg;
+        assert(memcpy(arg, commandline->argv[i].data, commandline->argv[i].length) != NULL);
+        arg[commandline->argv[i].length] = '\0';
+        arg += commandline->argv[i].length + 1;
+    }
+    argv[commandline->argc] = NULL;
+    
+    *dest = argv;
+    
+    return 0;
+}
+
+// Opens (or creates) the directory of a worker, and reads (or writes) its task.
+// Returns `-1` in case of failure, else 0.
+static int open_worker_directory(worker *worker, task *task, const char *tasks_path, uint64_t taskid) {
     char *task_path = calloc(1, PATH_MAX);
     assert(task_path != NULL);
 #ifdef __APPLE__
@@ -42,289 +522,739 @@ int create_worker(worker **dest, task *task, const char *tasks_path, uint64_t ta
     assert(sprintf(task_path, "%s%lu/", tasks_path, taskid) != -1);
 #endif
     assert(task_path != NULL);
-    tmp->dir_path = task_path;
+    worker->dir_path = task_path;
+    
+    // A task of the journal is read from it (its directory, which only holds its results, is created with them).
+    if (is_journal_opened()) {
+        return task != NULL ? 0 : find_journal_task(taskid, &worker->task);
+    }
     
     // Creates the task's directory if it doesn't exist.
-    assert(create_directory(tmp->dir_path) != -1);
+    assert(create_directory(worker->dir_path) != -1);
+    
+    // Opens (or create) and read (or write) the `task` file (which is not kept open, as it is never written again).
+    int task_file_fd;
+    assert(open_file(&task_file_fd, worker->dir_path, "task", O_RDWR | O_CREAT | O_CLOEXEC) != -1);
+    off_t pos = lseek(task_file_fd, 0L, SEEK_END);
+    int err = pos != -1 && (pos != 0 || task != NULL) && lseek(task_file_fd, 0L, SEEK_SET) != -1 ? 0 : -1;
+    if (err != -1 && task != NULL) {
+        buffer buf = create_buffer();
+        err = ftruncate(task_file_fd, 0) == -1 || write_task(&buf, task, 1) == -1 ||
+            write_buffer(task_file_fd, &buf) == -1 ? -1 : 0;
+        free(buf.data);
+    } else if (err != -1) {
+        reader task_reader = create_reader(task_file_fd);
+        err = read_task(&task_reader, &worker->task, 1);
+    }
+    
+    close(task_file_fd);
+    
+    return err;
+}
+
+// Opens the files holding the results of a worker (in its directory, which must exist), its outputs are only read when
+// requested.
+// Returns `-1` in case of failure, else 0.
+static int open_worker_files(worker *worker) {
+    // Opens and maps the `runs` file.
+    assert(open_runs_file(worker) != -1);
+    
+    // Opens the `last_stdout` and `last_stderr` files (like the `runs` file, they are not inherited by the tasks).
+    int oflags = O_RDWR | O_CREAT | O_CLOEXEC;
+    assert(open_file(&worker->last_stdout_file_fd, worker->dir_path, "last_stdout", oflags) != -1);
+    assert(open_file(&worker->last_stderr_file_fd, worker->dir_path, "last_stderr", oflags) != -1);
+    
+    return 0;
+}
+
+// Adds (or finds) a worker in the store, and reads (or writes) its task.
+// Returns `-1` in case of failure, else 0.
+static int open_worker_store_slot(worker *worker, task *task, uint64_t taskid) {
+    const uint8_t *data;
+    uint32_t length;
+    uint64_t offset;
     
-    // Opens (or create) and read (or write) the `task` file.
-    assert(open_file(&tmp->task_file_fd, tmp->dir_path, "task", O_RDWR | O_CREAT) != -1);
-    off_t pos = lseek(tmp->task_file_fd, 0L, SEEK_END);
-    assert(pos != -1 && (pos != 0 || task != NULL));
-    assert(lseek(tmp->task_file_fd, 0L, SEEK_SET) != -1);
     if (task != NULL) {
-        assert(ftruncate(tmp->task_file_fd, 0) != -1);
+        assert(add_store_slot(&worker->store_slot, taskid) != -1);
         buffer buf = create_buffer();
-        assert(write_task(&buf, task, 1) != -1);
-        assert(write_buffer(tmp->task_file_fd, &buf) != -1);
+        int err = write_task(&buf, task, 1);
+        if (err != -1) {
+            err = write_store_extent(worker->store_slot, STORE_EXTENT_TASK, buf.data, buf.length);
+        }
         free(buf.data);
+        assert(err != -1);
+    } else {
+        assert(find_store_slot(&worker->store_slot, taskid) != -1);
+        assert(get_store_extent(worker->store_slot, STORE_EXTENT_TASK, &data, &length, &offset) != -1);
+        reader task_reader = create_memory_reader(data, length);
+        assert(read_task(&task_reader, &worker->task, 1) != -1);
+    }
+    
+    return 0;
+}
+
+int load_worker_results(worker *worker) {
+    if (worker->results_loaded) {
+        return 0;
+    }
+    
+    // Only the tasks created with a history have one.
+    if (worker->history.fd == -1 && open_history(&worker->history, worker->history_path, 0) == -1) {
+        assert(errno == ENOENT);
+        errno = 0;
+    }
+    
+    if (worker->store_slot != WORKER_NO_STORE_SLOT) {
+        assert(open_store_runs(worker) != -1);
+    } else if (access(worker->dir_path, F_OK) == -1) {
+        // The directory of a task of the journal is only created by its first execution (see `finish_execution`), it
+        // has no results until then (and the directory is never created here, which could bring a removed task back).
+        assert(errno == ENOENT);
+        errno = 0;
+        
+        return 0;
     } else {
-        assert(read_task(tmp->task_file_fd, &tmp->task, 1) != -1);
+        assert(open_worker_files(worker) != -1);
     }
     
-    // Opens and read the `runs` file.
-    assert(open_file(&tmp->runs_file_fd, tmp->dir_path, "runs", O_RDWR | O_CREAT) != -1);
-    pos = lseek(tmp->runs_file_fd, 0L, SEEK_END);
-    assert(pos != -1);
-    if (pos > 0) {
-        assert(lseek(tmp->runs_file_fd, 0L, SEEK_SET) != -1);
-        assert(read_run_array(tmp->runs_file_fd, &tmp->runs) != -1);
+    worker->results_loaded = 1;
+    
+    return 0;
+}
+
+int create_worker(worker **dest, task *task, const char *tasks_path, uint64_t taskid, int keep_history) {
+    worker *tmp = malloc(sizeof(worker));
+    assert(tmp);
+    
+    if (task != NULL) {
+        tmp->task = *task;
+    }
+    tmp->runs_map = NULL;
+    tmp->runs_map_size = 0;
+    tmp->runs_file_offset = 0;
+    tmp->runs_capacity = 0;
+    tmp->runs_start = 0;
+    tmp->runs_count = 0;
+    tmp->exec_argv = NULL;
+    tmp->dir_path = NULL;
+    tmp->store_slot = WORKER_NO_STORE_SLOT;
+    tmp->history_path = NULL;
+    tmp->history = create_history();
+    tmp->runs_file_fd = -1;
+    tmp->last_stdout_file_fd = -1;
+    tmp->last_stderr_file_fd = -1;
+    tmp->next_run_time = 0;
+    tmp->heap_index = 0;
+    tmp->busy = 0;
+    tmp->removed = 0;
+    tmp->references = 0;
+    tmp->results_loaded = 0;
+    tmp->next_job = NULL;
+    assert(pthread_mutex_init(&tmp->lock, NULL) == 0);
+    
+    if (is_store_opened()) {
+        assert(open_worker_store_slot(tmp, task, taskid) != -1);
+    } else {
+        assert(open_worker_directory(tmp, task, tasks_path, taskid) != -1);
     }
     
-    // Opens and read the `last_stdout` file.
-    assert(open_file(&tmp->last_stdout_file_fd, tmp->dir_path, "last_stdout", O_RDWR | O_CREAT) != -1);
-    pos = lseek(tmp->last_stdout_file_fd, 0L, SEEK_END);
-    assert(pos != -1);
-    if (pos > 0) {
-        assert(lseek(tmp->last_stdout_file_fd, 0L, SEEK_SET) != -1);
-        assert(read_string(tmp->last_stdout_file_fd, &tmp->last_stdout) != -1);
+    // The history is kept aside (the same way whether the task is in the store or in its own directory).
+    int length = snprintf(NULL, 0, "%s" HISTORY_DIRECTORY_NAME "/%llu", tasks_path, (unsigned long long)taskid);
+    tmp->history_path = malloc(length + 1);
+    assert(tmp->history_path);
+    snprintf(tmp->history_path, length + 1, "%s" HISTORY_DIRECTORY_NAME "/%llu", tasks_path,
+        (unsigned long long)taskid);
+    
+    if (task != NULL && keep_history) {
+        char history_directory_path[PATH_MAX];
+        assert(snprintf(history_directory_path, sizeof(history_directory_path), "%s" HISTORY_DIRECTORY_NAME "/",
+            tasks_path) < (int)sizeof(history_directory_path));
+        assert(create_directory(history_directory_path) != -1);
+        assert(open_history(&tmp->history, tmp->history_path, 1) != -1);
     }
     
-    // Opens and read the `last_stderr` file.
-    assert(open_file(&tmp->last_stderr_file_fd, tmp->dir_path, "last_stderr", O_RDWR | O_CREAT) != -1);
-    pos = lseek(tmp->last_stderr_file_fd, 0L, SEEK_END);
-    assert(pos != -1);
-    if (pos > 0) {
-        assert(lseek(tmp->last_stderr_file_fd, 0L, SEEK_SET) != -1);
-        assert(read_string(tmp->last_stderr_file_fd, &tmp->last_stderr) != -1);
+    // The results of an existing task are only loaded on first access (a new task has its results created right away,
+    // unless it is in the journal).
+    if (task != NULL && !is_journal_opened()) {
+        assert(load_worker_results(tmp) != -1);
     }
     
+    // Builds the arguments given to every execution of the task.
+    assert(create_exec_argv(&tmp->exec_argv, &tmp->task.commandline) != -1);
+    
     *dest = tmp;
     
     return 0;
 }
 
+// Describes a part of the workers loaded by a thread of `load_workers`.
+typedef struct load_job {
+    worker **workers;
+    const uint64_t *taskids;
+    uint64_t begin;
+    uint64_t end;
+    const char *tasks_path;
+    int err;
+} load_job;
+
+static void *load_main(void *arg) {
+    load_job *job = arg;
+    
+    for (uint64_t i = job->begin; i < job->end && job->err != -1; i++) {
+        job->err = create_worker(&job->workers[i], NULL, job->tasks_path, job->taskids[i], 0);
+    }
+    
+    return NULL;
+}
+
+int load_workers(worker **workers, const uint64_t *taskids, uint64_t count, const char *tasks_path) {
+    // Every thread loads a contiguous part of the tasks (small parts are not worth a thread).
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t threads_count = cores > 0 ? (uint64_t)cores : 1;
+    if (threads_count > (count + LOAD_MIN_TASKS_PER_THREAD - 1) / LOAD_MIN_TASKS_PER_THREAD) {
+        threads_count = (count + LOAD_MIN_TASKS_PER_THREAD - 1) / LOAD_MIN_TASKS_PER_THREAD;
+    }
+    
+    if (threads_count <= 1) {
+        load_job job = { workers, taskids, 0, count, tasks_path, 0 };
+        load_main(&job);
+        
+        return job.err;
+    }
+    
+    load_job jobs[threads_count];
+    pthread_t threads[threads_count];
+    int err = 0;
+    uint64_t started = 0;
+    for (; started < threads_count; started++) {
+        jobs[started] = (load_job) {
+            workers, taskids, count * started / threads_count, count * (started + 1) / threads_count, tasks_path, 0
+        };
+        
+        if (pthread_create(&threads[started], NULL, load_main, &jobs[started]) != 0) {
+            err = -1;
+            break;
+        }
+    }
+    
+    for (uint64_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        err = jobs[i].err == -1 ? -1 : err;
+    }
+    
+    return err;
+}
+
 int free_worker(worker *worker) {
     free_task(&worker->task);
-    array_free(worker->runs);
-    free_string(&worker->last_stdout);
-    free_string(&worker->last_stderr);
+    free(worker->exec_argv);
     free(worker->dir_path);
-    assert(close(worker->task_file_fd) != -1);
-    assert(close(worker->runs_file_fd) != -1);
-    assert(close(worker->last_stdout_file_fd) != -1);
-    assert(close(worker->last_stderr_file_fd) != -1);
+    free(worker->history_path);
+    close_history(&worker->history);
+    
+    if (worker->store_slot != WORKER_NO_STORE_SLOT) {
+        // The runs are mapped with the whole store.
+        release_store_slot(worker->store_slot);
+    } else {
+        if (worker->runs_map != NULL) {
+            munmap(worker->runs_map, worker->runs_map_size);
+        }
+        
+        int fds[] = { worker->runs_file_fd, worker->last_stdout_file_fd, worker->last_stderr_file_fd };
+        for (uint32_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+            assert(fds[i] == -1 || close(fds[i]) != -1);
+        }
+    }
+    
+    // The files of a removed task of the journal are deleted in the background once nothing uses them anymore.
+    if (worker->removed && worker->store_slot == WORKER_NO_STORE_SLOT && is_journal_opened()) {
+        discard_task_files(worker->task.taskid);
+    }
+    
+    assert(pthread_mutex_destroy(&worker->lock) == 0);
     free(worker);
     
     return 0;
 }
 
-int is_worker_running(uint64_t taskid) {
-    int alive = 0;
+// Removes the `NULL` holes of `g_workers` (and updates the index), must be called with the write lock held.
+static int compact_workers() {
+    uint64_t size = 0;
     
-    for (uint64_t i = 0; i < array_size(g_running_taskids); i++) {
-        if (g_running_taskids[i] == taskid) {
-            alive = 1;
-            break;
+    for (uint64_t i = 0; i < array_size(g_workers); i++) {
+        if (g_workers[i] != NULL) {
+            g_workers[size] = g_workers[i];
+            assert(taskmap_put(&g_workers_index, g_workers[size]->task.taskid, size) != -1);
+            size++;
         }
     }
     
-    return alive;
+    while (array_size(g_workers) > size) {
+        assert(array_pop(g_workers) != -1);
+    }
+    
+    g_workers_holes = 0;
+    
+    return 0;
 }
 
-int remove_worker(uint64_t taskid) {
-    for (uint64_t i = 0; i < array_size(g_running_taskids); i++) {
-        if (g_running_taskids[i] == taskid) {
-            array_remove(g_running_taskids, i);
-            break;
+// Records a change of the running workers and bumps `g_workers_seq` (the write lock must be held), the oldest half of
+// the changes being forgotten once they outnumber twice the running workers.
+// Returns `-1` in case of failure, else 0.
+static int record_worker_change(uint64_t taskid, uint8_t removed) {
+    if (g_workers_seq == 0) {
+        struct timespec now;
+        assert(clock_gettime(CLOCK_REALTIME, &now) != -1);
+        g_workers_seq = (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+        g_workers_changes_start = g_workers_seq;
+    }
+    
+    uint64_t count = array_size(g_workers_changes);
+    if (count >= WORKER_CHANGES_MIN_COUNT && count >= 2 * (array_size(g_workers) - g_workers_holes)) {
+        uint64_t forgotten = count / 2;
+        memmove(g_workers_changes, g_workers_changes + forgotten, (count - forgotten) * sizeof(worker_change));
+        while (array_size(g_workers_changes) > count - forgotten) {
+            assert(array_pop(g_workers_changes) != -1);
         }
+        g_workers_changes_start += forgotten;
     }
     
+    worker_change change = { .taskid = taskid, .removed = removed };
+    assert(array_push(g_workers_changes, change) != -1);
+    g_workers_seq++;
+    
     return 0;
 }
 
-worker *get_worker(uint64_t taskid) {
-    for (uint64_t i = 0; i < array_size(g_workers); i++) {
-        if (g_workers[i]->task.taskid == taskid) {
-            return g_workers[i];
-        }
+int add_worker(worker *worker) {
+    pthread_rwlock_wrlock(&g_workers_lock);
+    
+    // The worker is only indexed once in the array, and is taken out of both if its addition cannot be completed (so
+    // that the index never refers to a slot without a worker).
+    int pushed = array_push(g_workers, worker) != -1;
+    int indexed = pushed && taskmap_put(&g_workers_index, worker->task.taskid, array_size(g_workers) - 1) != -1;
+    int err = indexed ? record_worker_change(worker->task.taskid, 0) : -1;
+    if (err == -1 && indexed) {
+        taskmap_remove(&g_workers_index, worker->task.taskid);
+    }
+    if (err == -1 && pushed) {
+        array_pop(g_workers);
     }
     
-    return NULL;
+    pthread_rwlock_unlock(&g_workers_lock);
+    
+    return err;
 }
 
-void cleanup_worker(void *cleanup_handle_ptr) {
-    worker_cleanup_handle *cleanup_handle = cleanup_handle_ptr;
-    pthread_mutex_unlock(cleanup_handle->mutex);
-    free_worker(cleanup_handle->worker);
+int is_worker_running(uint64_t taskid) {
+    pthread_rwlock_rdlock(&g_workers_lock);
+    int alive = taskmap_get(&g_workers_index, taskid, NULL);
+    pthread_rwlock_unlock(&g_workers_lock);
     
-    log("worker thread shutting down...\n");
+    return alive;
 }
 
-// Make the thread sleep until the next minute approximativaly.
-// The sleep can be cancelled by a `pthread_cancel` (can happen if a request to remove this task is received or if
-// saturnd is exiting).
-void sleep_worker(pthread_mutex_t *lock, pthread_cond_t *cond) {
-    struct timespec now_time;
-    clock_gettime(CLOCK_REALTIME, &now_time);
-    struct timespec duration = {now_time.tv_sec + 60, 0}; // NOLINT
+int remove_worker(uint64_t taskid) {
+    int err = 1;
+    uint64_t index;
+    
+    pthread_rwlock_wrlock(&g_workers_lock);
+    
+    if (taskmap_get(&g_workers_index, taskid, &index)) {
+        taskmap_remove(&g_workers_index, taskid);
+        g_workers[index] = NULL;
+        g_workers_holes++;
+        
+        // Compacts once half of the array is made of holes, so that removals stay constant-time amortized.
+        err = g_workers_holes * 2 > array_size(g_workers) ? compact_workers() : 0;
+        err = err != -1 ? record_worker_change(taskid, 1) : err;
+    }
+    
+    pthread_rwlock_unlock(&g_workers_lock);
     
-    pthread_mutex_lock(lock);
-    pthread_cond_timedwait(cond, lock, &duration);
-    pthread_mutex_unlock(lock);
+    return err;
 }
 
-void *worker_main(void *worker_arg) {
-    worker *worker_to_handle = (worker *)worker_arg;
-    timing timing = worker_to_handle->task.timing;
-    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
-    worker_cleanup_handle cleanup_handle = { .worker = worker_to_handle, .mutex = &lock };
+worker *acquire_worker(uint64_t taskid) {
+    worker *result = NULL;
+    uint64_t index;
     
-    // Push the cleanup handler (that will happen once the thread is going to end).
-    pthread_cleanup_push(cleanup_worker, &cleanup_handle); // NOLINT
+    pthread_rwlock_rdlock(&g_workers_lock);
     
-    while (1) {
-        // Checks if the task has to run this minute, if not, sleep until the next minute.
-        uint64_t execution_time = time(NULL);
-        time_t timestamp = (time_t)execution_time;
-        struct tm time_info = *localtime(&timestamp);
-        if (((timing.daysofweek >> time_info.tm_wday) % 2 == 0) ||
-            ((timing.hours >> time_info.tm_hour) % 2 == 0) ||
-            ((timing.minutes >> time_info.tm_min) % 2 == 0)) {
-            sleep_worker(&lock, &cond);
-        }
-        
-        if (!is_worker_running(worker_to_handle->task.taskid)) {
-            break;
-        }
-        
-        // Create self-pipes to extract `stdout` and `stderr` from the upcoming `exec` call.
-        int stdout_pipe[2];
-        fatal_assert(pipe(stdout_pipe) != -1);
-        int stderr_pipe[2];
-        fatal_assert(pipe(stderr_pipe) != -1);
-    
-        pid_t fork_pid = fork();
-        fatal_assert(fork_pid != -1);
+    // The reference is taken before the lock is released (a worker is only freed once it is removed).
+    if (taskmap_get(&g_workers_index, taskid, &index)) {
+        result = g_workers[index];
+        __atomic_add_fetch(&result->references, 1, __ATOMIC_ACQ_REL);
+    }
+    
+    pthread_rwlock_unlock(&g_workers_lock);
+    
+    return result;
+}
+
+int list_worker_changes(uint64_t since, worker ***added, uint64_t **removed) {
+    *added = NULL;
+    *removed = NULL;
+    
+    if (since < g_workers_changes_start || since > g_workers_seq) {
+        return 1;
+    }
+    
+    // The changes are found right away from their sequence numbers, an added worker being skipped if it was removed
+    // since then (its removal follows).
+    for (uint64_t i = since - g_workers_changes_start; i < array_size(g_workers_changes); i++) {
+        const worker_change *change = &g_workers_changes[i];
+        uint64_t index;
+        int err = 0;
         
-        if (fork_pid == 0) {
-            fatal_assert(close(stdout_pipe[0]) != -1);
-            fatal_assert(dup2(stdout_pipe[1], STDOUT_FILENO) != -1);
-            fatal_assert(close(stdout_pipe[1]) != -1);
-            fatal_assert(close(stderr_pipe[0]) != -1);
-            fatal_assert(dup2(stderr_pipe[1], STDERR_FILENO) != -1);
-            fatal_assert(close(stderr_pipe[1]) != -1);
-            
-            // Creates the `argv` array for the upcoming `exec` call.
-            char *argv[worker_to_handle->task.commandline.argc + 1];
-            for (uint32_t i = 0; i < worker_to_handle->task.commandline.argc; i++) {
-                char *arg = NULL;
-                fatal_assert(cstring_from_string(&arg, worker_to_handle->task.commandline.argv) != -1);
-                argv[i] = arg;
-            }
-            argv[worker_to_handle->task.commandline.argc] = NULL;
-            
-            // Execute the command in the fork.
-            execvp(argv[0], argv);
-            perror("execve");
-            exit(EXIT_FAILURE);
+        if (change->removed) {
+            err = array_push(*removed, change->taskid);
+        } else if (taskmap_get(&g_workers_index, change->taskid, &index)) {
+            err = array_push(*added, g_workers[index]);
         }
         
-        fatal_assert(close(stdout_pipe[1]) != -1);
-        fatal_assert(close(stderr_pipe[1]) != -1);
-        
-        char buf[PIPE_BUF] = { 0 };
-        
-        // Read the last stdout in a buffer.
-        char *stdout_buf = NULL;
-        while (read(stdout_pipe[0], buf, sizeof(buf)) != 0) {
-            for (uint32_t i = 0; i < PIPE_BUF; i++) {
-                fatal_assert(array_push(stdout_buf, buf[i]) != -1);
-                
-                if (buf[i] == 0) {
-                    break;
-                }
-            }
-            
-            void *tmp = memset(buf, 0, sizeof(buf));
-            fatal_assert(tmp);
+        if (err == -1) {
+            array_free(*added);
+            array_free(*removed);
+            return -1;
         }
-        
-        // Read the last stderr in a buffer.
-        char *stderr_buf = NULL;
-        while (read(stderr_pipe[0], buf, sizeof(buf)) != 0) {
-            for (uint32_t i = 0; i < PIPE_BUF; i++) {
-                fatal_assert(array_push(stderr_buf, buf[i]) != -1);
-                
-                if (buf[i] == 0) {
-                    break;
-                }
-            }
-            
-            char null_char = 0;
-            fatal_assert(array_push(stderr_buf, null_char) != -1);
-            
-            void *tmp = memset(buf, 0, sizeof(buf));
-            fatal_assert(tmp);
+    }
+    
+    return 0;
+}
+
+void cleanup_workers() {
+    pthread_rwlock_wrlock(&g_workers_lock);
+    
+    for (uint64_t i = 0; i < array_size(g_workers); i++) {
+        if (g_workers[i] != NULL) {
+            free_worker(g_workers[i]);
         }
+    }
     
-        fatal_assert(close(stdout_pipe[0]) != -1);
-        fatal_assert(close(stderr_pipe[0]) != -1);
-        
-        int status;
-        fatal_assert(waitpid(fork_pid, &status, 0) != -1);
-        
-        if (stdout_buf != NULL) {
-            // Saves the last stdout.
-            if (worker_to_handle->last_stdout.length > 0) {
-                free(worker_to_handle->last_stdout.data);
-            }
-            fatal_assert(string_from_cstring(&worker_to_handle->last_stdout, stdout_buf) != -1);
-            array_free(stdout_buf);
-    
-            // Writes to the `last_stdout` file.
-            fatal_assert(lseek(worker_to_handle->last_stdout_file_fd, 0L, SEEK_SET) != -1);
-            fatal_assert(ftruncate(worker_to_handle->last_stdout_file_fd, 0) != -1);
-            buffer wbuf = create_buffer();
-            fatal_assert(write_string(&wbuf, &worker_to_handle->last_stdout) != -1);
-            fatal_assert(write_buffer(worker_to_handle->last_stdout_file_fd, &wbuf) != -1);
-            free(wbuf.data);
+    array_free(g_workers);
+    free_taskmap(&g_workers_index);
+    g_workers_holes = 0;
+    array_free(g_workers_changes);
+    
+    pthread_rwlock_unlock(&g_workers_lock);
+}
+
+// Opens a pipe whose ends are closed on `exec` (so that they are not inherited by the tasks spawned concurrently).
+// Returns `-1` in case of failure, else 0.
+static int open_pipe(int fds[2]) {
+#ifdef __linux__
+    assert(pipe2(fds, O_CLOEXEC) != -1);
+#else
+    assert(pipe(fds) != -1);
+    if (fcntl(fds[0], F_SETFD, FD_CLOEXEC) == -1 || fcntl(fds[1], F_SETFD, FD_CLOEXEC) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+#endif
+    
+    return 0;
+}
+
+// Attributes of the spawned tasks (they must not inherit the signals blocked by the daemon's threads).
+static posix_spawnattr_t g_spawn_attr;
+static pthread_once_t g_spawn_attr_once = PTHREAD_ONCE_INIT;
+
+static void init_spawn_attr() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_init(&g_spawn_attr);
+    posix_spawnattr_setsigmask(&g_spawn_attr, &mask);
+    
+    // The daemon ignores `SIGPIPE` (to survive clients leaving in the middle of a reply), the tasks must not.
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&g_spawn_attr, &defaults);
+    posix_spawnattr_setflags(&g_spawn_attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+}
+
+// Creates the capture of the stream read from `fd`.
+static capture create_capture(int fd) {
+    capture capture = {
+        .fd = fd,
+        .data = create_buffer(),
+        .tail_position = g_output_cap / 2,
+        .total = 0
+    };
+    
+    return capture;
+}
+
+// Adds bytes read from a stream to its capture (once the cap is reached, only the head and the tail are kept).
+// Returns `-1` in case of failure, else 0.
+static int write_capture(capture *capture, const uint8_t *bytes, uint32_t length) {
+    capture->total += length;
+    
+    // Appends the bytes while the stream fits in the cap.
+    if (capture->data.length < g_output_cap) {
+        uint32_t count = g_output_cap - capture->data.length < length ? g_output_cap - capture->data.length : length;
+        assert(write_bytes(&capture->data, bytes, count) != -1);
+        bytes += count;
+        length -= count;
+    }
+    
+    // Then, only the latest bytes are kept in the ring following the head.
+    uint32_t head_size = g_output_cap / 2;
+    uint32_t tail_size = g_output_cap - head_size;
+    if (length > tail_size) {
+        bytes += length - tail_size;
+        length = tail_size;
+    }
+    
+    while (length > 0) {
+        uint32_t count = g_output_cap - capture->tail_position < length ? g_output_cap - capture->tail_position : length;
+        assert(memcpy(capture->data.data + capture->tail_position, bytes, count) != NULL);
+        capture->tail_position += count;
+        if (capture->tail_position == g_output_cap) {
+            capture->tail_position = head_size;
         }
+        bytes += count;
+        length -= count;
+    }
+    
+    return 0;
+}
+
+// Creates a string from a capture (its head and its tail separated by the number of bytes dropped in-between, if the
+// stream outgrew the cap), the capture's data is moved to the string when possible.
+// Returns `-1` in case of failure, else 0.
+static int string_from_capture(string *dest, capture *capture) {
+    if (capture->total <= g_output_cap) {
+        dest->length = capture->data.length;
+        dest->data = capture->data.data;
+        capture->data = create_buffer();
         
-        if (stderr_buf != NULL) {
-            // Saves the last stderr.
-            if (worker_to_handle->last_stderr.length > 0) {
-                free(worker_to_handle->last_stderr.data);
-            }
-            fatal_assert(string_from_cstring(&worker_to_handle->last_stderr, stderr_buf) != -1);
-            array_free(stderr_buf);
-    
-            // Writes to the `last_stderr` file.
-            fatal_assert(lseek(worker_to_handle->last_stderr_file_fd, 0L, SEEK_SET) != -1);
-            fatal_assert(ftruncate(worker_to_handle->last_stderr_file_fd, 0) != -1);
-            buffer wbuf = create_buffer();
-            fatal_assert(write_string(&wbuf, &worker_to_handle->last_stderr) != -1);
-            fatal_assert(write_buffer(worker_to_handle->last_stderr_file_fd, &wbuf) != -1);
-            free(wbuf.data);
+        return 0;
+    }
+    
+    uint32_t head_size = g_output_cap / 2;
+    char marker[64];
+    int marker_length = snprintf(marker, sizeof(marker), "\n[... %llu bytes truncated ...]\n",
+        (unsigned long long)(capture->total - g_output_cap));
+    assert(marker_length > 0);
+    
+    buffer buf = create_buffer();
+    int err = buffer_reserve(&buf, g_output_cap + (uint32_t)marker_length);
+    err = err != -1 ? write_bytes(&buf, capture->data.data, head_size) : err;
+    err = err != -1 ? write_bytes(&buf, marker, (uint32_t)marker_length) : err;
+    err = err != -1 ? write_bytes(&buf, capture->data.data + capture->tail_position,
+        g_output_cap - capture->tail_position) : err;
+    err = err != -1 ? write_bytes(&buf, capture->data.data + head_size, capture->tail_position - head_size) : err;
+    if (err == -1) {
+        free(buf.data);
+        return -1;
+    }
+    
+    dest->length = buf.length;
+    dest->data = buf.data;
+    
+    return 0;
+}
+
+// Replaces an output (0 for `stdout`, 1 for `stderr`) of a worker by the one of its last run in its file or in the
+// store, it is not kept in memory (the worker's lock must be held).
+// Returns `-1` in case of failure, else 0.
+static int save_output(worker *worker, uint32_t stream, const string *output) {
+    if (worker->store_slot != WORKER_NO_STORE_SLOT) {
+        return write_store_extent(worker->store_slot, stream == 0 ? STORE_EXTENT_STDOUT : STORE_EXTENT_STDERR,
+            output->data, output->length);
+    }
+    
+    // The output is written in a new file which then replaces the previous one, so that a reply still streaming the
+    // previous one (from its own descriptor) is not affected, and so that a crash cannot leave a partial output.
+    const char *file_name = stream == 0 ? "last_stdout" : "last_stderr";
+    char file_path[PATH_MAX];
+    char new_file_path[PATH_MAX];
+    assert(snprintf(file_path, sizeof(file_path), "%s%s", worker->dir_path, file_name) < (int)sizeof(file_path));
+    assert(snprintf(new_file_path, sizeof(new_file_path), "%s%s" OUTPUT_FILE_NEW_SUFFIX, worker->dir_path,
+        file_name) < (int)sizeof(new_file_path));
+    
+    // The directory only disappears once the task is removed, in which case its output is not needed anymore (the file
+    // is not inherited by the tasks spawned meanwhile by the other executors).
+    int fd = open(new_file_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd == -1 && errno == ENOENT) {
+        errno = 0;
+        return 0;
+    }
+    assert(fd != -1);
+    
+    buffer buf = create_buffer();
+    int err = write_string(&buf, output);
+    err = err != -1 ? write_buffer(fd, &buf) : err;
+    err = err != -1 ? rename(new_file_path, file_path) : err;
+    free(buf.data);
+    
+    if (err == -1) {
+        close(fd);
+        unlink(new_file_path);
+        return -1;
+    }
+    
+    int *file_fd = stream == 0 ? &worker->last_stdout_file_fd : &worker->last_stderr_file_fd;
+    close(*file_fd);
+    *file_fd = fd;
+    
+    return 0;
+}
+
+int start_execution(execution *dest, worker *worker, uint64_t execution_time) {
+    // Create self-pipes to extract `stdout` and `stderr` from the upcoming execution.
+    int stdout_pipe[2];
+    assert(open_pipe(stdout_pipe) != -1);
+    int stderr_pipe[2];
+    if (open_pipe(stderr_pipe) == -1) {
+        close(stdout_pipe[0]);
+        close(stdout_pipe[1]);
+        return -1;
+    }
+    
+    // The outputs are read whenever they are available (by the thread supervising the executions).
+    dest->worker = worker;
+    dest->pid = -1;
+    dest->time = execution_time;
+    dest->status = 0;
+    dest->exited = 0;
+    dest->captures[0] = create_capture(stdout_pipe[0]);
+    dest->captures[1] = create_capture(stderr_pipe[0]);
+    
+    int err = 0;
+    for (uint32_t i = 0; i < 2; i++) {
+        // Preallocates the beginning of the capture, it only grows for bigger outputs (up to the cap).
+        uint32_t capacity = g_output_cap < CAPTURE_INITIAL_CAPACITY ? g_output_cap : CAPTURE_INITIAL_CAPACITY;
+        if (fcntl(dest->captures[i].fd, F_SETFL, O_NONBLOCK) == -1 ||
+            buffer_reserve(&dest->captures[i].data, capacity) == -1) {
+            err = -1;
         }
-        
-        // Saves the last run.
-        run cur_run = {
-            .exitcode = WIFEXITED(status) ? WEXITSTATUS(status) : 0xFFFF,
-            .time = execution_time
-        };
-        array_push(worker_to_handle->runs, cur_run);
-    
-        // Writes to the `runs` file.
-        fatal_assert(lseek(worker_to_handle->runs_file_fd, 0L, SEEK_SET) != -1);
-        fatal_assert(ftruncate(worker_to_handle->runs_file_fd, 0) != -1);
-        buffer wbuf = create_buffer();
-        fatal_assert(write_run_array(&wbuf, worker_to_handle->runs) != -1);
-        fatal_assert(write_buffer(worker_to_handle->runs_file_fd, &wbuf) != -1);
-        free(wbuf.data);
-        
-        // Now that the task has been handled, we can sleep until the next minute.
-        sleep_worker(&lock, &cond);
+    }
+    
+    if (err == -1) {
+        free_execution(dest);
+        close(stdout_pipe[1]);
+        close(stderr_pipe[1]);
+        return -1;
+    }
+    
+    // Spawns the command without copying the daemon (its threads and its heap), the pipes are closed in the child on
+    // `exec` except for the ends duplicated over its `stdout` and `stderr`.
+    posix_spawn_file_actions_t actions;
+    int spawn_err = worker->exec_argv[0] == NULL ? ENOENT : pthread_once(&g_spawn_attr_once, init_spawn_attr);
+    spawn_err = spawn_err == 0 ? posix_spawn_file_actions_init(&actions) : spawn_err;
+    if (spawn_err == 0) {
+        // These are the only allocations of the spawn path (the arguments are cached on the worker).
+        spawn_err = posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], STDOUT_FILENO);
+        spawn_err = spawn_err == 0 ? posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], STDERR_FILENO) : spawn_err;
+        spawn_err = spawn_err == 0 ? posix_spawnp(&dest->pid, worker->exec_argv[0], &actions, &g_spawn_attr,
+            worker->exec_argv, environ) : spawn_err;
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    
+    // A command that cannot be executed is saved as a failed run (like a child failing its `exec`).
+    if (spawn_err != 0) {
+        dest->pid = -1;
+        dest->exited = 1;
+        dprintf(stderr_pipe[1], "execve: %s\n", strerror(spawn_err));
+    }
+    
+    close(stdout_pipe[1]);
+    close(stderr_pipe[1]);
+    
+    return 0;
+}
+
+int read_execution_output(execution *execution, uint32_t stream) {
+    capture *capture = &execution->captures[stream];
+    uint8_t chunk[CAPTURE_CHUNK_SIZE];
+    
+    ssize_t length = read(capture->fd, chunk, sizeof(chunk));
+    if (length == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    
+    if (length > 0) {
+        return write_capture(capture, chunk, (uint32_t)length);
+    }
+    
+    // The stream is closed (or could not be read anymore, in which case the task will get a `SIGPIPE`).
+    close(capture->fd);
+    capture->fd = -1;
+    
+    return length == 0 ? 1 : -1;
+}
+
+int finish_execution(execution *execution) {
+    string outputs[2] = { 0 };
+    int err = 0;
+    for (uint32_t i = 0; err != -1 && i < 2; i++) {
+        err = string_from_capture(&outputs[i], &execution->captures[i]);
+    }
+    free_execution(execution);
+    if (err == -1) {
+        free(outputs[0].data);
+        free(outputs[1].data);
+        return -1;
+    }
+    
+    worker *worker = execution->worker;
+    pthread_mutex_lock(&worker->lock);
+    
+    // The results of a task removed while it was running are dropped (saving them would recreate its directory, which
+    // would bring the task back on the next start).
+    if (__atomic_load_n(&worker->removed, __ATOMIC_ACQUIRE)) {
+        goto cleanup;
+    }
+    
+    // The directory of a task of the journal is created with its first results.
+    if (!worker->results_loaded && worker->store_slot == WORKER_NO_STORE_SLOT) {
+        fatal_assert(create_directory(worker->dir_path) != -1);
+    }
+    fatal_assert(load_worker_results(worker) != -1);
+    
+    // Saves the last stdout and the last stderr (even if empty, as they are the ones of the last run).
+    fatal_assert(save_output(worker, 0, &outputs[0]) != -1);
+    fatal_assert(save_output(worker, 1, &outputs[1]) != -1);
+    
+    // Saves the last run.
+    int status = execution->status;
+    run cur_run = {
+        .exitcode = execution->pid == -1 ? EXIT_FAILURE : WIFEXITED(status) ? WEXITSTATUS(status) : 0xFFFF,
+        .time = execution->time
+    };
+    
+    // Appends to the `runs` file.
+    fatal_assert(append_run(worker, &cur_run) != -1);
+    
+    // Archives both outputs in the history of the task (if it has one).
+    if (worker->history.fd != -1) {
+        fatal_assert(append_history(&worker->history, execution->time, outputs) != -1);
     }
     
     goto cleanup;
     
     error:
-    log("error in worker thread!\n");
+    err = -1;
     
     cleanup:
-    pthread_cleanup_pop(1); // NOLINT
+    pthread_mutex_unlock(&worker->lock);
+    free(outputs[0].data);
+    free(outputs[1].data);
     
-    return NULL;
+    return err;
+}
+
+void free_execution(execution *execution) {
+    for (uint32_t i = 0; i < 2; i++) {
+        if (execution->captures[i].fd != -1) {
+            close(execution->captures[i].fd);
+            execution->captures[i].fd = -1;
+        }
+        free(execution->captures[i].data.data);
+        execution->captures[i].data = create_buffer();
+    }
 }
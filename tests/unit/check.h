@@ -0,0 +1,25 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Minimal checks for the unit tests (in tests/unit/): a failed check is reported with its location and the test
+// carries on, then exits with a failure.
+
+// Number of checks which failed so far.
+static unsigned int g_failed_checks = 0;
+
+// Checks a condition, reporting it if it does not hold.
+#define check(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            g_failed_checks++; \
+        } \
+    } while (0)
+
+// Returns the exit code of a test (a failure if any check failed).
+#define checks_exit_code() (g_failed_checks == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+#endif /* CHECK_H. */
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/fcntl.h>
+#include <sy5/lz.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+#include <sy5/history.h>
+#include "check.h"
+
+// Tests the codec and the output history: outputs round trip across the boundaries of blocks (compressed or stored as
+// is), a partial record left by a crash is cut off when the history is opened, a record with corrupted lengths is
+// rejected, and runs are found by index and by time at the edges of the history.
+
+// Maximum number of bytes of an output in a block (as in src/history.c).
+#define BLOCK_SIZE (64 * 1024)
+
+// Size of the header of a history and offset of the lengths of the outputs in a record (as in src/history.c).
+#define HEADER_SIZE 8
+#define RECORD_LENGTHS_OFFSET 8
+
+static char g_history_path[] = "/tmp/saturnd-test-history-XXXXXX";
+
+// Kinds of contents of the outputs.
+typedef enum content {
+    CONTENT_ZEROS,
+    CONTENT_LOG,
+    CONTENT_RANDOM,
+    CONTENT_MIXED
+} content;
+
+// Fills an output with bytes which compress to nothing, lines of a log, bytes which do not compress or a mix of the
+// last two (a block of each).
+static void fill_output(uint8_t *output, uint32_t length, content content) {
+    for (uint32_t i = 0; i < length; i++) {
+        if (content == CONTENT_ZEROS) {
+            output[i] = 0;
+        } else if (content == CONTENT_LOG || (content == CONTENT_MIXED && i / BLOCK_SIZE % 2 == 0)) {
+            output[i] = "[run] processed 42 items\n"[i % 25] + (i % 997 == 0);
+        } else {
+            output[i] = (uint8_t)rand();
+        }
+    }
+}
+
+static void test_lz_round_trips() {
+    uint32_t lengths[] = { 0, 1, 5, 12, 13, 17, 255, 4096, BLOCK_SIZE - 1, BLOCK_SIZE, BLOCK_SIZE + 1 };
+    uint8_t *data = malloc(BLOCK_SIZE + 1);
+    uint8_t *compressed = malloc(lz_compress_bound(BLOCK_SIZE + 1));
+    uint8_t *decompressed = malloc(BLOCK_SIZE + 2);
+    check(data && compressed && decompressed);
+    
+    for (content content = CONTENT_ZEROS; content <= CONTENT_RANDOM; content++) {
+        for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+            fill_output(data, lengths[i], content);
+            uint32_t compressed_length = lz_compress(data, lengths[i], compressed);
+            check(compressed_length <= lz_compress_bound(lengths[i]));
+            check((uint64_t)lengths[i] <= (uint64_t)compressed_length * LZ_MAX_RATIO);
+            
+            check(lz_decompress(compressed, compressed_length, decompressed, lengths[i]) == 0);
+            check(memcmp(decompressed, data, lengths[i]) == 0);
+            
+            // The data must decompress to exactly the length given.
+            check(lz_decompress(compressed, compressed_length, decompressed, lengths[i] + 1) == -1);
+            if (lengths[i] > 0) {
+                check(lz_decompress(compressed, compressed_length, decompressed, lengths[i] - 1) == -1);
+            }
+        }
+    }
+    
+    free(data);
+    free(compressed);
+    free(decompressed);
+}
+
+// Appends a run whose outputs are `lengths[0]` and `lengths[1]` bytes of a content, kept in `outputs` to be checked.
+static void append_run(history *history, uint64_t time, const uint32_t lengths[2], content content, string outputs[2]) {
+    for (uint32_t stream = 0; stream < 2; stream++) {
+        outputs[stream].length = lengths[stream];
+        outputs[stream].data = malloc(lengths[stream] + 1);
+        check(outputs[stream].data != NULL);
+        fill_output(outputs[stream].data, lengths[stream], content);
+    }
+    
+    check(append_history(history, time, outputs) != -1);
+}
+
+static void check_run(const history *history, uint64_t run, const string outputs[2]) {
+    for (uint32_t stream = 0; stream < 2; stream++) {
+        string output = { 0 };
+        check(read_history_output(history, run, stream, &output) != -1);
+        check(output.length == outputs[stream].length);
+        check(output.length != outputs[stream].length || memcmp(output.data, outputs[stream].data, output.length) == 0);
+        free(output.data);
+    }
+}
+
+static off_t history_size() {
+    struct stat stats;
+    
+    return stat(g_history_path, &stats) == -1 ? -1 : stats.st_size;
+}
+
+static void test_round_trips() {
+    uint32_t lengths[][2] = {
+        { 0, 0 }, { 1, 0 }, { BLOCK_SIZE - 1, 3 }, { BLOCK_SIZE, BLOCK_SIZE + 1 },
+        { 3 * BLOCK_SIZE + 7, 2 * BLOCK_SIZE }
+    };
+    uint64_t count = sizeof(lengths) / sizeof(lengths[0]);
+    string outputs[4 * sizeof(lengths) / sizeof(lengths[0])][2];
+    
+    history history;
+    check(open_history(&history, g_history_path, 1) != -1);
+    for (content content = CONTENT_ZEROS; content <= CONTENT_MIXED; content++) {
+        for (uint64_t i = 0; i < count; i++) {
+            append_run(&history, content * count + i, lengths[i], content, outputs[content * count + i]);
+        }
+    }
+    
+    // The outputs are read back from the history, then from the history opened again.
+    for (uint32_t pass = 0; pass < 2; pass++) {
+        check(array_size(history.runs) == 4 * count);
+        for (uint64_t run = 0; run < 4 * count && run < array_size(history.runs); run++) {
+            check(history.runs[run].time == run);
+            check_run(&history, run, outputs[run]);
+        }
+        
+        close_history(&history);
+        check(open_history(&history, g_history_path, 0) != -1);
+    }
+    
+    // Random bytes are stored as is (so the history is not smaller than them).
+    check(history_size() > 4 * BLOCK_SIZE);
+    close_history(&history);
+    
+    for (uint64_t run = 0; run < 4 * count; run++) {
+        free(outputs[run][0].data);
+        free(outputs[run][1].data);
+    }
+}
+
+static void test_truncated_records() {
+    uint32_t lengths[2] = { BLOCK_SIZE + 100, 10 };
+    string outputs[3][2];
+    
+    check(truncate(g_history_path, 0) != -1);
+    history history;
+    check(open_history(&history, g_history_path, 0) != -1);
+    append_run(&history, 1, lengths, CONTENT_LOG, outputs[0]);
+    off_t first_end = history_size();
+    append_run(&history, 2, lengths, CONTENT_RANDOM, outputs[1]);
+    off_t second_end = history_size();
+    close_history(&history);
+    
+    // A record cut in its blocks, then in its header, is cut off (and the runs before it are kept).
+    off_t cuts[] = { second_end - 1, first_end + 5, first_end };
+    for (uint32_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+        check(truncate(g_history_path, cuts[i]) != -1);
+        check(open_history(&history, g_history_path, 0) != -1);
+        check(array_size(history.runs) == 1 && history_size() == first_end);
+        check_run(&history, 0, outputs[0]);
+        close_history(&history);
+    }
+    
+    // The next run is appended right after the last complete record.
+    check(open_history(&history, g_history_path, 0) != -1);
+    append_run(&history, 3, lengths, CONTENT_MIXED, outputs[2]);
+    close_history(&history);
+    check(open_history(&history, g_history_path, 0) != -1);
+    check(array_size(history.runs) == 2);
+    check_run(&history, 0, outputs[0]);
+    check_run(&history, 1, outputs[2]);
+    close_history(&history);
+    
+    for (uint32_t run = 0; run < 3; run++) {
+        free(outputs[run][0].data);
+        free(outputs[run][1].data);
+    }
+}
+
+static void test_corrupted_lengths() {
+    uint32_t lengths[2] = { 100, 0 };
+    string outputs[2];
+    
+    check(truncate(g_history_path, 0) != -1);
+    history history;
+    check(open_history(&history, g_history_path, 0) != -1);
+    append_run(&history, 1, lengths, CONTENT_ZEROS, outputs);
+    
+    // An output far longer than its blocks can hold (here wrapping the size of its allocation around) is rejected before
+    // it is allocated.
+    const uint8_t corrupted[] = { 0xff, 0xff, 0xff, 0xff };
+    int fd = open(g_history_path, O_WRONLY);
+    check(fd != -1);
+    check(pwrite(fd, corrupted, sizeof(corrupted), HEADER_SIZE + RECORD_LENGTHS_OFFSET) == sizeof(corrupted));
+    close(fd);
+    
+    string output = { 0 };
+    check(read_history_output(&history, 0, 0, &output) == -1 && output.data == NULL);
+    check(read_history_output(&history, 0, 1, &output) != -1 && output.length == 0);
+    free(output.data);
+    
+    close_history(&history);
+    free(outputs[0].data);
+    free(outputs[1].data);
+}
+
+static void test_find_runs() {
+    uint32_t lengths[2] = { 1, 1 };
+    string outputs[2];
+    uint64_t run = 0;
+    
+    check(truncate(g_history_path, 0) != -1);
+    history history;
+    check(open_history(&history, g_history_path, 0) != -1);
+    check(find_history_run(&history, 0, &run) == -1);
+    check(find_history_run_at(&history, 100, &run) == -1);
+    
+    // Several runs can be made at the same time (the latest one is found).
+    uint64_t times[] = { 100, 200, 200, 300 };
+    for (uint32_t i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        append_run(&history, times[i], lengths, CONTENT_LOG, outputs);
+        free(outputs[0].data);
+        free(outputs[1].data);
+    }
+    
+    check(find_history_run(&history, 0, &run) != -1 && run == 3);
+    check(find_history_run(&history, 3, &run) != -1 && run == 0);
+    check(find_history_run(&history, 4, &run) == -1);
+    
+    check(find_history_run_at(&history, 0, &run) == -1);
+    check(find_history_run_at(&history, 99, &run) == -1);
+    check(find_history_run_at(&history, 100, &run) != -1 && run == 0);
+    check(find_history_run_at(&history, 199, &run) != -1 && run == 0);
+    check(find_history_run_at(&history, 200, &run) != -1 && run == 2);
+    check(find_history_run_at(&history, 299, &run) != -1 && run == 2);
+    check(find_history_run_at(&history, 300, &run) != -1 && run == 3);
+    check(find_history_run_at(&history, UINT64_MAX, &run) != -1 && run == 3);
+    
+    close_history(&history);
+}
+
+int main() {
+    srand(42);
+    
+    int fd = mkstemp(g_history_path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    
+    test_lz_round_trips();
+    test_round_trips();
+    test_truncated_records();
+    test_corrupted_lengths();
+    test_find_runs();
+    
+    unlink(g_history_path);
+    
+    return checks_exit_code();
+}
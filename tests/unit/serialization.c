@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sy5/utils.h>
+#include "check.h"
+
+// Tests the reading of strings and command lines: they round trip, and a malformed length is rejected before anything
+// is allocated for it (from memory as from a file descriptor).
+
+static void test_round_trip() {
+    char *argv[] = { "echo", "", "hello world" };
+    task written = { .taskid = 42 };
+    check(timing_from_strings(&written.timing, "0,30", "8-18", "1-5") != -1);
+    check(commandline_from_args(&written.commandline, 3, argv) != -1);
+    
+    buffer buf = create_buffer();
+    check(write_task(&buf, &written, 1) != -1);
+    reader rd = create_memory_reader(buf.data, buf.length);
+    task read;
+    check(read_task(&rd, &read, 1) != -1);
+    check(rd.position == buf.length);
+    
+    check(read.taskid == 42 && read.commandline.argc == 3);
+    for (uint32_t i = 0; i < 3 && i < read.commandline.argc; i++) {
+        check(read.commandline.argv[i].length == strlen(argv[i]));
+        check(strcmp((char *)read.commandline.argv[i].data, argv[i]) == 0);
+    }
+    
+    free_task(&read);
+    free_task(&written);
+    free(buf.data);
+}
+
+static void test_malformed_lengths() {
+    // A length which wrapped the size of the allocation around.
+    const uint8_t wrapping[] = { 0xff, 0xff, 0xff, 0xff, 'a', 'b', 'c', 'd' };
+    reader rd = create_memory_reader(wrapping, sizeof(wrapping));
+    string read;
+    check(read_string(&rd, &read) == -1);
+    
+    // A length longer than the bytes left by one.
+    const uint8_t too_long[] = { 0, 0, 0, 5, 'a', 'b', 'c', 'd' };
+    rd = create_memory_reader(too_long, sizeof(too_long));
+    check(read_string(&rd, &read) == -1);
+    
+    const uint8_t exact[] = { 0, 0, 0, 4, 'a', 'b', 'c', 'd' };
+    rd = create_memory_reader(exact, sizeof(exact));
+    check(read_string(&rd, &read) != -1 && read.length == 4);
+    free_string(&read);
+    
+    // A command line with more arguments than bytes left, then one whose last argument is truncated.
+    const uint8_t too_many[] = { 0x10, 0, 0, 0, 0, 0, 0, 0 };
+    rd = create_memory_reader(too_many, sizeof(too_many));
+    commandline commandline;
+    check(read_commandline(&rd, &commandline) == -1 && commandline.argc == 0 && commandline.argv == NULL);
+    
+    const uint8_t truncated[] = { 0, 0, 0, 2, 0, 0, 0, 1, 'a', 0, 0, 0, 2, 'b' };
+    rd = create_memory_reader(truncated, sizeof(truncated));
+    check(read_commandline(&rd, &commandline) == -1 && commandline.argc == 0 && commandline.argv == NULL);
+}
+
+static void test_malformed_length_from_descriptor() {
+    // The end of a pipe is not known, so the length is only bounded by `STRING_MAX_LENGTH` (here exceeded by one).
+    int fds[2];
+    check(pipe(fds) != -1);
+    const uint8_t bytes[] = { 0x01, 0, 0, 1, 'a', 'b', 'c', 'd' };
+    check(write(fds[1], bytes, sizeof(bytes)) == (ssize_t)sizeof(bytes));
+    close(fds[1]);
+    
+    reader rd = create_reader(fds[0]);
+    string read;
+    check(read_string(&rd, &read) == -1);
+    close(fds[0]);
+}
+
+int main() {
+    test_round_trip();
+    test_malformed_lengths();
+    test_malformed_length_from_descriptor();
+    
+    return checks_exit_code();
+}
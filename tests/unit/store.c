@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sy5/utils.h>
+#include <sy5/array.h>
+#include <sy5/store.h>
+#include "check.h"
+
+// Tests the store: its tasks and their extents survive a reopening, the pages of replaced extents and removed tasks
+// are reused, and the table grows (keeping every task) once its slots are used.
+
+// Size of a page of the store (as in src/store.c).
+#define PAGE_SIZE 4096
+
+// Number of tasks added to grow the table twice (a table of one page holds 64 entries).
+#define GROWN_TASKS_COUNT (2 * 64 + 1)
+
+static char g_root_path[] = "/tmp/saturnd-test-store-XXXXXX";
+static char g_store_path[sizeof(g_root_path) + sizeof(STORE_FILE_NAME)];
+
+static off_t store_size() {
+    struct stat stats;
+    
+    return stat(g_store_path, &stats) == -1 ? -1 : stats.st_size;
+}
+
+static void reopen_store() {
+    close_store();
+    check(open_store(g_root_path) != -1);
+}
+
+static uint64_t tasks_count() {
+    uint64_t *taskids = NULL;
+    check(list_store_taskids(&taskids) != -1);
+    uint64_t count = array_size(taskids);
+    array_free(taskids);
+    
+    return count;
+}
+
+// Checks that an extent of a task holds `length` bytes of `expected`, and gives its offset in the file.
+static uint64_t check_extent(uint64_t taskid, store_extent_kind kind, const void *expected, uint32_t length) {
+    uint32_t slot;
+    const uint8_t *data;
+    uint32_t found_length = 0;
+    uint64_t offset = 0;
+    
+    check(find_store_slot(&slot, taskid) != -1);
+    check(get_store_extent(slot, kind, &data, &found_length, &offset) != -1);
+    check(found_length == length && memcmp(data, expected, length) == 0);
+    
+    return offset;
+}
+
+static void test_round_trip() {
+    uint32_t slot;
+    check(add_store_slot(&slot, 7) != -1);
+    check(write_store_extent(slot, STORE_EXTENT_TASK, "task", 4) != -1);
+    check(write_store_extent(slot, STORE_EXTENT_STDOUT, "hello\n", 6) != -1);
+    
+    // A task whose `STORE_EXTENT_TASK` was never written was not completely added.
+    uint32_t partial_slot;
+    check(add_store_slot(&partial_slot, 8) != -1);
+    check(tasks_count() == 2);
+    
+    reopen_store();
+    check(tasks_count() == 1);
+    check(find_store_slot(&partial_slot, 8) == -1);
+    check_extent(7, STORE_EXTENT_TASK, "task", 4);
+    check_extent(7, STORE_EXTENT_STDOUT, "hello\n", 6);
+    check_extent(7, STORE_EXTENT_STDERR, "", 0);
+}
+
+static void test_extent_reuse() {
+    uint32_t slot;
+    check(find_store_slot(&slot, 7) != -1);
+    
+    // The data is written in new pages while the old ones are still used, which are then freed for the next write.
+    uint8_t *output = malloc(3 * PAGE_SIZE);
+    check(output != NULL);
+    memset(output, 'a', 3 * PAGE_SIZE);
+    check(write_store_extent(slot, STORE_EXTENT_STDOUT, output, 3 * PAGE_SIZE) != -1);
+    uint64_t first_offset = check_extent(7, STORE_EXTENT_STDOUT, output, 3 * PAGE_SIZE);
+    
+    memset(output, 'b', 3 * PAGE_SIZE);
+    check(write_store_extent(slot, STORE_EXTENT_STDOUT, output, 3 * PAGE_SIZE) != -1);
+    check(check_extent(7, STORE_EXTENT_STDOUT, output, 3 * PAGE_SIZE) != first_offset);
+    off_t size = store_size();
+    
+    for (unsigned int i = 0; i < 10; i++) {
+        memset(output, 'c' + i, 3 * PAGE_SIZE);
+        check(write_store_extent(slot, STORE_EXTENT_STDOUT, output, 3 * PAGE_SIZE) != -1);
+    }
+    check(store_size() == size);
+    
+    // The free pages are recomputed when the store is opened.
+    reopen_store();
+    check(find_store_slot(&slot, 7) != -1);
+    uint64_t removed_offset = check_extent(7, STORE_EXTENT_STDOUT, output, 3 * PAGE_SIZE);
+    check(store_size() == size);
+    
+    // The pages of a removed task are only reused once it is released (the first free pages big enough are used).
+    check(remove_store_slot(slot) != -1);
+    check(find_store_slot(&slot, 7) == -1);
+    uint32_t new_slot;
+    check(add_store_slot(&new_slot, 9) != -1);
+    check(write_store_extent(new_slot, STORE_EXTENT_TASK, output, 3 * PAGE_SIZE) != -1);
+    uint64_t offset = check_extent(9, STORE_EXTENT_TASK, output, 3 * PAGE_SIZE);
+    check(offset + 3 * PAGE_SIZE <= removed_offset || offset >= removed_offset + 3 * PAGE_SIZE);
+    
+    release_store_slot(slot);
+    check(write_store_extent(new_slot, STORE_EXTENT_STDERR, output, 3 * PAGE_SIZE) != -1);
+    check(check_extent(9, STORE_EXTENT_STDERR, output, 3 * PAGE_SIZE) <= removed_offset);
+    
+    reopen_store();
+    check(tasks_count() == 1);
+    check(find_store_slot(&slot, 7) == -1);
+    check_extent(9, STORE_EXTENT_STDERR, output, 3 * PAGE_SIZE);
+    
+    free(output);
+}
+
+static void test_table_growth() {
+    for (uint64_t taskid = 100; taskid < 100 + GROWN_TASKS_COUNT; taskid++) {
+        uint32_t slot;
+        check(add_store_slot(&slot, taskid) != -1);
+        check(write_store_extent(slot, STORE_EXTENT_TASK, &taskid, sizeof(taskid)) != -1);
+    }
+    
+    reopen_store();
+    check(tasks_count() == 1 + GROWN_TASKS_COUNT);
+    for (uint64_t taskid = 100; taskid < 100 + GROWN_TASKS_COUNT; taskid++) {
+        check_extent(taskid, STORE_EXTENT_TASK, &taskid, sizeof(taskid));
+    }
+    check_extent(9, STORE_EXTENT_STDOUT, "", 0);
+}
+
+int main() {
+    if (mkdtemp(g_root_path) == NULL) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    snprintf(g_store_path, sizeof(g_store_path), "%s/%s", g_root_path, STORE_FILE_NAME);
+    
+    check(open_store(g_root_path) != -1);
+    test_round_trip();
+    test_extent_reuse();
+    test_table_growth();
+    close_store();
+    
+    unlink(g_store_path);
+    rmdir(g_root_path);
+    
+    return checks_exit_code();
+}
@@ -0,0 +1,167 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sy5/utils.h>
+#include "check.h"
+
+// Tests `timing_next_fire` against a brute-force search testing every minute (over more than a week, after which a
+// timing which matched nothing never matches), around month and year rollovers, DST transitions and for every
+// combination of days of the week.
+
+#define RANDOM_TIMINGS_COUNT 300
+#define SEARCHES_PER_TIMING 4
+
+#define ALL_MINUTES ((1ULL << 60) - 1)
+#define ALL_HOURS ((1U << 24) - 1)
+#define ALL_DAYSOFWEEK ((1U << 7) - 1)
+
+static time_t brute_force_next_fire(const timing *timing, time_t from) {
+    time_t timestamp = from - from % 60;
+    
+    for (unsigned int i = 0; i < 8 * 24 * 60; i++) {
+        struct tm time_info;
+        localtime_r(&timestamp, &time_info);
+        
+        if (((timing->daysofweek >> time_info.tm_wday) & 1) && ((timing->hours >> time_info.tm_hour) & 1) &&
+            ((timing->minutes >> time_info.tm_min) & 1)) {
+            return timestamp;
+        }
+        
+        timestamp += 60;
+    }
+    
+    return -1;
+}
+
+// Returns the time of a local date (with `month` from 1 to 12).
+static time_t local_time(int year, int month, int day, int hour, int minute, int second) {
+    struct tm time_info = {
+        .tm_year = year - 1900,
+        .tm_mon = month - 1,
+        .tm_mday = day,
+        .tm_hour = hour,
+        .tm_min = minute,
+        .tm_sec = second,
+        .tm_isdst = -1
+    };
+    
+    return mktime(&time_info);
+}
+
+// Checks that `timing_next_fire` finds the same minute as the brute-force search (reporting the timing otherwise).
+static void check_next_fire(uint64_t minutes, uint32_t hours, uint8_t daysofweek, time_t from) {
+    timing timing = { .minutes = minutes, .hours = hours, .daysofweek = daysofweek };
+    time_t expected = brute_force_next_fire(&timing, from);
+    time_t found = timing_next_fire(&timing, from);
+    
+    check(found == expected);
+    if (found != expected) {
+        fprintf(stderr, "  minutes %#llx hours %#x days %#x from %lld: found %lld instead of %lld\n",
+            (unsigned long long)minutes, hours, daysofweek, (long long)from, (long long)found, (long long)expected);
+    }
+}
+
+static uint64_t random_field(unsigned int bits, unsigned int density) {
+    uint64_t field = 0;
+    
+    for (unsigned int i = 0; i < bits; i++) {
+        if (rand() % density == 0) {
+            field |= 1ULL << i;
+        }
+    }
+    
+    return field;
+}
+
+static void test_empty_timings() {
+    time_t now = local_time(2024, 5, 14, 10, 0, 0);
+    timing timings[] = {
+        { .minutes = 0, .hours = ALL_HOURS, .daysofweek = ALL_DAYSOFWEEK },
+        { .minutes = ALL_MINUTES, .hours = 0, .daysofweek = ALL_DAYSOFWEEK },
+        { .minutes = ALL_MINUTES, .hours = ALL_HOURS, .daysofweek = 0 },
+        // Only the bits of existing minutes, hours and days count.
+        { .minutes = ~ALL_MINUTES, .hours = ~ALL_HOURS, .daysofweek = (uint8_t)~ALL_DAYSOFWEEK }
+    };
+    
+    for (unsigned int i = 0; i < sizeof(timings) / sizeof(timings[0]); i++) {
+        check(timing_next_fire(&timings[i], now) == -1);
+    }
+}
+
+static void test_rollovers() {
+    // The minute in progress matches (its seconds are ignored).
+    timing every_minute = { .minutes = ALL_MINUTES, .hours = ALL_HOURS, .daysofweek = ALL_DAYSOFWEEK };
+    check(timing_next_fire(&every_minute, local_time(2024, 5, 14, 10, 7, 42)) == local_time(2024, 5, 14, 10, 7, 0));
+    
+    // Year rollover.
+    timing midnight = { .minutes = 1, .hours = 1, .daysofweek = ALL_DAYSOFWEEK };
+    check(timing_next_fire(&midnight, local_time(2023, 12, 31, 23, 59, 30)) == local_time(2024, 1, 1, 0, 0, 0));
+    check_next_fire(1, 1, ALL_DAYSOFWEEK, local_time(2023, 12, 31, 0, 0, 1));
+    
+    // Month rollovers, including the 29th of February (a thursday in 2024).
+    check(timing_next_fire(&midnight, local_time(2024, 1, 31, 23, 30, 0)) == local_time(2024, 2, 1, 0, 0, 0));
+    timing thursdays = { .minutes = 1, .hours = 1, .daysofweek = 1 << 4 };
+    check(timing_next_fire(&thursdays, local_time(2024, 2, 28, 23, 59, 0)) == local_time(2024, 2, 29, 0, 0, 0));
+    check(timing_next_fire(&thursdays, local_time(2023, 2, 28, 12, 0, 0)) == local_time(2023, 3, 2, 0, 0, 0));
+    check_next_fire(1ULL << 59, 1U << 23, 1 << 2, local_time(2024, 4, 30, 23, 59, 59));
+    
+    // The last minute of a week only matches a week later once passed.
+    check_next_fire(1ULL << 59, 1U << 23, 1 << 6, local_time(2024, 6, 1, 23, 59, 0));
+    check_next_fire(1ULL << 59, 1U << 23, 1 << 6, local_time(2024, 6, 2, 0, 0, 0));
+}
+
+static void test_dst_transitions() {
+    // The hour skipped in spring and the hour repeated in autumn (in Europe/Paris).
+    time_t transitions[] = { local_time(2024, 3, 31, 1, 30, 0), local_time(2024, 10, 27, 1, 30, 0) };
+    
+    for (unsigned int i = 0; i < sizeof(transitions) / sizeof(transitions[0]); i++) {
+        check_next_fire(ALL_MINUTES, 1U << 2, ALL_DAYSOFWEEK, transitions[i]);
+        check_next_fire(1ULL << 30, 1U << 2 | 1U << 3, 1, transitions[i]);
+        check_next_fire(1ULL << 15, ALL_HOURS, ALL_DAYSOFWEEK, transitions[i] + 45 * 60);
+        check_next_fire(1ULL << 15, ALL_HOURS, ALL_DAYSOFWEEK, transitions[i] + 105 * 60);
+    }
+}
+
+static void test_daysofweek_combinations() {
+    // Every combination of days, from every day of a week (at a time after the matching hours of the day).
+    time_t monday = local_time(2024, 7, 1, 18, 20, 0);
+    
+    for (unsigned int days = 1; days <= ALL_DAYSOFWEEK; days++) {
+        for (unsigned int day = 0; day < 7; day++) {
+            check_next_fire(1ULL << 10 | 1ULL << 40, 1U << 8 | 1U << 18, (uint8_t)days, monday + day * 24 * 60 * 60);
+        }
+    }
+}
+
+static void test_random_timings() {
+    time_t start = local_time(2023, 1, 1, 0, 0, 0);
+    
+    for (unsigned int i = 0; i < RANDOM_TIMINGS_COUNT; i++) {
+        uint64_t minutes = random_field(60, 1 + rand() % 30);
+        uint32_t hours = (uint32_t)random_field(24, 1 + rand() % 12);
+        uint8_t daysofweek = (uint8_t)random_field(7, 1 + rand() % 4);
+        
+        for (unsigned int j = 0; j < SEARCHES_PER_TIMING; j++) {
+            time_t from = start + (time_t)(rand() % (2 * 366 * 24 * 60)) * 60 + rand() % 60;
+            check_next_fire(minutes, hours, daysofweek, from);
+        }
+    }
+}
+
+int main() {
+    srand(42);
+    
+    const char *timezones[] = { "UTC", "Europe/Paris" };
+    for (unsigned int i = 0; i < sizeof(timezones) / sizeof(timezones[0]); i++) {
+        setenv("TZ", timezones[i], 1);
+        tzset();
+        
+        test_empty_timings();
+        test_rollovers();
+        test_dst_transitions();
+        test_daysofweek_combinations();
+        test_random_timings();
+    }
+    
+    return checks_exit_code();
+}